@@ -3,13 +3,32 @@ use alloc::vec;
 use vec::Vec;
 
 pub const DEVICE_SIZE: usize = 10 * 1024 * 1024;
+pub const PAGE_SIZE: usize = 4096;
 
-static mut DATA: Vec<u8> = Vec::new();
+/// The device is stored in pages so that its data is page-aligned and pages of it can be mapped
+/// into the address space of processes.
+#[derive(Clone, Copy)]
+#[repr(C, align(4096))]
+struct Page([u8; PAGE_SIZE]);
+
+static mut DATA: Vec<Page> = Vec::new();
 
 /// Initialize the block device.
 /// Must be called before performing any other operation on the block device.
 pub fn init() {
-    unsafe { DATA = vec![0; DEVICE_SIZE] }
+    unsafe { DATA = vec![Page([0; PAGE_SIZE]); DEVICE_SIZE / PAGE_SIZE] }
+}
+
+/// Get a pointer to the data of the block device, so that it can be accessed without being
+/// copied.
+///
+/// # Arguments
+/// - `addr` - The offset in the block device.
+///
+/// # Safety
+/// This operation is unsafe because it uses raw pointers.
+pub unsafe fn as_ptr(addr: usize) -> *const u8 {
+    (DATA.as_ptr() as *const u8).add(addr)
 }
 
 /// Set `size` bytes starting in offset `addr` to `value`.
@@ -18,7 +37,7 @@ pub fn init() {
 /// This operation is unsafe because it uses raw pointers.
 pub unsafe fn set(addr: usize, size: usize, value: u8) {
     for i in 0..size {
-        core::ptr::write(DATA.as_mut_ptr().add(addr + i), value);
+        core::ptr::write((DATA.as_mut_ptr() as *mut u8).add(addr + i), value);
     }
 }
 
@@ -32,7 +51,7 @@ pub unsafe fn set(addr: usize, size: usize, value: u8) {
 /// # Safety
 /// This operation is unsafe because it uses raw pointers.
 pub unsafe fn read(addr: usize, size: usize, ans: *mut u8) {
-    core::ptr::copy_nonoverlapping(DATA.as_ptr().add(addr), ans, size);
+    core::ptr::copy_nonoverlapping(as_ptr(addr), ans, size);
 }
 
 /// Write to the block device.
@@ -45,5 +64,5 @@ pub unsafe fn read(addr: usize, size: usize, ans: *mut u8) {
 /// # Safety
 /// This operation is unafe because it uses pointers.
 pub unsafe fn write(addr: usize, size: usize, data: *const u8) {
-    core::ptr::copy_nonoverlapping(data, DATA.as_mut_ptr().add(addr), size)
+    core::ptr::copy_nonoverlapping(data, (DATA.as_mut_ptr() as *mut u8).add(addr), size)
 }
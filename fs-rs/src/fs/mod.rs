@@ -227,6 +227,38 @@ pub unsafe fn read_dir(file: usize, offset: usize) -> Option<DirEntry> {
     Some(buffer)
 }
 
+/// Read consecutive entries of a directory with a single read of the directory.
+///
+/// # Arguments
+/// - `file` - the file id
+/// - `offset` - The offset **in files** inside the dir of the first entry to read.
+/// - `entries` - The buffer to read the entries into.
+///
+/// # Returns
+/// The amount of entries that were read, which is less than the length of `entries` when the
+/// end of the directory is reached, or `None` if the directory doesn't exist or `file` is not a
+/// directory.
+pub unsafe fn read_dir_entries(
+    file: usize,
+    offset: usize,
+    entries: &mut [DirEntry],
+) -> Option<usize> {
+    if !read_inode(file)?.is_dir() {
+        return None;
+    }
+
+    Some(
+        read(
+            file,
+            core::slice::from_raw_parts_mut(
+                entries.as_mut_ptr() as *mut u8,
+                entries.len() * core::mem::size_of::<DirEntry>(),
+            ),
+            offset * core::mem::size_of::<DirEntry>(),
+        )? / core::mem::size_of::<DirEntry>(),
+    )
+}
+
 /// Returns `true` if a bit in a bitmap is set to 1.
 ///
 /// # Arguments
@@ -522,6 +554,17 @@ pub fn get_file_size(id: usize) -> Option<usize> {
     Some(read_inode(id)?.size())
 }
 
+/// Returns a file's size and whether it is a directory, reading its inode once, or `None` if the
+/// file was not found.
+///
+/// # Arguments
+/// - `id` - The id of the file.
+pub fn get_file_info(id: usize) -> Option<(usize, bool)> {
+    let inode = read_inode(id)?;
+
+    Some((inode.size(), inode.is_dir()))
+}
+
 /// Initialize the file system.
 /// Must be called before performing any other operation.
 ///
@@ -771,6 +814,34 @@ pub unsafe fn read(file: usize, buffer: &mut [u8], offset: usize) -> Option<usiz
     Some(bytes_read)
 }
 
+/// Get a pointer to the data of a block of a file, so that the data can be accessed without being
+/// copied.
+/// The blocks of the device are page-aligned, so the block can be mapped as a page.
+///
+/// # Arguments
+/// - `file` - The file's id.
+/// - `index` - The index of the block in the file.
+///
+/// # Returns
+/// A pointer to the block, null if the block is a hole in the file that reads as null bytes, or
+/// `None` if the file doesn't exist or the block is beyond the file's size.
+pub unsafe fn get_block(file: usize, index: usize) -> Option<*const u8> {
+    let inode = read_inode(file)?;
+    let pointer;
+
+    if index * BLOCK_SIZE >= inode.size() {
+        return None;
+    }
+    // UNWRAP: We check that we don't exceed the file's size
+    pointer = inode.get_ptr(index).unwrap();
+
+    if pointer == 0 {
+        Some(core::ptr::null())
+    } else {
+        Some(blkdev::as_ptr(pointer))
+    }
+}
+
 /// Change the length of a file to a specific length.
 /// If the file has been set to a greater length, reading the extra data will return null bytes
 /// until the data is being written.
@@ -0,0 +1,437 @@
+#include "bitmap.h"
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void Bitmap::load(const Journal& journal, uint64_t address, int bits, int free)
+{
+    const size_t WORDS = (bits + BITS_IN_WORD - 1) / BITS_IN_WORD;
+    const int PADDING = (int)(WORDS * BITS_IN_WORD) - bits;
+
+    this->_address = address;
+    this->_bits = bits;
+    this->_cursor = 0;
+    this->_words.assign(WORDS, 0);
+    this->_dirty.assign((WORDS + BITS_IN_WORD - 1) / BITS_IN_WORD, 0);
+    this->_blockSize = journal.blockSize();
+    this->_dirtyBlocks.assign((address + WORDS * sizeof(uint64_t) + this->_blockSize - 1) / this->_blockSize -
+                                      address / this->_blockSize,
+                              false);
+    this->_dirtyBlockCount = 0;
+    journal.read(address, WORDS * sizeof(uint64_t), (char*)this->_words.data());
+
+    // the bits after the end of the bitmap are never free
+    if (PADDING != 0)
+    {
+        this->_words.back() |= ALL_OCCUPIED << (BITS_IN_WORD - PADDING);
+    }
+
+    this->_free = free;
+    if (free == -1)
+    {
+        this->_free = 0;
+        for (uint64_t word : this->_words)
+        {
+            this->_free += BITS_IN_WORD - __builtin_popcountll(word);
+        }
+    }
+}
+
+void Bitmap::flush(Journal& journal)
+{
+    const size_t WORDS = this->_words.size();
+    size_t first{};
+    size_t last{};
+
+    for (size_t i = 0; i < this->_dirty.size(); i++)
+    {
+        while (this->_dirty[i] != 0)
+        {
+            // find the run of dirty words that starts at the lowest dirty bit
+            first = i * BITS_IN_WORD + __builtin_ctzll(this->_dirty[i]);
+            last = first;
+            while (last + 1 < WORDS &&
+                   this->_dirty[(last + 1) / BITS_IN_WORD] & ((uint64_t)1 << ((last + 1) % BITS_IN_WORD)))
+            {
+                last++;
+            }
+            journal.write(this->_address + first * sizeof(uint64_t),
+                          (last - first + 1) * sizeof(uint64_t),
+                          (const char*)(this->_words.data() + first));
+            for (size_t word = first; word <= last; word++)
+            {
+                this->_dirty[word / BITS_IN_WORD] &= ~((uint64_t)1 << (word % BITS_IN_WORD));
+            }
+        }
+    }
+    this->_dirtyBlocks.assign(this->_dirtyBlocks.size(), false);
+    this->_dirtyBlockCount = 0;
+}
+
+int Bitmap::dirtyBlocks() const
+{
+    return this->_dirtyBlockCount;
+}
+
+void Bitmap::markPending(int start, int length)
+{
+    const size_t LAST = (size_t)(start + length - 1) / BITS_IN_WORD;
+    const size_t WORDS_IN_BLOCK = this->_blockSize / sizeof(uint64_t);
+
+    if (length <= 0)
+    {
+        return;
+    }
+    // a word in every block is enough, and the last word may be in a block
+    // that the steps skip
+    for (size_t word = (size_t)start / BITS_IN_WORD; word < LAST; word += WORDS_IN_BLOCK)
+    {
+        this->_markBlockDirty(word);
+    }
+    this->_markBlockDirty(LAST);
+}
+
+int Bitmap::allocate()
+{
+    size_t word{};
+    int bit{};
+
+    if (this->_free == 0)
+    {
+        return -1;
+    }
+
+    // the bitmap isn't full, so if there's no free entry after the cursor
+    // there is one before it
+    word = this->_findWord(this->_cursor / BITS_IN_WORD, ALL_OCCUPIED);
+    if (word == this->_words.size())
+    {
+        word = this->_findWord(0, ALL_OCCUPIED);
+    }
+    bit = (int)(word * BITS_IN_WORD) + __builtin_ctzll(~this->_words[word]);
+    this->set(bit);
+    this->_cursor = bit + 1 < this->_bits ? bit + 1 : 0;
+
+    return bit;
+}
+
+int Bitmap::allocateRun(int length)
+{
+    int start = this->findRun(length, this->_cursor);
+
+    if (start == -1)
+    {
+        start = this->findRun(length, 0);
+    }
+    if (start != -1)
+    {
+        this->setRange(start, length);
+        this->_cursor = start + length < this->_bits ? start + length : 0;
+    }
+
+    return start;
+}
+
+std::vector<Bitmap::Run> Bitmap::allocateRuns(int count, int goal)
+{
+    std::vector<Run> runs;
+    std::vector<Run> freeRuns;
+    int remaining = count;
+    int start{};
+    int end{};
+    bool wrapped = false;
+
+    if (count <= 0 || count > this->_free)
+    {
+        return runs;
+    }
+
+    if (goal < 0 || goal >= this->_bits)
+    {
+        goal = this->_cursor;
+    }
+    else if (!this->test(goal))
+    {
+        // extend the run that ends right before the goal
+        end = std::min(this->_nextUsed(goal), goal + remaining);
+        runs.push_back({ goal, end - goal });
+        remaining -= end - goal;
+    }
+
+    // look for a single free run that fits, keeping the runs that don't
+    start = this->_nextFree(goal);
+    while (remaining != 0 && !(wrapped && start >= goal))
+    {
+        if (start == this->_bits)
+        {
+            wrapped = true;
+            start = this->_nextFree(0);
+            continue;
+        }
+        end = this->_nextUsed(start);
+        if (wrapped && end > goal)
+        {
+            end = goal;
+        }
+        if (!runs.empty() && runs.front().start == start)
+        {
+            // the free run that the goal extension already used
+            start = this->_nextFree(end);
+            continue;
+        }
+        if (end - start >= remaining)
+        {
+            runs.push_back({ start, remaining });
+            remaining = 0;
+        }
+        else
+        {
+            freeRuns.push_back({ start, end - start });
+            start = this->_nextFree(end);
+        }
+    }
+
+    // split what's left over as few runs as possible
+    std::sort(freeRuns.begin(), freeRuns.end(), [](const Run& first, const Run& second) {
+        return first.length > second.length;
+    });
+    for (size_t i = 0; remaining != 0 && i < freeRuns.size(); i++)
+    {
+        freeRuns[i].length = std::min(freeRuns[i].length, remaining);
+        runs.push_back(freeRuns[i]);
+        remaining -= freeRuns[i].length;
+    }
+
+    for (const Run& run : runs)
+    {
+        this->setRange(run.start, run.length);
+    }
+    this->_cursor = runs.back().start + runs.back().length;
+    if (this->_cursor >= this->_bits)
+    {
+        this->_cursor = 0;
+    }
+
+    return runs;
+}
+
+int Bitmap::findRun(int length, int from) const
+{
+    int start = this->_nextFree(from);
+    int end{};
+
+    if (length > this->_free)
+    {
+        return -1;
+    }
+    while (start < this->_bits)
+    {
+        end = this->_nextUsed(start);
+        if (end - start >= length)
+        {
+            return start;
+        }
+        start = this->_nextFree(end);
+    }
+
+    return -1;
+}
+
+void Bitmap::set(int n)
+{
+    const size_t WORD = n / BITS_IN_WORD;
+    const uint64_t MASK = (uint64_t)1 << (n % BITS_IN_WORD);
+
+    if (!(this->_words[WORD] & MASK))
+    {
+        this->_words[WORD] |= MASK;
+        this->_free--;
+        this->_markDirty(WORD);
+    }
+}
+
+void Bitmap::clear(int n)
+{
+    const size_t WORD = n / BITS_IN_WORD;
+    const uint64_t MASK = (uint64_t)1 << (n % BITS_IN_WORD);
+
+    if (this->_words[WORD] & MASK)
+    {
+        this->_words[WORD] &= ~MASK;
+        this->_free++;
+        this->_markDirty(WORD);
+    }
+}
+
+void Bitmap::setRange(int start, int length)
+{
+    const int END = start + length;
+    int bit = start;
+    int inWord{};
+    uint64_t mask{};
+    size_t word{};
+
+    // set a whole word, or the part of it that is in the range, at a time
+    while (bit < END)
+    {
+        word = bit / BITS_IN_WORD;
+        inWord = std::min(BITS_IN_WORD - bit % BITS_IN_WORD, END - bit);
+        mask = inWord == BITS_IN_WORD ? ALL_OCCUPIED :
+               (((uint64_t)1 << inWord) - 1) << (bit % BITS_IN_WORD);
+        this->_free -= inWord - __builtin_popcountll(this->_words[word] & mask);
+        this->_words[word] |= mask;
+        this->_markDirty(word);
+        bit += inWord;
+    }
+}
+
+void Bitmap::clearRange(int start, int length)
+{
+    const int END = start + length;
+    int bit = start;
+    int inWord{};
+    uint64_t mask{};
+    size_t word{};
+
+    // clear a whole word, or the part of it that is in the range, at a time
+    while (bit < END)
+    {
+        word = bit / BITS_IN_WORD;
+        inWord = std::min(BITS_IN_WORD - bit % BITS_IN_WORD, END - bit);
+        mask = inWord == BITS_IN_WORD ? ALL_OCCUPIED :
+               (((uint64_t)1 << inWord) - 1) << (bit % BITS_IN_WORD);
+        this->_free += __builtin_popcountll(this->_words[word] & mask);
+        this->_words[word] &= ~mask;
+        this->_markDirty(word);
+        bit += inWord;
+    }
+}
+
+bool Bitmap::test(int n) const
+{
+    return this->_words[n / BITS_IN_WORD] & ((uint64_t)1 << (n % BITS_IN_WORD));
+}
+
+int Bitmap::size() const
+{
+    return this->_bits;
+}
+
+int Bitmap::countFree() const
+{
+    return this->_free;
+}
+
+/**
+ * Find the first word that is different from a value.
+ * @param from the index of the word to start searching from.
+ * @param skip the value of the words to skip.
+ * @return the index of the word or the amount of words if not found.
+ */
+size_t Bitmap::_findWord(size_t from, uint64_t skip) const
+{
+    const size_t WORDS = this->_words.size();
+    size_t i = from;
+
+#ifdef __SSE2__
+    // compare two words at a time
+    const __m128i SKIP = _mm_set1_epi64x((long long)skip);
+
+    for (; i + 2 <= WORDS; i += 2)
+    {
+        __m128i pair = _mm_loadu_si128((const __m128i*)(this->_words.data() + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(pair, SKIP)) != 0xFFFF)
+        {
+            break;
+        }
+    }
+#endif
+    for (; i < WORDS; i++)
+    {
+        if (this->_words[i] != skip)
+        {
+            return i;
+        }
+    }
+
+    return WORDS;
+}
+
+/**
+ * Get the index of the first free entry at or after an index, or the size of
+ * the bitmap if there is none.
+ */
+int Bitmap::_nextFree(int from) const
+{
+    size_t word = from / BITS_IN_WORD;
+    uint64_t free{};
+
+    if (from >= this->_bits)
+    {
+        return this->_bits;
+    }
+    free = ~this->_words[word] & (ALL_OCCUPIED << (from % BITS_IN_WORD));
+    if (free == 0)
+    {
+        word = this->_findWord(word + 1, ALL_OCCUPIED);
+        if (word == this->_words.size())
+        {
+            return this->_bits;
+        }
+        free = ~this->_words[word];
+    }
+
+    return std::min(this->_bits, (int)(word * BITS_IN_WORD) + __builtin_ctzll(free));
+}
+
+/**
+ * Get the index of the first occupied entry at or after an index, or the size
+ * of the bitmap if there is none.
+ */
+int Bitmap::_nextUsed(int from) const
+{
+    size_t word = from / BITS_IN_WORD;
+    uint64_t used{};
+
+    if (from >= this->_bits)
+    {
+        return this->_bits;
+    }
+    used = this->_words[word] & (ALL_OCCUPIED << (from % BITS_IN_WORD));
+    if (used == 0)
+    {
+        word = this->_findWord(word + 1, 0);
+        if (word == this->_words.size())
+        {
+            return this->_bits;
+        }
+        used = this->_words[word];
+    }
+
+    return std::min(this->_bits, (int)(word * BITS_IN_WORD) + __builtin_ctzll(used));
+}
+
+void Bitmap::_markDirty(size_t word)
+{
+    this->_dirty[word / BITS_IN_WORD] |= (uint64_t)1 << (word % BITS_IN_WORD);
+    this->_markBlockDirty(word);
+}
+
+/**
+ * Mark the block of the device that holds a word as written by the next
+ * flush, and count it if it wasn't marked yet.
+ * @param word the index of the word.
+ */
+void Bitmap::_markBlockDirty(size_t word)
+{
+    const size_t BLOCK = (this->_address + word * sizeof(uint64_t)) / this->_blockSize -
+                         this->_address / this->_blockSize;
+
+    if (!this->_dirtyBlocks[BLOCK])
+    {
+        this->_dirtyBlocks[BLOCK] = true;
+        this->_dirtyBlockCount++;
+    }
+}
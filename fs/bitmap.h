@@ -0,0 +1,125 @@
+#ifndef __BITMAP_H__
+#define __BITMAP_H__
+
+#include <vector>
+#include <cstdint>
+#include "journal.h"
+
+/**
+ * An in-memory copy of an allocation bitmap that is stored on the block device.
+ * A set bit marks an occupied entry. The bits are kept in 64-bit words, so
+ * free entries are found a word at a time, and only the words that were
+ * changed are written back to the device on flush.
+ */
+class Bitmap
+{
+public:
+    /**
+     * A range of contiguous entries.
+     */
+    struct Run
+    {
+        int start;
+        int length;
+    };
+
+    /**
+     * Read a bitmap from the block device.
+     * @param journal the journal of the block device.
+     * @param address the address of the bitmap, must be aligned to a word.
+     * @param bits the amount of entries in the bitmap.
+     * @param free the amount of free entries if it is known, for example
+     *        from the last time the bitmap was flushed, or -1 to count them.
+     */
+    void load(const Journal& journal, uint64_t address, int bits, int free = -1);
+
+    /**
+     * Write every word that was changed since the last flush to the device.
+     * Adjacent changed words are written together.
+     * @param journal the journal of the block device, the words are written
+     *        as part of its running transaction.
+     */
+    void flush(Journal& journal);
+
+    /**
+     * Get the amount of blocks of the device that the next flush writes.
+     */
+    int dirtyBlocks() const;
+
+    /**
+     * Count the blocks of the device that hold a range of entries as written
+     * by the next flush, for entries that are changed right before it.
+     * @param start the first entry of the range.
+     * @param length the amount of entries in the range.
+     */
+    void markPending(int start, int length);
+
+    /**
+     * Allocate a free entry, starting the search where the previous
+     * allocation ended.
+     * @return the index of the entry or -1 if the bitmap is full.
+     */
+    int allocate();
+
+    /**
+     * Allocate a run of contiguous free entries.
+     * @param length the amount of entries in the run.
+     * @return the index of the first entry in the run or -1 if there is no
+     *         free run that is long enough.
+     */
+    int allocateRun(int length);
+
+    /**
+     * Allocate entries in as few runs as possible with a single pass over the
+     * bitmap.
+     * The entries that directly follow `goal` are used first, because they
+     * extend the run that ends there. Then, the first free run that can hold
+     * the rest (searching from `goal`) is used. If there is no such run the
+     * rest is split over the longest free runs.
+     * @param count the amount of entries to allocate.
+     * @param goal the index of the entry that should be allocated first, or -1
+     *        to start searching where the previous allocation ended.
+     * @return the allocated runs, or an empty vector if there are not enough
+     *         free entries, in which case nothing is allocated.
+     */
+    std::vector<Run> allocateRuns(int count, int goal);
+
+    /**
+     * Find the first run of free entries that starts at or after an index.
+     * @param length the minimal length of the run.
+     * @param from the index to start searching from.
+     * @return the index of the first entry in the run or -1 if not found.
+     */
+    int findRun(int length, int from) const;
+
+    void set(int n);
+    void clear(int n);
+    void setRange(int start, int length);
+    void clearRange(int start, int length);
+    bool test(int n) const;
+
+    int size() const;
+    int countFree() const;
+
+private:
+    static constexpr int BITS_IN_WORD = 64;
+    static constexpr uint64_t ALL_OCCUPIED = 0xFFFFFFFFFFFFFFFF;
+
+    size_t _findWord(size_t from, uint64_t skip) const;
+    int _nextFree(int from) const;
+    int _nextUsed(int from) const;
+    void _markDirty(size_t word);
+    void _markBlockDirty(size_t word);
+
+    std::vector<uint64_t> _words;
+    std::vector<uint64_t> _dirty; // a bit for every word that has to be flushed
+    std::vector<bool> _dirtyBlocks; // every block of the device that the bitmap spans, by its position
+    int _dirtyBlockCount = 0;
+    size_t _blockSize = 0;
+    uint64_t _address = 0;
+    int _bits = 0;
+    int _free = 0;
+    int _cursor = 0; // where the next allocation starts searching
+};
+
+#endif // __BITMAP_H__
@@ -1,12 +1,36 @@
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <cstring>
 #include "blkdev.h"
+#include "stats.h"
 #include <fcntl.h>
 #include <stdexcept>
 #include <cerrno>
 
-BlockDeviceSimulator::BlockDeviceSimulator(const std::string& fname) {
+void BlockDevice::submit(std::span<const Request> requests) {
+	for (const Request& request : requests) {
+		if (request.write)
+			write(request.addr, request.size, request.data);
+		else
+			read(request.addr, request.size, request.data);
+	}
+}
+
+const char* BlockDevice::view(uint64_t addr, size_t size) const {
+	return nullptr;
+}
+
+void BlockDevice::prefetch(uint64_t addr, size_t size) const {
+}
+
+void BlockDevice::sync() {
+	sync(0, size());
+}
+
+int BlockDevice::open_file(const std::string& fname, uint64_t& size) {
+	struct stat st{};
+	int fd;
 
 	// if file doesn't exist, create it
 	if (access(fname.c_str(), F_OK) == -1) {
@@ -15,7 +39,7 @@ BlockDeviceSimulator::BlockDeviceSimulator(const std::string& fname) {
 			throw std::runtime_error(
 				std::string("open-create failed: ") + strerror(errno));
 
-		if (lseek(fd, DEVICE_SIZE-1, SEEK_SET) == -1)
+		if (lseek(fd, size-1, SEEK_SET) == -1)
 			throw std::runtime_error("Could not seek");
 
 		::write(fd, "\0", 1);
@@ -25,24 +49,62 @@ BlockDeviceSimulator::BlockDeviceSimulator(const std::string& fname) {
 			throw std::runtime_error(
 				std::string("open failed: ") + strerror(errno));
 		}
+		if (fstat(fd, &st) == -1)
+			throw std::runtime_error(
+				std::string("stat failed: ") + strerror(errno));
+		size = st.st_size;
 	}
 
-	filemap = (unsigned char *)mmap(nullptr, DEVICE_SIZE, PROT_READ | PROT_WRITE,
+	return fd;
+}
+
+BlockDeviceSimulator::BlockDeviceSimulator(const std::string& fname, uint64_t size) :
+		device_size(size) {
+	fd = open_file(fname, device_size);
+
+	filemap = (unsigned char *)mmap(nullptr, device_size, PROT_READ | PROT_WRITE,
 				        MAP_SHARED, fd, 0);
 	if (filemap == (unsigned char *)-1)
 		throw std::runtime_error(strerror(errno));
 }
 
 BlockDeviceSimulator::~BlockDeviceSimulator() {
-	munmap(filemap, DEVICE_SIZE);
+	munmap(filemap, device_size);
 	close(fd);
 }
 
-void BlockDeviceSimulator::read(int addr, int size, char *ans) const {
+void BlockDeviceSimulator::read(uint64_t addr, size_t size, char *ans) const {
+	static const int METRIC = Stats::metric("mmap.read");
+	Stats::Timer timer(METRIC, size);
+
 	memcpy(ans, filemap + addr, size);
 }
 
-void BlockDeviceSimulator::write(int addr, int size, const char* data) {
+void BlockDeviceSimulator::write(uint64_t addr, size_t size, const char* data) {
+	static const int METRIC = Stats::metric("mmap.write");
+	Stats::Timer timer(METRIC, size);
+
 	memcpy(filemap + addr, data, size);
 }
 
+
+const char* BlockDeviceSimulator::view(uint64_t addr, size_t size) const {
+	return (const char*)filemap + addr;
+}
+
+void BlockDeviceSimulator::sync(uint64_t addr, size_t size) {
+	static const int METRIC = Stats::metric("mmap.sync");
+	Stats::Timer timer(METRIC);
+
+	// msync only accepts addresses that are aligned to a page
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	const uint64_t start = addr - addr % page_size;
+
+	if (msync(filemap + start, addr + size - start, MS_SYNC) == -1)
+		throw std::runtime_error(
+			std::string("msync failed: ") + strerror(errno));
+}
+
+uint64_t BlockDeviceSimulator::size() const {
+	return device_size;
+}
@@ -1,20 +1,103 @@
 #ifndef __BLKDEVSIM__H__
 #define __BLKDEVSIM__H__
 
+#include <span>
 #include <string>
+#include <cstdint>
+#include <cstddef>
 
-class BlockDeviceSimulator {
+/**
+ * A device that stores a fixed amount of bytes, which myfs is mounted on.
+ */
+class BlockDevice {
 public:
-	BlockDeviceSimulator(const std::string& fname);
-	~BlockDeviceSimulator();
+	/**
+	 * A single read or write that is part of a batch.
+	 */
+	struct Request {
+		bool write;
+		uint64_t addr;
+		size_t size;
+		char* data; // the buffer to read into, or the data to write
+	};
 
-	void read(int addr, int size, char* ans) const;
-	void write(int addr, int size, const char* data);
+	virtual ~BlockDevice() = default;
 
-	static constexpr int DEVICE_SIZE = 1024 * 1024;
+	virtual void read(uint64_t addr, size_t size, char* ans) const = 0;
+	virtual void write(uint64_t addr, size_t size, const char* data) = 0;
+
+	/**
+	 * Perform a batch of requests, which a device may have in flight at
+	 * the same time. The requests are performed in no particular order, so
+	 * a batch shouldn't have two requests for the same range if one of
+	 * them is a write.
+	 * By default the requests are performed one after the other.
+	 */
+	virtual void submit(std::span<const Request> requests);
+
+	/**
+	 * Get a pointer to a range of the device, without copying it.
+	 * The pointer stays valid until the device is destroyed.
+	 * @return the pointer, or nullptr if the device isn't in memory.
+	 */
+	virtual const char* view(uint64_t addr, size_t size) const;
+
+	/**
+	 * Hint that a range of the device is going to be read soon, so a
+	 * device that caches its data can read it ahead.
+	 * By default nothing is done.
+	 */
+	virtual void prefetch(uint64_t addr, size_t size) const;
+
+	/**
+	 * Wait until the writes to a range of the device are stored.
+	 */
+	virtual void sync(uint64_t addr, size_t size) = 0;
+
+	/**
+	 * Wait until every write to the device is stored.
+	 */
+	void sync();
+
+	virtual uint64_t size() const = 0;
+
+	static constexpr uint64_t DEFAULT_DEVICE_SIZE = 1024 * 1024;
+
+protected:
+	/**
+	 * Open the file that backs a device.
+	 * If the file doesn't exist it is created with `size` bytes, otherwise
+	 * `size` is set to the size of the existing file.
+	 * @return the file descriptor.
+	 */
+	static int open_file(const std::string& fname, uint64_t& size);
+};
+
+/**
+ * A block device that is backed by a file which is mapped to memory.
+ */
+class BlockDeviceSimulator : public BlockDevice {
+public:
+	/**
+	 * Open a block device that is backed by a file.
+	 * If the file doesn't exist it is created with `size` bytes, otherwise
+	 * the size of the device is the size of the existing file.
+	 */
+	BlockDeviceSimulator(const std::string& fname, uint64_t size = DEFAULT_DEVICE_SIZE);
+	~BlockDeviceSimulator() override;
+
+	void read(uint64_t addr, size_t size, char* ans) const override;
+	void write(uint64_t addr, size_t size, const char* data) override;
+	const char* view(uint64_t addr, size_t size) const override;
+
+	using BlockDevice::sync;
+	void sync(uint64_t addr, size_t size) override;
+
+	uint64_t size() const override;
 
 private:
 	int fd;
+	uint64_t device_size;
 	unsigned char* filemap;
 };
 
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cstring>
+#include "cached_blkdev.h"
+#include "stats.h"
+
+CachedBlockDevice::CachedBlockDevice(BlockDevice* device, size_t capacity, size_t page_size,
+				     size_t max_read_ahead) :
+		device(device), capacity(capacity), page_size(page_size),
+		// reading ahead more than the big accesses that skip the cache would
+		// replace pages before they are used
+		max_read_ahead(std::min(max_read_ahead, capacity / 4)),
+		memory(new char[capacity * page_size]) {
+	frames.reserve(capacity);
+}
+
+CachedBlockDevice::~CachedBlockDevice() {
+	std::lock_guard<std::mutex> guard(lock);
+	write_back(0, UINT64_MAX);
+}
+
+void CachedBlockDevice::read(uint64_t addr, size_t size, char* ans) const {
+	static const int METRIC = Stats::metric("cache.read");
+	Stats::Timer timer(METRIC, size);
+
+	const uint64_t first = addr / page_size;
+	const uint64_t end = (addr + size + page_size - 1) / page_size;
+	std::vector<uint64_t> missing;
+	std::vector<size_t> loaded;
+	std::vector<Request> reads;
+	size_t missing_pages;
+	uint64_t from;
+	uint64_t to;
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (size == 0)
+		return;
+
+	if (end - first > capacity / 4) {
+		device->read(addr, size, ans);
+		// the dirty pages are newer than the device
+		for (const frame& cached : frames) {
+			from = std::max(addr, cached.page * page_size);
+			to = std::min(addr + size, (cached.page + 1) * page_size);
+			if (cached.dirty && from < to)
+				memcpy(ans + (from - addr), frame_data(&cached - frames.data()) + (from - cached.page * page_size), to - from);
+		}
+		return;
+	}
+
+	// copy the cached pages first, loading the others may replace them
+	for (uint64_t page = first; page < end; page++) {
+		const auto found = index.find(page);
+
+		if (found == index.end()) {
+			missing.push_back(page);
+			continue;
+		}
+		frames[found->second].referenced = true;
+		from = std::max(addr, page * page_size);
+		to = std::min(addr + size, (page + 1) * page_size);
+		memcpy(ans + (from - addr), frame_data(found->second) + (from - page * page_size), to - from);
+	}
+	missing_pages = missing.size();
+	counters.hits += (end - first) - missing_pages;
+	counters.misses += missing_pages;
+
+	// a read that starts where the previous one ended is sequential
+	if (first == next_page || first + 1 == next_page)
+		read_ahead_window = std::min(std::max(read_ahead_window * 2, MIN_READ_AHEAD), max_read_ahead);
+	else
+		read_ahead_window = 0;
+	next_page = end;
+	for (uint64_t page = end; page < end + read_ahead_window && page * page_size < device->size(); page++) {
+		if (index.find(page) == index.end())
+			missing.push_back(page);
+	}
+	counters.read_ahead += missing.size() - missing_pages;
+	if (missing.empty())
+		return;
+
+	loaded = allocate_frames(missing);
+	for (size_t i = 0; i < missing.size(); i++)
+		reads.push_back({ false, missing[i] * page_size, page_bytes(missing[i]), frame_data(loaded[i]) });
+	device->submit(reads);
+
+	for (size_t i = 0; i < missing_pages; i++) {
+		from = std::max(addr, missing[i] * page_size);
+		to = std::min(addr + size, (missing[i] + 1) * page_size);
+		memcpy(ans + (from - addr), frame_data(loaded[i]) + (from - missing[i] * page_size), to - from);
+	}
+}
+
+void CachedBlockDevice::write(uint64_t addr, size_t size, const char* data) {
+	static const int METRIC = Stats::metric("cache.write");
+	Stats::Timer timer(METRIC, size);
+
+	const uint64_t first = addr / page_size;
+	const uint64_t end = (addr + size + page_size - 1) / page_size;
+	std::vector<uint64_t> missing;
+	std::vector<size_t> allocated;
+	std::vector<Request> reads;
+	uint64_t from;
+	uint64_t to;
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (size == 0)
+		return;
+
+	if (end - first > capacity / 4) {
+		device->write(addr, size, data);
+		// keep the cached pages up to date
+		for (const frame& cached : frames) {
+			from = std::max(addr, cached.page * page_size);
+			to = std::min(addr + size, (cached.page + 1) * page_size);
+			if (from < to)
+				memcpy(frame_data(&cached - frames.data()) + (from - cached.page * page_size), data + (from - addr), to - from);
+		}
+		return;
+	}
+
+	for (uint64_t page = first; page < end; page++) {
+		const auto found = index.find(page);
+
+		from = std::max(addr, page * page_size);
+		to = std::min(addr + size, (page + 1) * page_size);
+		if (found == index.end()) {
+			missing.push_back(page);
+			continue;
+		}
+		frames[found->second].referenced = true;
+		frames[found->second].dirty = true;
+		memcpy(frame_data(found->second) + (from - page * page_size), data + (from - addr), to - from);
+	}
+	counters.hits += (end - first) - missing.size();
+	if (missing.empty())
+		return;
+
+	// only the pages that aren't overwritten completely have to be read
+	allocated = allocate_frames(missing);
+	for (size_t i = 0; i < missing.size(); i++) {
+		from = std::max(addr, missing[i] * page_size);
+		to = std::min(addr + size, (missing[i] + 1) * page_size);
+		if (to - from != page_bytes(missing[i])) {
+			reads.push_back({ false, missing[i] * page_size, page_bytes(missing[i]), frame_data(allocated[i]) });
+			counters.misses++;
+		}
+	}
+	device->submit(reads);
+
+	for (size_t i = 0; i < missing.size(); i++) {
+		from = std::max(addr, missing[i] * page_size);
+		to = std::min(addr + size, (missing[i] + 1) * page_size);
+		memcpy(frame_data(allocated[i]) + (from - missing[i] * page_size), data + (from - addr), to - from);
+		frames[allocated[i]].dirty = true;
+	}
+}
+
+void CachedBlockDevice::prefetch(uint64_t addr, size_t size) const {
+	const uint64_t first = addr / page_size;
+	const uint64_t end = std::min((addr + size + page_size - 1) / page_size, first + capacity / 4);
+	std::vector<uint64_t> missing;
+	std::vector<size_t> loaded;
+	std::vector<Request> reads;
+	std::lock_guard<std::mutex> guard(lock);
+
+	for (uint64_t page = first; page < end && page * page_size < device->size(); page++) {
+		if (index.find(page) == index.end())
+			missing.push_back(page);
+	}
+	if (missing.empty())
+		return;
+
+	loaded = allocate_frames(missing);
+	for (size_t i = 0; i < missing.size(); i++)
+		reads.push_back({ false, missing[i] * page_size, page_bytes(missing[i]), frame_data(loaded[i]) });
+	device->submit(reads);
+	counters.read_ahead += missing.size();
+}
+
+void CachedBlockDevice::sync(uint64_t addr, size_t size) {
+	static const int METRIC = Stats::metric("cache.sync");
+	Stats::Timer timer(METRIC);
+
+	std::lock_guard<std::mutex> guard(lock);
+	write_back(addr / page_size, (addr + size + page_size - 1) / page_size);
+	device->sync(addr, size);
+}
+
+uint64_t CachedBlockDevice::size() const {
+	return device->size();
+}
+
+CachedBlockDevice::stats CachedBlockDevice::get_stats() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return counters;
+}
+
+void CachedBlockDevice::reset_stats() {
+	std::lock_guard<std::mutex> guard(lock);
+	counters = stats{};
+}
+
+/**
+ * Get the amount of bytes in a page, which is only smaller than the page
+ * size for the last page of the device.
+ */
+size_t CachedBlockDevice::page_bytes(uint64_t page) const {
+	return std::min(page_size, device->size() - page * page_size);
+}
+
+char* CachedBlockDevice::frame_data(size_t frame_index) const {
+	return memory.get() + frame_index * page_size;
+}
+
+/**
+ * Give pages that aren't cached a frame each.
+ * The frames are taken with the CLOCK algorithm: the hand skips the frames
+ * that were accessed since it last passed them, and the dirty pages that are
+ * replaced are written back to the device.
+ * Note: the data of the frames is not read.
+ * @param pages the pages, at most half the capacity.
+ * @return the frame of every page.
+ */
+std::vector<size_t> CachedBlockDevice::allocate_frames(const std::vector<uint64_t>& pages) const {
+	std::vector<size_t> allocated;
+	std::vector<Request> write_backs;
+	size_t victim;
+
+	for (uint64_t page : pages) {
+		if (frames.size() < capacity) {
+			victim = frames.size();
+			frames.push_back({});
+		} else {
+			while (frames[hand].referenced) {
+				frames[hand].referenced = false;
+				hand = (hand + 1) % capacity;
+			}
+			victim = hand;
+			hand = (hand + 1) % capacity;
+			index.erase(frames[victim].page);
+			counters.evictions++;
+			if (frames[victim].dirty) {
+				write_backs.push_back({ true, frames[victim].page * page_size,
+							page_bytes(frames[victim].page), frame_data(victim) });
+				counters.write_backs++;
+			}
+		}
+		frames[victim] = { page, false, true };
+		index[page] = victim;
+		allocated.push_back(victim);
+	}
+	// the frames are only reused once their old pages are written back
+	device->submit(write_backs);
+
+	return allocated;
+}
+
+/**
+ * Write the dirty pages of a range back to the device.
+ * @param first_page the first page of the range.
+ * @param end_page the page after the range.
+ */
+void CachedBlockDevice::write_back(uint64_t first_page, uint64_t end_page) {
+	std::vector<Request> write_backs;
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		if (frames[i].dirty && frames[i].page >= first_page && frames[i].page < end_page) {
+			write_backs.push_back({ true, frames[i].page * page_size,
+						page_bytes(frames[i].page), frame_data(i) });
+			frames[i].dirty = false;
+		}
+	}
+	device->submit(write_backs);
+	counters.write_backs += write_backs.size();
+}
@@ -0,0 +1,97 @@
+#ifndef __CACHED_BLKDEV_H__
+#define __CACHED_BLKDEV_H__
+
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include "blkdev.h"
+
+/**
+ * A block device that keeps the recently used pages of another block device
+ * in memory.
+ * The cache has a fixed amount of pages and replaces them with the CLOCK
+ * algorithm. Writes only change the cached pages, which are written back to
+ * the device when they are replaced or on sync.
+ * When a read continues the previous read, the pages that follow it are read
+ * ahead in the same batch, and the read-ahead window grows as long as the
+ * reads stay sequential.
+ * Accesses of more than a quarter of the cache go straight to the device, so
+ * a large read doesn't replace the whole cache.
+ * The cache may be used by several threads at once, every access holds a
+ * single lock for its whole duration.
+ */
+class CachedBlockDevice : public BlockDevice {
+public:
+	/**
+	 * Counters of the cache accesses.
+	 */
+	struct stats {
+		uint64_t hits; // pages that were accessed while they were cached
+		uint64_t misses; // pages that were read from the device when they were accessed
+		uint64_t read_ahead; // pages that were read from the device before they were accessed
+		uint64_t write_backs; // dirty pages that were written to the device
+		uint64_t evictions; // pages that were replaced
+	};
+
+	/**
+	 * Cache a block device.
+	 * @param device the device to cache, which must outlive the cache.
+	 * @param capacity the amount of pages in the cache.
+	 * @param page_size the size of a page, the unit that is cached.
+	 * @param max_read_ahead the maximal amount of pages to read ahead.
+	 */
+	CachedBlockDevice(BlockDevice* device, size_t capacity = DEFAULT_CAPACITY,
+			  size_t page_size = DEFAULT_PAGE_SIZE,
+			  size_t max_read_ahead = DEFAULT_MAX_READ_AHEAD);
+
+	/**
+	 * Write the dirty pages back to the device.
+	 */
+	~CachedBlockDevice() override;
+
+	void read(uint64_t addr, size_t size, char* ans) const override;
+	void write(uint64_t addr, size_t size, const char* data) override;
+	void prefetch(uint64_t addr, size_t size) const override;
+
+	using BlockDevice::sync;
+	void sync(uint64_t addr, size_t size) override;
+
+	uint64_t size() const override;
+
+	stats get_stats() const;
+	void reset_stats();
+
+	static constexpr size_t DEFAULT_CAPACITY = 1024;
+	static constexpr size_t DEFAULT_PAGE_SIZE = 4096;
+	static constexpr size_t DEFAULT_MAX_READ_AHEAD = 32;
+	static constexpr size_t MIN_READ_AHEAD = 4;
+
+private:
+	struct frame {
+		uint64_t page;
+		bool dirty;
+		bool referenced; // cleared by the clock hand, a page is only replaced if it's clear
+	};
+
+	size_t page_bytes(uint64_t page) const;
+	char* frame_data(size_t frame_index) const;
+	std::vector<size_t> allocate_frames(const std::vector<uint64_t>& pages) const;
+	void write_back(uint64_t first_page, uint64_t end_page);
+
+	BlockDevice* device;
+	size_t capacity;
+	size_t page_size;
+	size_t max_read_ahead;
+	std::unique_ptr<char[]> memory; // the data of the frames
+	// everything below changes on reads, and is guarded by the lock
+	mutable std::mutex lock;
+	mutable std::vector<frame> frames;
+	mutable std::unordered_map<uint64_t, size_t> index; // the frame of every cached page
+	mutable size_t hand = 0;
+	mutable uint64_t next_page = 0; // the page after the previous read
+	mutable size_t read_ahead_window = 0;
+	mutable stats counters{};
+};
+
+#endif // __CACHED_BLKDEV_H__
@@ -0,0 +1,236 @@
+#include "dentry_cache.h"
+#include <bit>
+#include <cstring>
+
+DentryCache::DentryCache(size_t capacity) :
+        _sets(capacity == 0 ? 0 : std::bit_ceil((capacity + WAYS - 1) / WAYS)),
+        _slots(new Slot[this->_sets * WAYS]()),
+        _hands(new uint8_t[this->_sets]())
+{
+}
+
+bool DentryCache::lookup(int parent, std::string_view name, int& id) const
+{
+    Key key{};
+    Slot* set = nullptr;
+    uint64_t sequence{};
+    bool match{};
+    int value{};
+
+    if (this->_sets == 0 || !DentryCache::_makeKey(parent, name, key))
+    {
+        return false;
+    }
+
+    set = this->_slots.get() + this->_setOf(key) * WAYS;
+    for (size_t way = 0; way < WAYS; way++)
+    {
+        Slot& slot = set[way];
+
+        // read the slot again if it was changed while it was read
+        do
+        {
+            sequence = slot.sequence.load(std::memory_order_acquire);
+            match = DentryCache::_matches(slot, key);
+            value = slot.id.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while (sequence % 2 != 0 || slot.sequence.load(std::memory_order_relaxed) != sequence);
+
+        if (match)
+        {
+            slot.referenced.store(true, std::memory_order_relaxed);
+            id = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DentryCache::insert(int parent, std::string_view name, int id)
+{
+    Key key{};
+    Slot* set = nullptr;
+    Slot* slot = nullptr;
+    size_t setIndex{};
+
+    if (this->_sets == 0 || !DentryCache::_makeKey(parent, name, key))
+    {
+        return;
+    }
+    setIndex = this->_setOf(key);
+    set = this->_slots.get() + setIndex * WAYS;
+
+    std::lock_guard lock(this->_lock);
+    slot = this->_find(key);
+    for (size_t way = 0; way < WAYS && slot == nullptr; way++)
+    {
+        if (!set[way].used.load(std::memory_order_relaxed))
+        {
+            slot = &set[way];
+        }
+    }
+    if (slot == nullptr)
+    {
+        // the hand skips the entries that were looked up since it last passed them
+        uint8_t& hand = this->_hands[setIndex];
+
+        while (set[hand].referenced.exchange(false, std::memory_order_relaxed))
+        {
+            hand = (hand + 1) % WAYS;
+        }
+        slot = &set[hand];
+        hand = (hand + 1) % WAYS;
+    }
+
+    DentryCache::_store(*slot, key, id, true);
+}
+
+void DentryCache::erase(int parent, std::string_view name)
+{
+    Key key{};
+    Slot* slot = nullptr;
+
+    if (this->_sets == 0 || !DentryCache::_makeKey(parent, name, key))
+    {
+        return;
+    }
+
+    std::lock_guard lock(this->_lock);
+    slot = this->_find(key);
+    if (slot != nullptr)
+    {
+        DentryCache::_store(*slot, Key{}, NOT_FOUND, false);
+    }
+}
+
+void DentryCache::clear()
+{
+    std::lock_guard lock(this->_lock);
+
+    for (size_t i = 0; i < this->_sets * WAYS; i++)
+    {
+        if (this->_slots[i].used.load(std::memory_order_relaxed))
+        {
+            DentryCache::_store(this->_slots[i], Key{}, NOT_FOUND, false);
+        }
+    }
+}
+
+/**
+ * Build the key of a name, padding the name with null bytes.
+ * @return false if the name is too long to be cached.
+ */
+bool DentryCache::_makeKey(int parent, std::string_view name, DentryCache::Key& key)
+{
+    static_assert(MAX_NAME_LEN <= sizeof(Key::name), "a name must fit in the words of a key");
+
+    if (name.size() > MAX_NAME_LEN)
+    {
+        return false;
+    }
+    key.parent = parent;
+    memset(key.name, 0, sizeof(key.name));
+    memcpy(key.name, name.data(), name.size());
+
+    return true;
+}
+
+size_t DentryCache::_hash(const DentryCache::Key& key)
+{
+    // FNV-1a over the parent id and the name
+    constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+    constexpr uint64_t FNV_PRIME = 0x100000001b3;
+    const auto* name = (const uint8_t*)key.name;
+    uint64_t hash = FNV_OFFSET;
+
+    for (size_t i = 0; i < sizeof(key.parent); i++)
+    {
+        hash = (hash ^ ((key.parent >> (i * 8)) & 0xFF)) * FNV_PRIME;
+    }
+    for (size_t i = 0; i < MAX_NAME_LEN; i++)
+    {
+        hash = (hash ^ name[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Check whether a slot holds the entry of a key.
+ * Note: the result is only meaningful if the slot didn't change while it was
+ * read.
+ */
+bool DentryCache::_matches(const DentryCache::Slot& slot, const DentryCache::Key& key)
+{
+    if (!slot.used.load(std::memory_order_relaxed) ||
+        slot.parent.load(std::memory_order_relaxed) != key.parent)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < NAME_WORDS; i++)
+    {
+        if (slot.name[i].load(std::memory_order_relaxed) != key.name[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Change the entry in a slot, so that lookups which read the slot at the same
+ * time read it again.
+ * Note: must be called with the lock held.
+ * @param slot the slot.
+ * @param key the key of the entry.
+ * @param id the inode id of the entry.
+ * @param used false to empty the slot.
+ */
+void DentryCache::_store(DentryCache::Slot& slot, const DentryCache::Key& key, int id, bool used)
+{
+    const uint64_t SEQUENCE = slot.sequence.load(std::memory_order_relaxed);
+
+    slot.sequence.store(SEQUENCE + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.used.store(used, std::memory_order_relaxed);
+    slot.referenced.store(used, std::memory_order_relaxed);
+    slot.parent.store(key.parent, std::memory_order_relaxed);
+    for (size_t i = 0; i < NAME_WORDS; i++)
+    {
+        slot.name[i].store(key.name[i], std::memory_order_relaxed);
+    }
+    slot.id.store(id, std::memory_order_relaxed);
+
+    slot.sequence.store(SEQUENCE + 2, std::memory_order_release);
+}
+
+/**
+ * Get the index of the set that a key is stored in.
+ */
+size_t DentryCache::_setOf(const DentryCache::Key& key) const
+{
+    return DentryCache::_hash(key) & (this->_sets - 1);
+}
+
+/**
+ * Find the slot that holds the entry of a key.
+ * Note: must be called with the lock held.
+ * @return the slot, or nullptr if the key isn't cached.
+ */
+DentryCache::Slot* DentryCache::_find(const DentryCache::Key& key) const
+{
+    Slot* set = this->_slots.get() + this->_setOf(key) * WAYS;
+
+    for (size_t way = 0; way < WAYS; way++)
+    {
+        if (DentryCache::_matches(set[way], key))
+        {
+            return &set[way];
+        }
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,110 @@
+#ifndef __DENTRY_CACHE_H__
+#define __DENTRY_CACHE_H__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * A bounded cache of directory entries that maps a name inside a directory to
+ * the inode id of the file with that name.
+ * Names that are known to be missing from a directory are cached as well
+ * (negative entries), so repeated lookups of missing files don't have to read
+ * the directory either.
+ * The cache is set-associative: an entry can only be stored in one of the
+ * WAYS slots of the set its key hashes to, and when the set is full the entry
+ * to replace is chosen with the CLOCK algorithm.
+ * Lookups don't take a lock, so any amount of threads can look up entries at
+ * once. Every slot has a sequence number that is odd while the slot is being
+ * changed, and a lookup that sees the number change while it reads the slot
+ * reads it again. Changes to the cache are serialized by a lock.
+ */
+class DentryCache
+{
+public:
+    /**
+     * The id of a negative entry.
+     */
+    static constexpr int NOT_FOUND = -1;
+
+    /**
+     * The maximal length of a cached name.
+     * Longer names can't be stored in a directory, so they are never cached.
+     */
+    static constexpr size_t MAX_NAME_LEN = 10;
+
+    /**
+     * @param capacity the amount of entries in the cache, which is rounded up
+     *        to a whole amount of sets.
+     */
+    explicit DentryCache(size_t capacity);
+
+    /**
+     * Look up a name in the cache.
+     * @param parent the inode id of the directory.
+     * @param name the name of the file.
+     * @param id set to the inode id of the file, or NOT_FOUND if the file is
+     *        known to be missing.
+     * @return whether the name was found in the cache.
+     */
+    bool lookup(int parent, std::string_view name, int& id) const;
+
+    /**
+     * Add an entry to the cache or replace the existing one.
+     * @param parent the inode id of the directory.
+     * @param name the name of the file.
+     * @param id the inode id of the file or NOT_FOUND.
+     */
+    void insert(int parent, std::string_view name, int id);
+
+    /**
+     * Remove an entry from the cache, if it is cached.
+     */
+    void erase(int parent, std::string_view name);
+
+    /**
+     * Remove all the entries from the cache.
+     */
+    void clear();
+
+private:
+    static constexpr size_t WAYS = 4; // slots in a set
+    static constexpr size_t NAME_WORDS = 2; // 64-bit words that hold a name
+
+    struct Key
+    {
+        int parent;
+        uint64_t name[NAME_WORDS]; // padded with null bytes
+    };
+
+    /**
+     * Every field is atomic so lookups can read a slot while it is changed,
+     * the sequence number tells them whether what they read is consistent.
+     */
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence; // odd while the slot is changed
+        std::atomic<bool> used;
+        std::atomic<bool> referenced; // set by lookups, cleared by the clock hand
+        std::atomic<int> parent;
+        std::atomic<uint64_t> name[NAME_WORDS];
+        std::atomic<int> id;
+    };
+
+    static bool _makeKey(int parent, std::string_view name, Key& key);
+    static size_t _hash(const Key& key);
+    static bool _matches(const Slot& slot, const Key& key);
+    static void _store(Slot& slot, const Key& key, int id, bool used);
+    size_t _setOf(const Key& key) const;
+    Slot* _find(const Key& key) const;
+
+    size_t _sets; // amount of sets, a power of two
+    std::unique_ptr<Slot[]> _slots; // the slots of every set, one set after the other
+    std::unique_ptr<uint8_t[]> _hands; // the clock hand of every set
+    std::mutex _lock; // held while the cache is changed
+};
+
+#endif // __DENTRY_CACHE_H__
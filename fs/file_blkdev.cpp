@@ -0,0 +1,244 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <cerrno>
+#include "file_blkdev.h"
+#include "stats.h"
+
+FileBlockDevice::FileBlockDevice(const std::string& fname, uint64_t size, unsigned queue_depth) :
+		device_size(size) {
+	fd = open_file(fname, device_size);
+
+	// without a ring the requests of a batch are performed one at a time
+	if (queue_depth > 1)
+		setup_ring(queue_depth);
+}
+
+FileBlockDevice::~FileBlockDevice() {
+	close_ring();
+	close(fd);
+}
+
+void FileBlockDevice::read(uint64_t addr, size_t size, char *ans) const {
+	static const int METRIC = Stats::metric("file.read");
+	Stats::Timer timer(METRIC, size);
+
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < size) {
+		ret = pread(fd, ans + done, size - done, addr + done);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			throw std::runtime_error(std::string("pread failed: ") +
+				(ret == 0 ? "end of file" : strerror(errno)));
+		done += ret;
+	}
+}
+
+void FileBlockDevice::write(uint64_t addr, size_t size, const char* data) {
+	static const int METRIC = Stats::metric("file.write");
+	Stats::Timer timer(METRIC, size);
+
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < size) {
+		ret = pwrite(fd, data + done, size - done, addr + done);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1)
+			throw std::runtime_error(
+				std::string("pwrite failed: ") + strerror(errno));
+		done += ret;
+	}
+}
+
+void FileBlockDevice::submit(std::span<const Request> requests) {
+	static const int METRIC = Stats::metric("file.submit");
+	Stats::Timer timer(METRIC);
+
+	// the requests that the ring didn't complete, and how much of them was done
+	std::vector<std::pair<size_t, size_t>> leftovers;
+	std::vector<struct iovec> iovecs(requests.size());
+	size_t next = 0;
+	unsigned in_flight = 0;
+	unsigned to_submit;
+	unsigned tail;
+	unsigned head;
+	unsigned index;
+	int error = 0;
+
+	if (uring.fd == -1 || requests.size() < 2) {
+		BlockDevice::submit(requests);
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(ring_lock);
+	while (next < requests.size() || in_flight != 0) {
+		// fill the ring, the kernel only reads the entries after the tail
+		// is published
+		to_submit = 0;
+		tail = *uring.sq_tail;
+		for (; next < requests.size() && in_flight < uring.entries; next++) {
+			const Request& request = requests[next];
+			struct io_uring_sqe* sqe;
+
+			iovecs[next] = { request.data, request.size };
+			index = tail & *uring.sq_mask;
+			sqe = &uring.sqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+			sqe->fd = fd;
+			sqe->off = request.addr;
+			sqe->addr = (uint64_t)&iovecs[next];
+			sqe->len = 1;
+			sqe->user_data = next;
+			uring.sq_array[index] = index;
+			tail++;
+			in_flight++;
+			to_submit++;
+		}
+		__atomic_store_n(uring.sq_tail, tail, __ATOMIC_RELEASE);
+		enter_ring(to_submit, 1);
+
+		head = *uring.cq_head;
+		while (head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)) {
+			const struct io_uring_cqe* cqe = &uring.cqes[head & *uring.cq_mask];
+
+			if (cqe->res < 0 && error == 0)
+				error = -cqe->res;
+			else if (cqe->res >= 0 && (size_t)cqe->res < requests[cqe->user_data].size)
+				leftovers.push_back({ cqe->user_data, cqe->res });
+			head++;
+			in_flight--;
+		}
+		__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	// every request is done, so nothing refers to the buffers anymore
+	if (error != 0)
+		throw std::runtime_error(
+			std::string("io_uring request failed: ") + strerror(error));
+	for (const auto& [request_index, done] : leftovers) {
+		const Request& request = requests[request_index];
+
+		if (request.write)
+			write(request.addr + done, request.size - done, request.data + done);
+		else
+			read(request.addr + done, request.size - done, request.data + done);
+	}
+}
+
+void FileBlockDevice::sync(uint64_t addr, size_t size) {
+	// the whole file is flushed, there's no way to wait for only a range
+	if (fdatasync(fd) == -1)
+		throw std::runtime_error(
+			std::string("fdatasync failed: ") + strerror(errno));
+}
+
+uint64_t FileBlockDevice::size() const {
+	return device_size;
+}
+
+/**
+ * Create the io_uring and map its queues.
+ * @return whether the kernel supports io_uring.
+ */
+bool FileBlockDevice::setup_ring(unsigned queue_depth) {
+	struct io_uring_params params{};
+
+	uring.fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+	if (uring.fd == -1)
+		return false;
+
+	uring.entries = params.sq_entries;
+	uring.sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring.cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	// the submission and the completion queues may share a mapping
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		uring.sq_map_size = std::max(uring.sq_map_size, uring.cq_map_size);
+		uring.cq_map_size = uring.sq_map_size;
+	}
+
+	uring.sq_map = mmap(nullptr, uring.sq_map_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+	if (uring.sq_map == MAP_FAILED) {
+		uring.sq_map = nullptr;
+		close_ring();
+		return false;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		uring.cq_map = uring.sq_map;
+	} else {
+		uring.cq_map = mmap(nullptr, uring.cq_map_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+		if (uring.cq_map == MAP_FAILED) {
+			uring.cq_map = nullptr;
+			close_ring();
+			return false;
+		}
+	}
+	uring.sqes = (struct io_uring_sqe*)mmap(nullptr, uring.sqes_size, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+	if (uring.sqes == MAP_FAILED) {
+		uring.sqes = nullptr;
+		close_ring();
+		return false;
+	}
+
+	uring.sq_head = (unsigned*)((char*)uring.sq_map + params.sq_off.head);
+	uring.sq_tail = (unsigned*)((char*)uring.sq_map + params.sq_off.tail);
+	uring.sq_mask = (unsigned*)((char*)uring.sq_map + params.sq_off.ring_mask);
+	uring.sq_array = (unsigned*)((char*)uring.sq_map + params.sq_off.array);
+	uring.cq_head = (unsigned*)((char*)uring.cq_map + params.cq_off.head);
+	uring.cq_tail = (unsigned*)((char*)uring.cq_map + params.cq_off.tail);
+	uring.cq_mask = (unsigned*)((char*)uring.cq_map + params.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe*)((char*)uring.cq_map + params.cq_off.cqes);
+
+	return true;
+}
+
+void FileBlockDevice::close_ring() {
+	if (uring.sqes != nullptr)
+		munmap(uring.sqes, uring.sqes_size);
+	if (uring.cq_map != nullptr && uring.cq_map != uring.sq_map)
+		munmap(uring.cq_map, uring.cq_map_size);
+	if (uring.sq_map != nullptr)
+		munmap(uring.sq_map, uring.sq_map_size);
+	if (uring.fd != -1)
+		close(uring.fd);
+	uring = ring();
+}
+
+/**
+ * Submit the requests that were added to the ring, and wait for
+ * completions.
+ * @param to_submit the amount of requests that were added.
+ * @param min_complete the amount of completions to wait for.
+ */
+void FileBlockDevice::enter_ring(unsigned to_submit, unsigned min_complete) {
+	long ret;
+
+	while (true) {
+		ret = syscall(__NR_io_uring_enter, uring.fd, to_submit, min_complete,
+			      IORING_ENTER_GETEVENTS, nullptr, 0);
+		if (ret == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			throw std::runtime_error(
+				std::string("io_uring_enter failed: ") + strerror(errno));
+		}
+		to_submit -= ret;
+		if (to_submit == 0)
+			return;
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef __FILE_BLKDEV_H__
+#define __FILE_BLKDEV_H__
+
+#include <string>
+#include <mutex>
+#include "blkdev.h"
+
+/**
+ * A block device that is backed by a file, which is accessed with explicit
+ * reads and writes instead of being mapped to memory. This avoids the page
+ * faults of the first accesses to a mapped image, and works for images that
+ * are too big to map.
+ * Batches are submitted to an io_uring, so up to `queue_depth` requests are
+ * in flight at the same time. If the kernel doesn't support io_uring, the
+ * requests of a batch are performed one after the other.
+ * Single reads and writes may be performed by several threads at once, and
+ * the threads that submit batches take turns using the ring.
+ */
+class FileBlockDevice : public BlockDevice {
+public:
+	/**
+	 * Open a block device that is backed by a file.
+	 * If the file doesn't exist it is created with `size` bytes, otherwise
+	 * the size of the device is the size of the existing file.
+	 * @param queue_depth the maximal amount of requests in flight.
+	 */
+	FileBlockDevice(const std::string& fname, uint64_t size = DEFAULT_DEVICE_SIZE,
+			unsigned queue_depth = DEFAULT_QUEUE_DEPTH);
+	~FileBlockDevice() override;
+
+	void read(uint64_t addr, size_t size, char* ans) const override;
+	void write(uint64_t addr, size_t size, const char* data) override;
+	void submit(std::span<const Request> requests) override;
+
+	using BlockDevice::sync;
+	void sync(uint64_t addr, size_t size) override;
+
+	uint64_t size() const override;
+
+	static constexpr unsigned DEFAULT_QUEUE_DEPTH = 32;
+
+private:
+	/**
+	 * The parts of an io_uring that are mapped from the kernel.
+	 */
+	struct ring {
+		int fd = -1;
+		unsigned entries = 0;
+		void* sq_map = nullptr;
+		size_t sq_map_size = 0;
+		void* cq_map = nullptr;
+		size_t cq_map_size = 0;
+		struct io_uring_sqe* sqes = nullptr;
+		size_t sqes_size = 0;
+		unsigned* sq_head = nullptr;
+		unsigned* sq_tail = nullptr;
+		unsigned* sq_mask = nullptr;
+		unsigned* sq_array = nullptr;
+		unsigned* cq_head = nullptr;
+		unsigned* cq_tail = nullptr;
+		unsigned* cq_mask = nullptr;
+		struct io_uring_cqe* cqes = nullptr;
+	};
+
+	bool setup_ring(unsigned queue_depth);
+	void close_ring();
+	void enter_ring(unsigned to_submit, unsigned min_complete);
+
+	int fd;
+	uint64_t device_size;
+	ring uring;
+	std::mutex ring_lock; // held while the ring is used by a batch
+};
+
+#endif // __FILE_BLKDEV_H__
@@ -0,0 +1,264 @@
+#include "journal.h"
+#include "stats.h"
+#include <algorithm>
+#include <mutex>
+#include <cstring>
+#include <stdexcept>
+
+Journal::Journal(BlockDevice* blkdevsim) :
+        _blkdevsim(blkdevsim)
+{
+}
+
+void Journal::load(uint64_t address, int blocks, int blockSize)
+{
+    std::unique_lock lock(this->_lock);
+
+    this->_address = address;
+    this->_blockSize = blockSize;
+    this->_blocks.clear();
+
+    // the most blocks that fit in the region together with their numbers
+    this->_capacity = blocks;
+    while (this->_capacity != 0 && this->_headerBlocks(this->_capacity) + this->_capacity > (size_t)blocks)
+    {
+        this->_capacity--;
+    }
+}
+
+bool Journal::replay()
+{
+    const uint64_t DEVICE_BLOCKS = this->_blkdevsim->size() / this->_blockSize;
+    Header header{};
+    std::vector<uint64_t> blocks;
+    std::vector<char> block(this->_blockSize);
+    uint64_t checksum{};
+    uint64_t firstBlock{};
+    std::unique_lock lock(this->_lock);
+
+    this->_blkdevsim->read(this->_address, sizeof(header), (char*)&header);
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.count > this->_capacity)
+    {
+        return false;
+    }
+
+    blocks.resize(header.count);
+    this->_blkdevsim->read(this->_address + sizeof(header), blocks.size() * sizeof(uint64_t),
+                           (char*)blocks.data());
+    firstBlock = this->_address + this->_headerBlocks(header.count) * this->_blockSize;
+    checksum = _checksum(CHECKSUM_SEED, &header.sequence, sizeof(header.sequence));
+    checksum = _checksum(checksum, &header.count, sizeof(header.count));
+    checksum = _checksum(checksum, blocks.data(), blocks.size() * sizeof(uint64_t));
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        this->_blkdevsim->read(firstBlock + i * this->_blockSize, this->_blockSize, block.data());
+        checksum = _checksum(checksum, block.data(), block.size());
+    }
+    // a transaction whose commit didn't finish
+    if (checksum != header.checksum ||
+        std::any_of(blocks.begin(), blocks.end(), [DEVICE_BLOCKS](uint64_t number) {
+            return number >= DEVICE_BLOCKS;
+        }))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        this->_blkdevsim->read(firstBlock + i * this->_blockSize, this->_blockSize, block.data());
+        this->_blkdevsim->write(blocks[i] * this->_blockSize, this->_blockSize, block.data());
+    }
+    this->_blkdevsim->sync();
+    this->_sequence = header.sequence + 1;
+
+    return true;
+}
+
+void Journal::reset()
+{
+    const Header EMPTY{};
+    std::unique_lock lock(this->_lock);
+
+    this->_blocks.clear();
+    this->_blkdevsim->write(this->_address, sizeof(EMPTY), (const char*)&EMPTY);
+}
+
+void Journal::read(uint64_t addr, size_t size, char* buffer) const
+{
+    static const int METRIC = Stats::metric("journal.read");
+    Stats::Timer timer(METRIC, size);
+
+    const uint64_t END = addr + size;
+    uint64_t from{};
+    uint64_t to{};
+    std::shared_lock lock(this->_lock);
+
+    this->_blkdevsim->read(addr, size, buffer);
+    if (this->_blocks.empty())
+    {
+        return;
+    }
+
+    for (uint64_t block = addr / this->_blockSize; block * this->_blockSize < END; block++)
+    {
+        const auto FOUND = this->_blocks.find(block);
+
+        if (FOUND != this->_blocks.end())
+        {
+            from = std::max(addr, block * this->_blockSize);
+            to = std::min(END, (block + 1) * this->_blockSize);
+            memcpy(buffer + (from - addr), FOUND->second.data() + (from - block * this->_blockSize), to - from);
+        }
+    }
+}
+
+void Journal::write(uint64_t addr, size_t size, const char* data)
+{
+    static const int METRIC = Stats::metric("journal.write");
+    Stats::Timer timer(METRIC, size);
+
+    const uint64_t END = addr + size;
+    uint64_t from{};
+    uint64_t to{};
+    std::unique_lock lock(this->_lock);
+
+    for (uint64_t block = addr / this->_blockSize; block * this->_blockSize < END; block++)
+    {
+        auto [changed, added] = this->_blocks.try_emplace(block);
+
+        from = std::max(addr, block * this->_blockSize);
+        to = std::min(END, (block + 1) * this->_blockSize);
+        if (added)
+        {
+            changed->second.resize(this->_blockSize);
+            if (to - from != this->_blockSize)
+            {
+                this->_blkdevsim->read(block * this->_blockSize, this->_blockSize, changed->second.data());
+            }
+        }
+        memcpy(changed->second.data() + (from - block * this->_blockSize), data + (from - addr), to - from);
+    }
+}
+
+void Journal::commit()
+{
+    static const int METRIC = Stats::metric("journal.commit");
+    Stats::Timer timer(METRIC);
+
+    std::vector<uint64_t> blocks;
+    std::unique_lock lock(this->_lock);
+
+    if (this->_blocks.size() > this->_capacity)
+    {
+        throw std::runtime_error("Error: the transaction doesn't fit in the journal");
+    }
+    blocks.reserve(this->_blocks.size());
+    for (const auto& [number, data] : this->_blocks)
+    {
+        blocks.push_back(number);
+    }
+    std::sort(blocks.begin(), blocks.end());
+    this->_commitTransaction(blocks.data(), blocks.size());
+    this->_blocks.clear();
+}
+
+size_t Journal::pending() const
+{
+    std::shared_lock lock(this->_lock);
+    return this->_blocks.size();
+}
+
+size_t Journal::capacity() const
+{
+    return this->_capacity;
+}
+
+size_t Journal::blockSize() const
+{
+    return this->_blockSize;
+}
+
+/**
+ * Get the amount of blocks that the header of a transaction takes.
+ * @param count the amount of blocks in the transaction.
+ */
+size_t Journal::_headerBlocks(size_t count) const
+{
+    return (sizeof(Header) + count * sizeof(uint64_t) + this->_blockSize - 1) / this->_blockSize;
+}
+
+/**
+ * Write changed blocks to the journal as a single transaction, and then to
+ * their place.
+ * The journal is flushed once the transaction is written, and the checksum
+ * in the header tells if a transaction wasn't written completely.
+ * @param blocks the numbers of the blocks.
+ * @param count the amount of blocks, at most the capacity of the journal.
+ */
+void Journal::_commitTransaction(const uint64_t* blocks, size_t count)
+{
+    const size_t HEADER_SIZE = this->_headerBlocks(count) * this->_blockSize;
+    std::vector<char> header(HEADER_SIZE, 0);
+    std::vector<BlockDevice::Request> requests;
+    Header fields{};
+
+    // the journal is overwritten, so the blocks of the previous transaction
+    // must be stored in their place first. This also stores the file data
+    // that the transaction refers to.
+    this->_blkdevsim->sync();
+
+    memcpy(fields.magic, MAGIC, sizeof(MAGIC));
+    fields.count = (uint32_t)count;
+    fields.sequence = this->_sequence++;
+    fields.checksum = _checksum(CHECKSUM_SEED, &fields.sequence, sizeof(fields.sequence));
+    fields.checksum = _checksum(fields.checksum, &fields.count, sizeof(fields.count));
+    fields.checksum = _checksum(fields.checksum, blocks, count * sizeof(uint64_t));
+    for (size_t i = 0; i < count; i++)
+    {
+        std::vector<char>& data = this->_blocks.at(blocks[i]);
+
+        fields.checksum = _checksum(fields.checksum, data.data(), data.size());
+        requests.push_back({ true, this->_address + HEADER_SIZE + i * this->_blockSize,
+                             this->_blockSize, data.data() });
+    }
+    memcpy(header.data(), &fields, sizeof(fields));
+    memcpy(header.data() + sizeof(fields), blocks, count * sizeof(uint64_t));
+    requests.push_back({ true, this->_address, HEADER_SIZE, header.data() });
+    this->_blkdevsim->submit(requests);
+    this->_blkdevsim->sync(this->_address, HEADER_SIZE + count * this->_blockSize);
+
+    // the transaction is committed, the blocks are flushed by the next commit
+    for (size_t i = 0; i < count; i++)
+    {
+        requests[i].addr = blocks[i] * this->_blockSize;
+    }
+    requests.pop_back();
+    this->_blkdevsim->submit(requests);
+}
+
+/**
+ * Hash data with FNV-1a, a 64-bit word at a time.
+ * @param seed the hash of the data before this data, or CHECKSUM_SEED.
+ * @param data the data.
+ * @param size the size of the data in bytes.
+ */
+uint64_t Journal::_checksum(uint64_t seed, const void* data, size_t size)
+{
+    constexpr uint64_t FNV_PRIME = 0x100000001b3;
+    const auto* bytes = (const uint8_t*)data;
+    uint64_t hash = seed;
+    uint64_t word{};
+    size_t i = 0;
+
+    for (; i + sizeof(word) <= size; i += sizeof(word))
+    {
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
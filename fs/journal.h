@@ -0,0 +1,116 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+#include "blkdev.h"
+
+/**
+ * A write-ahead journal for the metadata of the file system.
+ * Metadata writes are not written to their place on the device right away.
+ * Instead, the blocks they change are kept in memory, and reads of those
+ * blocks see the changed copy. On commit, every changed block is written to
+ * the journal region as a single transaction, the journal is flushed and only
+ * then the blocks are written to their place. If the file system isn't
+ * unmounted cleanly, the last committed transaction is written to its place
+ * again on the next mount, so the metadata is always in the state of a commit.
+ * The device is seen as an array of blocks of the journal's block size that
+ * starts at address 0.
+ * Reads may run in several threads at once, while writes and commits hold
+ * the journal exclusively.
+ */
+class Journal
+{
+public:
+    explicit Journal(BlockDevice* blkdevsim);
+
+    /**
+     * Set the place of the journal region on the device.
+     * The changed blocks that weren't committed are discarded.
+     * @param address the address of the journal region, must be aligned to a
+     *        block.
+     * @param blocks the amount of blocks in the journal region.
+     * @param blockSize the size of a block.
+     */
+    void load(uint64_t address, int blocks, int blockSize);
+
+    /**
+     * Write the transaction that is stored in the journal region to its place
+     * on the device, if the journal holds a complete transaction.
+     * @return whether a transaction was written.
+     */
+    bool replay();
+
+    /**
+     * Erase the journal region, so there's nothing to replay.
+     */
+    void reset();
+
+    /**
+     * Read from the device, including the changes that weren't committed.
+     */
+    void read(uint64_t addr, size_t size, char* buffer) const;
+
+    /**
+     * Write to the device. The change is only made in memory until it is
+     * committed.
+     */
+    void write(uint64_t addr, size_t size, const char* data);
+
+    /**
+     * Write every changed block to the journal as a single transaction, and
+     * then to its place.
+     * @throws std::runtime_error if there are more changed blocks than fit in
+     *         the journal, in which case nothing is written, because a part
+     *         of the changes could be all that is left after a crash.
+     */
+    void commit();
+
+    /**
+     * Get the amount of changed blocks that weren't committed.
+     */
+    size_t pending() const;
+
+    /**
+     * Get the maximal amount of blocks in a single transaction.
+     */
+    size_t capacity() const;
+
+    /**
+     * Get the size of the blocks that the journal keeps.
+     */
+    size_t blockSize() const;
+
+private:
+    static constexpr char MAGIC[4] = { 'J', 'R', 'N', 'L' };
+    static constexpr uint64_t CHECKSUM_SEED = 0xcbf29ce484222325; // the FNV-1a offset basis
+
+    /**
+     * The start of the journal region, followed by the numbers of the blocks
+     * in the transaction. The blocks themselves start at the first block after
+     * the block numbers.
+     */
+    struct Header
+    {
+        char magic[4]; // MAGIC if the journal holds a transaction
+        uint32_t count; // amount of blocks in the transaction
+        uint64_t sequence; // number of the transaction
+        uint64_t checksum; // of the sequence, the count, the block numbers and the blocks
+    };
+
+    size_t _headerBlocks(size_t count) const;
+    void _commitTransaction(const uint64_t* blocks, size_t count);
+    static uint64_t _checksum(uint64_t seed, const void* data, size_t size);
+
+    BlockDevice* _blkdevsim;
+    std::unordered_map<uint64_t, std::vector<char>> _blocks; // changed blocks by their number
+    uint64_t _address = 0;
+    size_t _blockSize = 0;
+    size_t _capacity = 0;
+    uint64_t _sequence = 0; // the number of the next transaction
+    mutable std::shared_mutex _lock;
+};
+
+#endif // __JOURNAL_H__
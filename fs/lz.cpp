@@ -0,0 +1,222 @@
+#include "lz.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+size_t Lz::bound(size_t size)
+{
+    // the token and the length bytes of the literals if nothing matches
+    return size + size / 255 + 16;
+}
+
+size_t Lz::compress(const char* src, size_t size, char* dst, size_t capacity)
+{
+    const auto* const IN = (const uint8_t*)src;
+    const uint8_t* const END = IN + size;
+    // a match is only looked for where MIN_MATCH bytes are left to hash
+    const uint8_t* const MATCH_LIMIT = size > MIN_MATCH ? END - MIN_MATCH : IN;
+    auto* out = (uint8_t*)dst;
+    const uint8_t* const OUT_END = out + capacity;
+    uint32_t table[1 << HASH_BITS]{}; // the last position of every hash
+    const uint8_t* anchor = IN; // the first literal that wasn't written yet
+    const uint8_t* ip = IN;
+    const uint8_t* candidate = nullptr;
+    uint8_t* token = nullptr;
+    size_t literals{};
+    size_t match{};
+    uint32_t hash{};
+
+    while (ip < MATCH_LIMIT)
+    {
+        hash = Lz::_hash(ip);
+        candidate = IN + table[hash];
+        table[hash] = (uint32_t)(ip - IN);
+        if (candidate >= ip || (size_t)(ip - candidate) > MAX_OFFSET ||
+            memcmp(candidate, ip, MIN_MATCH) != 0)
+        {
+            ip++;
+            continue;
+        }
+        match = MIN_MATCH;
+        while (ip + match < END && candidate[match] == ip[match])
+        {
+            match++;
+        }
+
+        literals = ip - anchor;
+        if (OUT_END - out < (ptrdiff_t)(1 + literals))
+        {
+            return 0;
+        }
+        token = out++;
+        *token = (uint8_t)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(match - MIN_MATCH, 15));
+        if (literals >= 15 && !Lz::_writeLength(literals - 15, out, OUT_END))
+        {
+            return 0;
+        }
+        if (OUT_END - out < (ptrdiff_t)(literals + 2))
+        {
+            return 0;
+        }
+        memcpy(out, anchor, literals);
+        out += literals;
+        *out++ = (uint8_t)((ip - candidate) & 0xFF);
+        *out++ = (uint8_t)((ip - candidate) >> 8);
+        if (match - MIN_MATCH >= 15 && !Lz::_writeLength(match - MIN_MATCH - 15, out, OUT_END))
+        {
+            return 0;
+        }
+
+        ip += match;
+        anchor = ip;
+    }
+
+    // the last sequence only has literals
+    literals = END - anchor;
+    if (out == OUT_END)
+    {
+        return 0;
+    }
+    token = out++;
+    *token = (uint8_t)(std::min<size_t>(literals, 15) << 4);
+    if (literals >= 15 && !Lz::_writeLength(literals - 15, out, OUT_END))
+    {
+        return 0;
+    }
+    if (OUT_END - out < (ptrdiff_t)literals)
+    {
+        return 0;
+    }
+    memcpy(out, anchor, literals);
+    out += literals;
+
+    return out - (uint8_t*)dst;
+}
+
+void Lz::decompress(const char* src, size_t size, char* dst, size_t dstSize)
+{
+    const auto* in = (const uint8_t*)src;
+    const uint8_t* const END = in + size;
+    auto* out = (uint8_t*)dst;
+    const uint8_t* const OUT_END = out + dstSize;
+    const uint8_t* match = nullptr;
+    uint8_t token{};
+    size_t literals{};
+    size_t length{};
+    size_t offset{};
+
+    while (in < END)
+    {
+        token = *in++;
+        literals = token >> 4;
+        if (literals == 15)
+        {
+            literals = Lz::_readLength(literals, in, END);
+        }
+        if (literals > (size_t)(END - in) || literals > (size_t)(OUT_END - out))
+        {
+            throw std::runtime_error("Error: corrupted compressed data");
+        }
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == END)
+        {
+            break;
+        }
+
+        if (END - in < 2)
+        {
+            throw std::runtime_error("Error: corrupted compressed data");
+        }
+        offset = in[0] | (in[1] << 8);
+        in += 2;
+        length = token & 15;
+        if (length == 15)
+        {
+            length = Lz::_readLength(length, in, END);
+        }
+        length += MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(out - (uint8_t*)dst) || length > (size_t)(OUT_END - out))
+        {
+            throw std::runtime_error("Error: corrupted compressed data");
+        }
+
+        // the match may overlap the bytes it produces, so it's copied a byte
+        // at a time
+        match = out - offset;
+        for (size_t i = 0; i < length; i++)
+        {
+            out[i] = match[i];
+        }
+        out += length;
+    }
+
+    if (out != OUT_END)
+    {
+        throw std::runtime_error("Error: corrupted compressed data");
+    }
+}
+
+/**
+ * Hash the MIN_MATCH bytes that start at a position.
+ */
+uint32_t Lz::_hash(const uint8_t* data)
+{
+    uint32_t word{};
+
+    memcpy(&word, data, sizeof(word));
+
+    return (word * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/**
+ * Write the rest of a length that doesn't fit in its nibble of the token.
+ * @param length the part of the length that is left.
+ * @param out where to write, advanced past the written bytes.
+ * @param end the end of the output buffer.
+ * @return false if the length doesn't fit in the buffer.
+ */
+bool Lz::_writeLength(size_t length, uint8_t*& out, const uint8_t* end)
+{
+    while (length >= 255)
+    {
+        if (out == end)
+        {
+            return false;
+        }
+        *out++ = 255;
+        length -= 255;
+    }
+    if (out == end)
+    {
+        return false;
+    }
+    *out++ = (uint8_t)length;
+
+    return true;
+}
+
+/**
+ * Read the rest of a length that didn't fit in its nibble of the token.
+ * @param length the value of the nibble.
+ * @param in where to read from, advanced past the read bytes.
+ * @param end the end of the compressed data.
+ * @return the whole length.
+ */
+size_t Lz::_readLength(size_t length, const uint8_t*& in, const uint8_t* end)
+{
+    uint8_t byte{};
+
+    do
+    {
+        if (in == end)
+        {
+            throw std::runtime_error("Error: corrupted compressed data");
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+
+    return length;
+}
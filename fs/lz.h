@@ -0,0 +1,57 @@
+#ifndef __LZ_H__
+#define __LZ_H__
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A fast LZ77 codec in the style of LZ4, for data that is compressed once and
+ * decompressed often.
+ * The compressed data is a list of sequences. Every sequence starts with a
+ * token byte whose high nibble is the amount of literals and whose low nibble
+ * is the length of the match minus MIN_MATCH, where 15 means that more bytes
+ * follow, each adding up to 255. The token is followed by the literals, a
+ * 16-bit little-endian offset back to the match and the rest of the match
+ * length. The last sequence ends after its literals.
+ */
+class Lz
+{
+public:
+    /**
+     * Get the size of the largest output that compressing data can produce.
+     * @param size the size of the data.
+     */
+    static size_t bound(size_t size);
+
+    /**
+     * Compress data.
+     * @param src the data.
+     * @param size the size of the data.
+     * @param dst the buffer to compress into.
+     * @param capacity the size of the buffer.
+     * @return the size of the compressed data, or 0 if it doesn't fit in the
+     *         buffer.
+     */
+    static size_t compress(const char* src, size_t size, char* dst, size_t capacity);
+
+    /**
+     * Decompress data that was compressed with compress.
+     * @param src the compressed data.
+     * @param size the size of the compressed data.
+     * @param dst the buffer to decompress into.
+     * @param dstSize the size of the data before it was compressed.
+     * @throw std::runtime_error if the data is corrupted.
+     */
+    static void decompress(const char* src, size_t size, char* dst, size_t dstSize);
+
+private:
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr size_t MAX_OFFSET = 0xFFFF;
+    static constexpr int HASH_BITS = 12;
+
+    static uint32_t _hash(const uint8_t* data);
+    static bool _writeLength(size_t length, uint8_t*& out, const uint8_t* end);
+    static size_t _readLength(size_t length, const uint8_t*& in, const uint8_t* end);
+};
+
+#endif // __LZ_H__
@@ -1,9 +1,28 @@
 #include "myfs.h"
+#include "lz.h"
+#include "stats.h"
+#include <limits>
 
 const char* MyFs::MYFS_MAGIC = "MYFS";
 
-MyFs::MyFs(BlockDeviceSimulator* blkdevsim_) :
-        blkdevsim(blkdevsim_), _parts(MyFs::_calcParts())
+/**
+ * Divide two numbers and round the result up.
+ */
+static constexpr uint64_t ceilDiv(uint64_t value, uint64_t divisor)
+{
+    return value / divisor + (value % divisor != 0);
+}
+
+/**
+ * Round a number up to a multiple of an alignment.
+ */
+static constexpr uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return ceilDiv(value, alignment) * alignment;
+}
+
+MyFs::MyFs(BlockDevice* blkdevsim_, int block_size) :
+        blkdevsim(blkdevsim_), _parts(), _header(), _journal(blkdevsim_), _dentries(DENTRY_CACHE_SIZE)
 {
     struct myfs_header header{};
 
@@ -13,430 +32,2600 @@ MyFs::MyFs(BlockDeviceSimulator* blkdevsim_) :
     {
         std::cout << "Did not find myfs instance on blkdev" << std::endl;
         std::cout << "Creating..." << std::endl;
-        format();
+        format(block_size);
         std::cout << "Finished!" << std::endl;
     }
+    else
+    {
+        if (header.deviceSize > blkdevsim->size())
+        {
+            throw std::runtime_error("Error: the device is smaller than the file system");
+        }
+        this->_parts = MyFs::_calcParts(header.deviceSize, (int)header.blockSize);
+        this->_journal.load(this->_parts.journal, this->_parts.journalBlocks, this->_parts.blockSize);
+        this->_journal.replay();
+        // the counts in the header may have only been in the journal
+        blkdevsim->read(0, sizeof(this->_header), (char*)&this->_header);
+        this->_initializedInodes = (int)this->_header.initializedInodes;
+        this->_loadBitmaps();
+    }
+}
+
+MyFs::~MyFs()
+{
+    this->sync();
 }
 
 /**
  * Format the drive.
- * write the file system header, zero out the bitmaps and create root folder inode.
+ * write the file system header, zero out the bitmaps (and the inode table, unless
+ * it is initialized lazily) and create root folder inode.
  */
-void MyFs::format()
+void MyFs::format(int block_size, bool lazy_inodes)
 {
+    static const int METRIC = Stats::metric("myfs.format");
+    Stats::Timer timer(METRIC);
     struct myfs_header header{};
-    int bitMapsSize = this->_parts.root - this->_parts.blockBitMap;
-    auto* zeroesBuf = new uint8_t[bitMapsSize]{0};
+    uint64_t bitMapsSize{};
+    uint64_t inodeTableSize{};
     Inode root{};
 
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE ||
+        (block_size & (block_size - 1)) != 0)
+    {
+        throw std::runtime_error("Error: invalid block size");
+    }
+    this->_parts = MyFs::_calcParts(blkdevsim->size(), block_size);
+    this->_dentries.clear();
+    for (InodeCacheShard& shard : this->_inodeCache)
+    {
+        shard.inodes.clear();
+        shard.clock.clear();
+        shard.hand = 0;
+    }
+    this->_dirtyInodeBlocks.clear();
+    this->_freedRuns.clear();
+    this->_freedCount = 0;
+    this->_journal.load(this->_parts.journal, this->_parts.journalBlocks, block_size);
+    bitMapsSize = this->_parts.root - this->_parts.blockBitMap;
+    inodeTableSize = (uint64_t)this->_parts.inodeCount * sizeof(Inode);
+
     // put the header in place
     strncpy(header.magic, MYFS_MAGIC, sizeof(header.magic));
     header.version = CURR_VERSION;
+    header.blockSize = block_size;
+    header.deviceSize = blkdevsim->size();
+    header.freeBlocks = this->_parts.blockCount;
+    header.freeInodes = this->_parts.inodeCount;
+    header.initializedInodes = lazy_inodes ? 0 : this->_parts.inodeCount;
     blkdevsim->write(0, sizeof(header), (const char*)&header);
+    this->_header = header;
+    this->_initializedInodes = (int)header.initializedInodes;
 
     // zero out bit maps
-    blkdevsim->write(this->_parts.blockBitMap, bitMapsSize, (const char*)zeroesBuf);
-    delete[] zeroesBuf;
+    std::vector<uint8_t> zeroesBuf(bitMapsSize, 0);
+    blkdevsim->write(this->_parts.blockBitMap, bitMapsSize, (const char*)zeroesBuf.data());
+    if (!lazy_inodes)
+    {
+        zeroesBuf.assign(std::min<uint64_t>(inodeTableSize, INODE_TABLE_CHUNK), 0);
+        for (uint64_t done = 0; done < inodeTableSize; done += zeroesBuf.size())
+        {
+            blkdevsim->write(this->_parts.root + done,
+                             std::min<uint64_t>(zeroesBuf.size(), inodeTableSize - done),
+                             (const char*)zeroesBuf.data());
+        }
+    }
+    this->_journal.reset();
+    this->_loadBitmaps();
 
     // create root directory Inode
     root.directory = true;
     root.id = this->_allocateInode();
-    blkdevsim->write(this->_parts.root, sizeof(root), (const char*)&root);
+    this->_writeInode(root);
+    this->sync();
 }
 
 /**
- * Create a file in the root directory.
- * @param path_str the file's name.
- * @param directory whether the file is a directory. (directories are not yet implemented)
+ * Create a file.
+ * @param path_str the file's path.
+ * @param directory whether the file is a directory.
+ * @param compressed whether the file's data is compressed.
  */
-void MyFs::create_file(const std::string& path_str, bool directory)
+void MyFs::create_file(const std::string& path_str, bool directory, bool compressed)
 {
-    const size_t LAST_DELIMITER = path_str.find_last_of('/');
-    const std::string FILE_NAME = path_str.substr(LAST_DELIMITER + 1, std::string::npos);
+    static const int METRIC = Stats::metric("myfs.create_file");
+    Stats::Timer timer(METRIC);
+    const std::string_view PATH = path_str;
+    const size_t LAST_DELIMITER = PATH.find_last_of('/');
+    // the name is truncated to the length that can be stored in the directory
+    const std::string_view FILE_NAME = PATH.substr(LAST_DELIMITER + 1).substr(0, FILE_NAME_LEN - 1);
+    const int DIR_ID = this->_getInodeId(PATH.substr(0, LAST_DELIMITER));
     Inode file{};
-    Inode dir = this->_getInode(path_str.substr(0, LAST_DELIMITER));
+    Inode dir{};
     DirEntry fileDetails{};
 
-    // create file inode
-    file.id = this->_allocateInode();
-    file.directory = directory;
-    this->_writeInode(file);
+    {
+        Operation operation(*this, DIR_ID);
+
+        dir = this->_readInode(DIR_ID);
+        if (!dir.directory)
+        {
+            throw std::runtime_error("Error: not a directory");
+        }
+        if (FILE_NAME.empty())
+        {
+            throw std::runtime_error("Error: the file name is empty");
+        }
+        if (this->_lookup(dir, FILE_NAME) != DentryCache::NOT_FOUND)
+        {
+            throw std::runtime_error("Error: the file already exists");
+        }
+
+        // create file inode
+        file.id = this->_allocateInode();
+        file.directory = directory;
+        file.flags = compressed && !directory ? COMPRESSED : 0;
+        this->_writeInode(file);
 
-    // add the file to the directory that contains it
-    // copy the name, leave 1 byte to the null terminator
-    memcpy(fileDetails.name, FILE_NAME.c_str(), sizeof(fileDetails.name) - 1);
-    fileDetails.id = file.id;
-    this->_addFileToFolder(fileDetails, dir);
+        // add the file to the directory that contains it
+        // copy the name, the rest of the name buffer is the null terminator
+        FILE_NAME.copy(fileDetails.name, sizeof(fileDetails.name) - 1);
+        fileDetails.id = file.id;
+        this->_addFileToFolder(fileDetails, dir);
+        this->_dentries.insert(dir.id, FILE_NAME, file.id);
+    }
+    this->_commitIfFull();
 }
 
 std::string MyFs::get_content(const std::string& path_str) const
 {
-    const Inode FILE = this->_getInode(path_str);
-    const char* content = (char*)this->_readInodeData(FILE);
-    std::string contentStr = content;
+    static const int METRIC = Stats::metric("myfs.get_content");
+    Stats::Timer timer(METRIC);
+    const int FILE_ID = this->_getInodeId(path_str);
+    std::shared_lock lock(this->_inodeLock(FILE_ID));
+    const Inode FILE = this->_readInode(FILE_ID);
+    std::string content(FILE.size, '\0');
+
+    timer.setBytes(FILE.size);
+    this->_readInodeData(FILE, 0, FILE.size, content.data());
+
+    return content;
+}
+
+int MyFs::get_file_id(const std::string& path_str) const
+{
+    static const int METRIC = Stats::metric("myfs.get_file_id");
+    Stats::Timer timer(METRIC);
+
+    return this->_getInodeId(path_str);
+}
+
+size_t MyFs::read(const std::string& path_str, size_t offset, size_t length, char* dst) const
+{
+    return this->read(this->get_file_id(path_str), offset, length, dst);
+}
+
+size_t MyFs::read(int file, size_t offset, size_t length, char* dst) const
+{
+    static const int METRIC = Stats::metric("myfs.read");
+    Stats::Timer timer(METRIC);
+    std::shared_lock lock(this->_inodeLock(file));
+    const Inode INODE = this->_readInode(file);
 
-    delete[] content;
+    if (offset >= INODE.size)
+    {
+        return 0;
+    }
+    length = std::min(length, INODE.size - offset);
+    timer.setBytes(length);
+    this->_readInodeData(INODE, offset, length, dst);
+
+    return length;
+}
+
+size_t MyFs::read(int file, size_t offset, std::span<char> dst) const
+{
+    return this->read(file, offset, dst.size(), dst.data());
+}
+
+const char* MyFs::view(int file, size_t offset, size_t length) const
+{
+    static const int METRIC = Stats::metric("myfs.view");
+    Stats::Timer timer(METRIC, length);
+    std::shared_lock lock(this->_inodeLock(file));
+    const Inode INODE = this->_readInode(file);
+    size_t extentStart{};
+    size_t extentEnd{};
+
+    // the blocks of a directory may have changes that are only in the journal
+    if (offset + length > INODE.size || INODE.directory || (INODE.flags & COMPRESSED))
+    {
+        return nullptr;
+    }
+    for (const Extent& extent : this->_readExtents(INODE))
+    {
+        extentStart = (size_t)extent.fileBlock * this->_parts.blockSize;
+        extentEnd = extentStart + (size_t)extent.length * this->_parts.blockSize;
+        if (offset >= extentStart && offset + length <= extentEnd)
+        {
+            return this->blkdevsim->view(this->_getBlockAddress(extent.start) + (offset - extentStart),
+                                         length);
+        }
+    }
 
-    return contentStr;
+    return nullptr;
 }
 
 void MyFs::set_content(const std::string& path_str, const std::string& content)
 {
-    const size_t NEW_SIZE = content.size();
-    const unsigned int LAST_POINTER = NEW_SIZE / BLOCK_SIZE;
-    const char* cStrContent = content.c_str();
-    Inode file = this->_getInode(path_str);
-    unsigned int pointer{};
-    int toWrite{};
-    size_t bytesWritten{};
+    this->_setContent(path_str, content, std::nullopt);
+}
+
+void MyFs::set_content(const std::string& path_str, const std::string& content, bool compressed)
+{
+    this->_setContent(path_str, content, compressed);
+}
+
+void MyFs::write(int file, size_t offset, std::string_view data)
+{
+    static const int METRIC = Stats::metric("myfs.write");
+    Stats::Timer timer(METRIC, data.size());
+    Inode inode{};
 
-    file = this->_reallocateBlocks(file, NEW_SIZE);
-    file.size = NEW_SIZE;
-    while (bytesWritten != file.size)
     {
-        toWrite = pointer == LAST_POINTER ?
-                  (int)(file.size % BLOCK_SIZE) : BLOCK_SIZE;
-        this->blkdevsim->write(file.addresses[pointer],
-                               toWrite,
-                               cStrContent + bytesWritten);
-        bytesWritten += toWrite;
-        pointer++;
+        Operation operation(*this, file);
+
+        inode = this->_readInode(file);
+        this->_write(inode, offset, data);
     }
-    this->_writeInode(file);
+    this->_commitIfFull();
 }
 
-MyFs::dir_list MyFs::list_dir(const std::string& path_str)
+void MyFs::write(const std::string& path_str, size_t offset, std::string_view data)
 {
-    dir_list ans;
-    dir_list_entry entry{};
-    const Inode DIR = this->_getInode(path_str);
-    const auto* rootDirContent = (DirEntry*)this->_readInodeData(DIR);
-    Inode file{};
-    size_t dirEntries{};
+    this->write(this->get_file_id(path_str), offset, data);
+}
+
+void MyFs::append(int file, std::string_view data)
+{
+    static const int METRIC = Stats::metric("myfs.append");
+    Stats::Timer timer(METRIC, data.size());
+    Inode inode{};
 
-    dirEntries = DIR.size / sizeof(DirEntry);
-    for (size_t i = 0; i < dirEntries; i++)
     {
-        entry.name = rootDirContent[i].name;
-        this->blkdevsim->read(this->_getInodeAddress(rootDirContent[i].id),
-                              sizeof(Inode),
-                              (char*)&file);
-        entry.file_size = (int)file.size;
-        entry.is_dir = file.directory;
-        ans.push_back(entry);
+        // the size is read under the same lock as the write, so appends of
+        // several threads don't overwrite each other
+        Operation operation(*this, file);
+
+        inode = this->_readInode(file);
+        this->_write(inode, inode.size, data);
     }
-    delete[] rootDirContent;
+    this->_commitIfFull();
+}
 
-    return ans;
+void MyFs::append(const std::string& path_str, std::string_view data)
+{
+    this->append(this->get_file_id(path_str), data);
 }
 
-/**
- * Calculate the disk parts for the file system.
- * @param deviceSize the disk device size.
- * @return a struct with pointers to every segment.
- */
-constexpr MyFs::DiskParts MyFs::_calcParts()
+void MyFs::truncate(int file, size_t size)
 {
-    const int deviceSize = BlockDeviceSimulator::DEVICE_SIZE;
-    DiskParts parts{};
-    int remainingSpace = deviceSize - (int)sizeof(myfs_header);
-    int amountOfBlocks = remainingSpace / BLOCK_SIZE;
-    int amountOfInodes = 0;
+    static const int METRIC = Stats::metric("myfs.truncate");
+    Stats::Timer timer(METRIC);
+    Inode inode{};
 
-    parts.blockBitMap = sizeof(myfs_header);
-    parts.inodeBitMap = parts.blockBitMap;
-    // make room for the blocks bit map
-    while ((parts.inodeBitMap - parts.blockBitMap) * BITS_IN_BYTE < amountOfBlocks)
     {
-        if ((parts.inodeBitMap - parts.blockBitMap) % BLOCK_SIZE == 0)
+        Operation operation(*this, file);
+
+        inode = this->_readInode(file);
+        if (inode.directory)
         {
-            amountOfBlocks--;
+            throw std::runtime_error("Error: is a directory");
         }
-        parts.inodeBitMap++;
+        this->_truncate(inode, size);
     }
-    remainingSpace = deviceSize - parts.inodeBitMap;
-    amountOfInodes = remainingSpace / BYTES_PER_INODE;
-    parts.root = parts.inodeBitMap + (int)std::ceil((float)amountOfInodes / BITS_IN_BYTE);
-    parts.unused = parts.root + amountOfInodes * (int)sizeof(Inode);
-
-    parts.data = parts.unused + (deviceSize - parts.unused) % BLOCK_SIZE;
+    this->_commitIfFull();
+}
 
-    return parts;
+void MyFs::truncate(const std::string& path_str, size_t size)
+{
+    this->truncate(this->get_file_id(path_str), size);
 }
 
-/**
- * Find an unoccupied bit in a bitmap and allocate it.
- * @param bitmapStart address of the start of the bitmap.
- * @return the index of the allocated bit in the bitmap.
- */
-int MyFs::_allocate(int bitmapStart)
+void MyFs::remove_file(const std::string& path_str)
 {
-    constexpr int BITS_IN_BUFFER = 64;
-    constexpr int BYTES_IN_BUFFER = BITS_IN_BUFFER / BITS_IN_BYTE;
-    constexpr uint64_t ALL_OCCUPIED = 0xFFFFFFFFFFFFFFFF;
-    uint64_t buffer = 0;
-    int address = bitmapStart;
+    static const int METRIC = Stats::metric("myfs.remove_file");
+    Stats::Timer timer(METRIC);
+    const std::string_view PATH = path_str;
+    const size_t LAST_DELIMITER = PATH.find_last_of('/');
+    const std::string_view FILE_NAME = PATH.substr(LAST_DELIMITER + 1).substr(0, FILE_NAME_LEN - 1);
+    const int DIR_ID = this->_getInodeId(PATH.substr(0, LAST_DELIMITER));
+    const int FILE_ID = this->_getInodeId(PATH);
+    Inode dir{};
+    Inode file{};
+    Inode freed{};
 
-    // read the bitmap until an unoccupied memory is found
-    do
+    if (FILE_ID == ROOT_INODE)
     {
-        this->blkdevsim->read(address, BYTES_IN_BUFFER, (char*)&buffer);
-        address += BYTES_IN_BUFFER;
-    } while (buffer == ALL_OCCUPIED);
-    address -= BYTES_IN_BUFFER;
+        throw std::runtime_error("Error: the root directory can't be removed");
+    }
 
-    // read the buffer until an unoccupied memory is found
-    for (int i = 0; i < BITS_IN_BUFFER; i++)
     {
-        if (!(buffer & (1 << i))) // if the (i)'s bit is 0
+        Operation operation(*this, DIR_ID, FILE_ID);
+
+        dir = this->_readInode(DIR_ID);
+        // the file may have been removed or replaced before it was locked
+        if (FILE_NAME.empty() || this->_lookup(dir, FILE_NAME) != FILE_ID)
+        {
+            throw std::runtime_error("Error: the file was not found");
+        }
+        file = this->_readInode(FILE_ID);
+        if (file.directory && !this->_readDirEntries(file).empty())
         {
-            buffer ^= 1 << i; // flip the bit to mark as occupied
-            this->blkdevsim->write(address, BYTES_IN_BUFFER, (const char*)&buffer);
+            throw std::runtime_error("Error: the directory is not empty");
+        }
 
-            // get the index in the bitmap
-            address -= bitmapStart;
-            address += i;
+        this->_removeFromFolder(dir, FILE_NAME);
+        this->_dentries.insert(DIR_ID, FILE_NAME, DentryCache::NOT_FOUND);
+        this->_truncateBlocks(file, 0);
+        freed.id = FILE_ID;
+        this->_writeInode(freed);
+        {
+            std::lock_guard lock(this->_allocatorLock);
 
-            // once we found unoccupied space, we finished our task
-            break;
+            this->_deallocate(this->_inodeBitmap, FILE_ID);
         }
     }
-    return address;
+    this->_commitIfFull();
 }
 
-/**
- * Deallocate a bit from a bitmap.
- * @param bitmapStart address of the start of the bitmap.
- * @param n the index of the allocated bit in the bitmap.
- */
-void MyFs::_deallocate(int bitmapStart, int n)
+MyFs::dir_list MyFs::list_dir(const std::string& path_str) const
+{
+    return this->list_dir(this->_getInodeId(path_str));
+}
+
+MyFs::dir_list MyFs::list_dir(int dir) const
 {
-    int byteAddress = bitmapStart + n / BITS_IN_BYTE;
-    int byte = 0;
-    unsigned int offset = n % BITS_IN_BYTE;
+    static const int METRIC = Stats::metric("myfs.list_dir");
+    Stats::Timer timer(METRIC);
+    std::shared_lock lock(this->_inodeLock(dir));
+    const Inode DIR = this->_readInode(dir);
+    dir_list ans;
+    std::vector<DirEntry> entries;
+    std::vector<int> ids;
+    std::vector<Inode> files;
+
+    if (!DIR.directory)
+    {
+        throw std::runtime_error("Error: not a directory");
+    }
+
+    entries = this->_readDirEntries(DIR);
+    ids.reserve(entries.size());
+    for (const DirEntry& entry : entries)
+    {
+        ids.push_back(entry.id);
+    }
+    files = this->_readInodes(ids);
+
+    ans.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        ans.push_back({ std::string(_getEntryName(entries[i])),
+                        files[i].directory,
+                        (int)files[i].size,
+                        entries[i].id });
+    }
 
-    this->blkdevsim->read(byteAddress, 1, (char*)&byte);
-    byte ^= 1 << offset; // flip the bit to mark as unoccupied
-    this->blkdevsim->write(byteAddress, 1, (const char*)&byte);
+    return ans;
 }
 
-/**
- * Resize the amount of blocks an inode points to.
- * Deallocate or allocate blocks according to the new size.
- * @param inode the inode's properties.
- * @param newSize the new intended size in bytes.
- * @return the same inode with updated pointers.
- */
-MyFs::Inode MyFs::_reallocateBlocks(const MyFs::Inode& inode, size_t newSize)
+MyFs::tree_walker MyFs::walk(const std::string& path_str) const
+{
+    return tree_walker(*this, this->_getInodeId(path_str));
+}
+
+MyFs::tree_walker::tree_walker(const MyFs& fs, int dir) :
+        _fs(fs)
 {
-    int i = 0;
-    int usedBlocks{};
-    size_t requiredBlocks = newSize / BLOCK_SIZE + (newSize % BLOCK_SIZE != 0);
-    int blocksToAllocate{};
-    Inode newAddresses = inode;
+    this->_frames.push_back({ fs.list_dir(dir), 0 });
+}
 
-    if (requiredBlocks > DIRECT_POINTERS)
+bool MyFs::tree_walker::next(tree_entry& entry)
+{
+    while (!this->_frames.empty() && this->_frames.back().next == this->_frames.back().entries.size())
     {
-        throw std::runtime_error("Error: reached maximum file size");
+        this->_frames.pop_back();
+    }
+    if (this->_frames.empty())
+    {
+        return false;
     }
 
-    // check how many blocks are in use
-    while (newAddresses.addresses[usedBlocks] != 0)
+    Frame& top = this->_frames.back();
+    const dir_list_entry& child = top.entries[top.next++];
+
+    entry = { child, (int)this->_frames.size() - 1, top.next == top.entries.size() };
+    if (entry.is_dir)
     {
-        usedBlocks++;
+        // top is invalidated by the push
+        this->_frames.push_back({ this->_fs.list_dir(entry.id), 0 });
     }
-    blocksToAllocate = (int)(requiredBlocks - usedBlocks);
-    // if we need to allocate
-    if (blocksToAllocate > 0)
+
+    return true;
+}
+
+void MyFs::sync()
+{
+    static const int METRIC = Stats::metric("myfs.sync");
+    Stats::Timer timer(METRIC);
+
+    this->_commit(false);
+}
+
+MyFs::fs_stats MyFs::statfs() const
+{
+    std::lock_guard lock(this->_allocatorLock);
+
+    return { this->_parts.blockSize,
+             this->_parts.blockCount,
+             this->_blockBitmap.countFree() + this->_freedCount,
+             this->_parts.inodeCount,
+             this->_inodeBitmap.countFree() };
+}
+
+double MyFs::fragmentation() const
+{
+    uint64_t breaks{};
+    uint64_t blocks{};
+    int count{};
+
+    for (int id : this->_allocatedInodes())
     {
-        for (i = 0; i < blocksToAllocate; i++)
+        std::shared_lock lock(this->_inodeLock(id));
+        const std::vector<Extent> EXTENTS = this->_readExtents(this->_readInode(id));
+
+        count = MyFs::_countBlocks(EXTENTS, 0, std::numeric_limits<int>::max());
+        if (count != 0)
         {
-            newAddresses.addresses[usedBlocks] = this->_allocateBlock();
-            usedBlocks++;
+            breaks += MyFs::_countRuns(EXTENTS) - 1;
+            blocks += count - 1;
         }
     }
-    // if we need to deallocate
-    else if (blocksToAllocate < 0)
+
+    return blocks == 0 ? 0 : 100.0 * (double)breaks / (double)blocks;
+}
+
+MyFs::defrag_stats MyFs::defrag(bool pack_directories)
+{
+    static const int METRIC = Stats::metric("myfs.defrag");
+    Stats::Timer timer(METRIC);
+    defrag_stats stats{};
+    std::vector<int> ids;
+    std::vector<Inode> inodes;
+
+    // the blocks that were freed before can only be moved to once they are
+    // committed
+    this->sync();
+    stats.fragmentation_before = this->fragmentation();
+
+    ids = this->_allocatedInodes();
+    if (pack_directories)
+    {
+        // the directories are moved first, so they take the first free runs
+        inodes = this->_readInodes(ids);
+        std::stable_partition(inodes.begin(), inodes.end(), [](const Inode& inode) {
+            return inode.directory;
+        });
+        std::transform(inodes.begin(), inodes.end(), ids.begin(), [](const Inode& inode) {
+            return inode.id;
+        });
+    }
+    for (int id : ids)
     {
-        for (i = 0; i < -blocksToAllocate; i++)
+        if (this->_defragInode(id, pack_directories, stats.blocks_moved))
         {
-            usedBlocks--;
-            this->_deallocateBlock(newAddresses.addresses[usedBlocks]);
-            newAddresses.addresses[usedBlocks] = 0;
+            stats.files_moved++;
         }
+        this->_commitIfFull();
     }
 
-    return newAddresses;
+    this->sync();
+    stats.fragmentation_after = this->fragmentation();
+    timer.setBytes((uint64_t)stats.blocks_moved * this->_parts.blockSize);
+
+    return stats;
 }
 
-/**
- * Find an empty space for an inode and allocate it.
- * @return the inode's id.
- */
-int MyFs::_allocateInode()
+MyFs::Operation::Operation(MyFs& fs, int inode) :
+        Operation(fs, inode, inode)
 {
-    return this->_allocate(this->_parts.inodeBitMap);
 }
 
-/**
- * Find an empty block and allocate it.
- * @return address of the block.
- */
-int MyFs::_allocateBlock()
+MyFs::Operation::Operation(MyFs& fs, int inode, int other) :
+        _fs(fs), _inodeLock(fs._inodeLock(inode), std::defer_lock),
+        _otherLock(fs._inodeLock(other), std::defer_lock)
 {
-    int address = this->_allocate(this->_parts.blockBitMap);
+    if (this->_inodeLock.mutex() == this->_otherLock.mutex())
+    {
+        this->_inodeLock.lock();
+        this->_otherLock.release();
+    }
+    else
+    {
+        std::lock(this->_inodeLock, this->_otherLock);
+    }
 
-    // get physical address of the occupied block
-    address *= BLOCK_SIZE;
-    address += this->_parts.data;
+    std::unique_lock lock(fs._transactionLock);
 
-    return address;
+    fs._transactionChanged.wait(lock, [&fs] { return !fs._committing; });
+    fs._activeOperations++;
 }
 
-/**
- * Deallocate a block of disk memory.
- * @param address the address of the block.
- */
-void MyFs::_deallocateBlock(int address)
+MyFs::Operation::~Operation()
 {
-    int blockNumber = (address - this->_parts.data) / BLOCK_SIZE;
+    std::lock_guard lock(this->_fs._transactionLock);
 
-    this->_deallocate(this->_parts.blockBitMap, blockNumber);
+    this->_fs._activeOperations--;
+    this->_fs._transactionChanged.notify_all();
 }
 
 /**
- * Get an inode's physical address.
- * @param id the inode's id.
- * @return the inode's address on disk.
+ * Calculate the disk parts for the file system.
+ * Every bitmap starts on a 64-bit word, and the journal region and the data
+ * region that follows it start on a block boundary.
+ * @param deviceSize the disk device size.
+ * @param blockSize the size of a data block.
+ * @return a struct with pointers to every segment.
  */
-int MyFs::_getInodeAddress(int id) const
+MyFs::DiskParts MyFs::_calcParts(uint64_t deviceSize, int blockSize)
 {
-    return this->_parts.root + id * (int)sizeof(Inode);
+    constexpr uint64_t WORD_SIZE = sizeof(uint64_t);
+    const uint64_t INODES = deviceSize / BYTES_PER_INODE;
+    const uint64_t INODE_BIT_MAP_SIZE = alignUp(ceilDiv(INODES, BITS_IN_BYTE), WORD_SIZE);
+    const uint64_t JOURNAL_SIZE = std::max(
+            alignUp(std::clamp(deviceSize / JOURNAL_RATIO, (uint64_t)JOURNAL_MIN_SIZE, (uint64_t)JOURNAL_MAX_SIZE),
+                    blockSize),
+            (uint64_t)JOURNAL_MIN_BLOCKS * blockSize);
+    DiskParts parts{};
+    uint64_t metadataSize{};
+    uint64_t blocks{};
+
+    parts.blockSize = blockSize;
+    parts.blockBitMap = alignUp(sizeof(myfs_header), WORD_SIZE);
+    metadataSize = parts.blockBitMap + INODE_BIT_MAP_SIZE + INODES * sizeof(Inode) + JOURNAL_SIZE;
+    if (INODES == 0 || metadataSize + blockSize > deviceSize)
+    {
+        throw std::runtime_error("Error: the device is too small");
+    }
+
+    // start by giving every byte that is left to the data region, and give up
+    // blocks until the block bit map fits as well
+    blocks = (deviceSize - metadataSize) / blockSize;
+    while (true)
+    {
+        parts.inodeBitMap = parts.blockBitMap + alignUp(ceilDiv(blocks, BITS_IN_BYTE), WORD_SIZE);
+        parts.root = parts.inodeBitMap + INODE_BIT_MAP_SIZE;
+        parts.unused = parts.root + INODES * sizeof(Inode);
+        parts.journal = alignUp(parts.unused, blockSize);
+        parts.data = parts.journal + JOURNAL_SIZE;
+        if (parts.data + blocks * blockSize <= deviceSize)
+        {
+            break;
+        }
+        if (--blocks == 0)
+        {
+            throw std::runtime_error("Error: the device is too small");
+        }
+    }
+
+    if (blocks > (uint64_t)std::numeric_limits<int>::max() ||
+        INODES > (uint64_t)std::numeric_limits<int>::max())
+    {
+        throw std::runtime_error("Error: the device is too large for the block size");
+    }
+    parts.blockCount = (int)blocks;
+    parts.inodeCount = (int)INODES;
+    parts.journalBlocks = (int)(JOURNAL_SIZE / blockSize);
+
+    return parts;
 }
 
 /**
- * Add a file to a folder.
- * @param file the name and inode id of the file that will be written to disk.
- * @param folder the inode of the folder.
+ * Read the allocation bitmaps from the disk into memory.
+ * The free entries aren't counted, their amounts are taken from the header.
  */
-void MyFs::_addFileToFolder(const MyFs::DirEntry& file, MyFs::Inode& folder)
+void MyFs::_loadBitmaps()
 {
-    unsigned int pointer = folder.size / BLOCK_SIZE;
-    int bytesLeft = sizeof(file);
-    int address{};
-    int spaceTakenInLastBlock = (int)(folder.size % BLOCK_SIZE);
-    int emptySpace{};
-    int toWrite{};
-    size_t written{};
-
-    folder = this->_reallocateBlocks(folder, folder.size + sizeof(file));
-    address = folder.addresses[pointer] + spaceTakenInLastBlock;
-    emptySpace = BLOCK_SIZE - spaceTakenInLastBlock;
-    toWrite = bytesLeft > emptySpace ? emptySpace : bytesLeft;
-    do
-    {
-        this->blkdevsim->write(
-                address,
-                toWrite,
-                (char*)&file + written
-        );
-        folder.size += toWrite;
-        written += toWrite;
-        bytesLeft -= toWrite;
-        pointer++;
-        address = folder.addresses[pointer];
-
-        // setup for next iteration
-        toWrite = bytesLeft > BLOCK_SIZE ? BLOCK_SIZE : bytesLeft;
-    } while (bytesLeft != 0);
-
-    this->_writeInode(folder);
+    this->_blockBitmap.load(this->_journal, this->_parts.blockBitMap, this->_parts.blockCount,
+                            (int)this->_header.freeBlocks);
+    this->_inodeBitmap.load(this->_journal, this->_parts.inodeBitMap, this->_parts.inodeCount,
+                            (int)this->_header.freeInodes);
 }
 
 /**
- * Read the data an inode points to.
- * @param inode the inode.
- * @return the data that was read.
+ * Find an unoccupied bit in a bitmap and allocate it.
+ * @param bitmap the bitmap.
+ * @return the index of the allocated bit in the bitmap.
  */
-void* MyFs::_readInodeData(const MyFs::Inode& inode) const
+int MyFs::_allocate(Bitmap& bitmap)
 {
-    const unsigned int LAST_POINTER = inode.size / BLOCK_SIZE;
-    unsigned int pointer = 0;
-    int toRead{};
-    auto* buffer = new uint8_t[inode.size];
-    size_t bytesRead{};
+    std::lock_guard lock(this->_allocatorLock);
+    int index = bitmap.allocate();
 
-    while (bytesRead != inode.size)
+    if (index == -1)
     {
-        toRead = pointer == LAST_POINTER ?
-                 (int)(inode.size % BLOCK_SIZE) : BLOCK_SIZE;
-        this->blkdevsim->read(inode.addresses[pointer],
-                              toRead,
-                              (char*)buffer + bytesRead);
-        bytesRead += toRead;
-        pointer++;
+        throw std::runtime_error("Error: not enough disk space");
     }
 
-    return buffer;
+    return index;
+}
+
+/**
+ * Deallocate a bit from a bitmap.
+ * Note: the caller must hold the allocator lock.
+ * @param bitmap the bitmap.
+ * @param n the index of the allocated bit in the bitmap.
+ */
+void MyFs::_deallocate(Bitmap& bitmap, int n)
+{
+    bitmap.clear(n);
 }
 
-MyFs::Inode MyFs::_getRootDir() const
+/**
+ * Resize the amount of blocks an inode points to.
+ * Every block in the new size is allocated, including the blocks of holes,
+ * and the blocks after it are deallocated.
+ * @param inode the inode's properties.
+ * @param newSize the new intended size in bytes.
+ * @return the same inode with updated extents.
+ */
+MyFs::Inode MyFs::_reallocateBlocks(const MyFs::Inode& inode, size_t newSize)
 {
-    Inode ans{};
+    Inode resized = inode;
 
-    this->blkdevsim->read(this->_parts.root,
-                          sizeof(Inode),
-                          (char*)&ans);
+    this->_truncateBlocks(resized, newSize);
+    this->_allocateRange(resized, 0, newSize);
 
-    return ans;
+    return resized;
 }
 
 /**
- * Get file's inode by path, assuming it exists
- * @param path the file's path.
- * @return the file's inode.
+ * Allocate the blocks of a range inside a file that are not allocated yet.
+ * If the file fits in its inode with the range, it is stored there and no
+ * block is allocated. A file that was stored in its inode and doesn't fit
+ * there anymore is moved to a block first.
+ * The missing blocks are reserved with a single allocation that prefers the
+ * blocks that follow the extent before the first missing block, so the file
+ * stays contiguous when possible. The parts of the new blocks that are
+ * outside of the range are zeroed.
+ * Note: the inode itself is not written to the disk.
+ * @param inode the inode.
+ * @param offset the offset of the range inside the file.
+ * @param length the length of the range.
  */
-MyFs::Inode MyFs::_getInode(std::string path) const
+void MyFs::_allocateRange(MyFs::Inode& inode, size_t offset, size_t length)
 {
-    size_t nextDelimiter = path.find('/');
-    std::string nextFolder;
-    Inode inode = this->_getRootDir();
-    DirEntry* dirContent = nullptr;
-    int index{};
+    const size_t BLOCK_SIZE = this->_parts.blockSize;
+    const int FIRST = (int)(offset / BLOCK_SIZE);
+    const int END = (int)ceilDiv(offset + length, BLOCK_SIZE);
+    std::vector<Extent> extents = this->_readExtents(inode);
+    std::vector<Extent> holes; // ranges of file blocks that have no blocks
+    std::vector<Extent> added;
+    std::vector<Bitmap::Run> runs;
+    std::vector<char> zeroes;
+    std::vector<BlockDevice::Request> requests;
+    int fileBlock{};
+    int count{};
+    int goal = -1;
+    size_t run{};
+    int usedFromRun{};
+    int toUse{};
+    size_t extentStart{};
+    size_t extentEnd{};
+
+    if (length == 0)
+    {
+        return;
+    }
+    if (MyFs::_fitsInline(inode, offset + length))
+    {
+        if (!(inode.flags & INLINE_DATA))
+        {
+            inode.flags |= INLINE_DATA;
+            memset(inode.inlineData, 0, sizeof(inode.inlineData));
+        }
+        return;
+    }
+    if (inode.flags & INLINE_DATA)
+    {
+        this->_moveInlineData(inode);
+        extents = this->_readExtents(inode);
+    }
+
+    count = MyFs::_findHoles(extents, FIRST, END, holes);
+    if (count == 0)
+    {
+        return;
+    }
 
-    if (path == "/")
+    for (const Extent& extent : extents)
     {
-        return inode; // return root dir
+        if (extent.fileBlock + extent.length == holes.front().fileBlock)
+        {
+            goal = extent.start + extent.length;
+        }
     }
+    runs = this->_allocateBlocks(count, goal);
 
-    while (nextDelimiter != std::string::npos)
+    // spread the allocated runs over the holes
+    for (const Extent& hole : holes)
     {
-        dirContent = (DirEntry*)this->_readInodeData(inode);
-        path = path.substr(nextDelimiter + 1, std::string::npos);
-        nextDelimiter = path.find('/');
-        nextFolder = path.substr(0, nextDelimiter);
-        while (strcmp(dirContent[index].name, nextFolder.c_str()) != 0)
+        for (fileBlock = hole.fileBlock; fileBlock < hole.fileBlock + hole.length; fileBlock += toUse)
         {
-            index++;
+            toUse = std::min(hole.fileBlock + hole.length - fileBlock,
+                             runs[run].length - usedFromRun);
+            added.push_back({ fileBlock, runs[run].start + usedFromRun, toUse });
+            usedFromRun += toUse;
+            if (usedFromRun == runs[run].length)
+            {
+                run++;
+                usedFromRun = 0;
+            }
         }
-        this->blkdevsim->read(
-                this->_getInodeAddress(dirContent[index].id),
-                sizeof(Inode),
-                (char*)&inode);
-        index = 0;
-        delete[] dirContent;
     }
+    extents.insert(extents.end(), added.begin(), added.end());
+    _mergeExtents(extents);
+    this->_writeExtents(inode, extents);
 
-    return inode;
+    zeroes.resize(BLOCK_SIZE, 0);
+    for (const Extent& extent : added)
+    {
+        extentStart = extent.fileBlock * BLOCK_SIZE;
+        extentEnd = extentStart + extent.length * BLOCK_SIZE;
+        if (extentStart < offset)
+        {
+            requests.push_back({ true, this->_getBlockAddress(extent.start),
+                                 std::min(offset, extentEnd) - extentStart,
+                                 zeroes.data() });
+        }
+        if (extentEnd > offset + length)
+        {
+            const size_t FROM = std::max(offset + length, extentStart);
+
+            requests.push_back({ true, this->_getBlockAddress(extent.start) + (FROM - extentStart),
+                                 extentEnd - FROM,
+                                 zeroes.data() });
+        }
+    }
+    this->_submit(inode, requests);
 }
 
 /**
- * Write an inode to the disk.
+ * Make sure that the blocks which a range inside a file is missing can be
+ * allocated, before anything is changed to make room for the range.
+ * See _reserveBlocks.
  * @param inode the inode.
+ * @param offset the offset of the range inside the file.
+ * @param length the length of the range.
  */
-void MyFs::_writeInode(const MyFs::Inode& inode)
+void MyFs::_checkSpace(const MyFs::Inode& inode, size_t offset, size_t length)
+{
+    const size_t BLOCK_SIZE = this->_parts.blockSize;
+    std::vector<Extent> holes;
+    int missing{};
+
+    if (length == 0 || MyFs::_fitsInline(inode, offset + length))
+    {
+        return;
+    }
+    missing = MyFs::_findHoles(this->_readExtents(inode), (int)(offset / BLOCK_SIZE),
+                               (int)ceilDiv(offset + length, BLOCK_SIZE), holes);
+    this->_reserveBlocks(missing);
+}
+
+/**
+ * Make sure that blocks can be allocated, before an operation changes
+ * anything.
+ * The blocks that were freed in the running transaction are counted as free.
+ * If they are needed, the transaction is committed first so they can be
+ * reused, because a commit in the middle of the operation would commit half
+ * of it. Operations on other files may still take the free blocks first, in
+ * which case the allocation itself fails.
+ * @param count the amount of blocks.
+ */
+void MyFs::_reserveBlocks(int count)
 {
-    this->blkdevsim->write(this->_getInodeAddress(inode.id),
-                           sizeof(inode),
-                           (const char*)&inode);
+    std::unique_lock lock(this->_allocatorLock);
+
+    if (count > this->_blockBitmap.countFree() + this->_freedCount)
+    {
+        throw std::runtime_error("Error: not enough disk space");
+    }
+    if (count > this->_blockBitmap.countFree())
+    {
+        lock.unlock();
+        this->_commit(true);
+    }
+}
+
+/**
+ * Check whether the data of an inode can be stored inside it after the inode
+ * is extended to a size. A file that has blocks stays in them, because
+ * it can't be moved without reading them.
+ * @param inode the inode.
+ * @param end the size that the inode is extended to.
+ */
+bool MyFs::_fitsInline(const MyFs::Inode& inode, size_t end)
+{
+    return !(inode.flags & INDEXED_DIR) && std::max(inode.size, end) <= INLINE_SIZE &&
+           ((inode.flags & INLINE_DATA) || inode.extentCount == 0);
+}
+
+/**
+ * Move the data that is stored inside an inode to a block of its own.
+ * Note: the inode itself is not written to the disk.
+ * @param inode the inode.
+ */
+void MyFs::_moveInlineData(MyFs::Inode& inode)
+{
+    std::vector<char> block(this->_parts.blockSize, 0);
+
+    memcpy(block.data(), inode.inlineData, sizeof(inode.inlineData));
+    inode.flags &= ~INLINE_DATA;
+    memset(inode.inlineData, 0, sizeof(inode.inlineData));
+    inode.extentCount = 0;
+    if (inode.size != 0)
+    {
+        this->_writeExtents(inode, { { 0, this->_allocateRun(1), 1 } });
+        this->_writeInodeData(inode, 0, block.size(), block.data());
+    }
+}
+
+/**
+ * Find the ranges of file blocks inside a range that no extent holds.
+ * @param extents the extents of a file, sorted by their position in the file.
+ * @param first the first file block of the range.
+ * @param end the file block after the range.
+ * @param holes the ranges are added to it, as extents whose start is 0.
+ * @return the amount of blocks in the ranges.
+ */
+int MyFs::_findHoles(const std::vector<Extent>& extents, int first, int end, std::vector<Extent>& holes)
+{
+    int fileBlock = first;
+    int count{};
+
+    for (const Extent& extent : extents)
+    {
+        if (extent.fileBlock >= end)
+        {
+            break;
+        }
+        if (extent.fileBlock > fileBlock)
+        {
+            holes.push_back({ fileBlock, 0, extent.fileBlock - fileBlock });
+            count += extent.fileBlock - fileBlock;
+        }
+        fileBlock = std::max(fileBlock, extent.fileBlock + extent.length);
+    }
+    if (fileBlock < end)
+    {
+        holes.push_back({ fileBlock, 0, end - fileBlock });
+        count += end - fileBlock;
+    }
+
+    return count;
+}
+
+/**
+ * Deallocate the blocks of a file that are past a size.
+ * Note: the inode itself is not written to the disk.
+ * @param inode the inode.
+ * @param size the size of the file in bytes.
+ */
+void MyFs::_truncateBlocks(MyFs::Inode& inode, size_t size)
+{
+    const int REQUIRED_BLOCKS = (int)ceilDiv(size, this->_parts.blockSize);
+    std::vector<Extent> extents = this->_readExtents(inode);
+    bool changed = false;
+    int toKeep{};
+
+    if (inode.flags & INLINE_DATA)
+    {
+        if (size < sizeof(inode.inlineData))
+        {
+            memset(inode.inlineData + size, 0, sizeof(inode.inlineData) - size);
+        }
+        return;
+    }
+
+    while (!extents.empty() &&
+           extents.back().fileBlock + extents.back().length > REQUIRED_BLOCKS)
+    {
+        Extent& last = extents.back();
+
+        toKeep = std::max(REQUIRED_BLOCKS - last.fileBlock, 0);
+        this->_deallocateBlocks(last.start + toKeep, last.length - toKeep);
+        last.length = toKeep;
+        if (last.length == 0)
+        {
+            extents.pop_back();
+        }
+        changed = true;
+    }
+    if (changed)
+    {
+        this->_writeExtents(inode, extents);
+    }
+}
+
+/**
+ * Deallocate the blocks of a file in a range of file blocks, which becomes a
+ * hole.
+ * Note: the inode itself is not written to the disk.
+ * @param inode the inode.
+ * @param first the first file block of the range.
+ * @param end the file block after the range.
+ */
+void MyFs::_freeBlockRange(MyFs::Inode& inode, int first, int end)
+{
+    const std::vector<Extent> EXTENTS = this->_readExtents(inode);
+    std::vector<Extent> kept;
+    int from{};
+    int to{};
+
+    for (const Extent& extent : EXTENTS)
+    {
+        from = std::max(first, extent.fileBlock);
+        to = std::min(end, extent.fileBlock + extent.length);
+        if (from >= to)
+        {
+            kept.push_back(extent);
+            continue;
+        }
+
+        if (extent.fileBlock < from)
+        {
+            kept.push_back({ extent.fileBlock, extent.start, from - extent.fileBlock });
+        }
+        this->_deallocateBlocks(extent.start + (from - extent.fileBlock), to - from);
+        if (to < extent.fileBlock + extent.length)
+        {
+            kept.push_back({ to, extent.start + (to - extent.fileBlock), extent.fileBlock + extent.length - to });
+        }
+    }
+    if (kept.size() != EXTENTS.size() ||
+        !std::equal(kept.begin(), kept.end(), EXTENTS.begin(), [](const Extent& first, const Extent& second) {
+            return first.fileBlock == second.fileBlock && first.length == second.length;
+        }))
+    {
+        this->_writeExtents(inode, kept);
+    }
+}
+
+/**
+ * Count the blocks that extents hold in a range of file blocks.
+ * @param extents the extents.
+ * @param first the first file block of the range.
+ * @param end the file block after the range.
+ */
+int MyFs::_countBlocks(const std::vector<Extent>& extents, int first, int end)
+{
+    int count{};
+
+    for (const Extent& extent : extents)
+    {
+        count += std::max(std::min(end, extent.fileBlock + extent.length) - std::max(first, extent.fileBlock), 0);
+    }
+
+    return count;
+}
+
+/**
+ * Sort extents by their position in the file and merge the extents that are
+ * contiguous both in the file and on the disk.
+ */
+void MyFs::_mergeExtents(std::vector<Extent>& extents)
+{
+    size_t merged = 0;
+
+    std::sort(extents.begin(), extents.end(), [](const Extent& first, const Extent& second) {
+        return first.fileBlock < second.fileBlock;
+    });
+    for (size_t i = 1; i < extents.size(); i++)
+    {
+        Extent& last = extents[merged];
+
+        if (last.fileBlock + last.length == extents[i].fileBlock &&
+            last.start + last.length == extents[i].start)
+        {
+            last.length += extents[i].length;
+        }
+        else
+        {
+            extents[++merged] = extents[i];
+        }
+    }
+    if (!extents.empty())
+    {
+        extents.resize(merged + 1);
+    }
+}
+
+/**
+ * Find an empty space for an inode and allocate it.
+ * @return the inode's id.
+ */
+int MyFs::_allocateInode()
+{
+    const int ID = this->_allocate(this->_inodeBitmap);
+    std::lock_guard lock(this->_allocatorLock);
+
+    // the entry of the inode is initialized when the inode is written
+    if (ID >= this->_initializedInodes.load(std::memory_order_relaxed))
+    {
+        this->_initializedInodes.store(ID + 1, std::memory_order_relaxed);
+    }
+
+    return ID;
+}
+
+/**
+ * Allocate blocks in as few runs of contiguous blocks as possible.
+ * @param count the amount of blocks to allocate.
+ * @param goal the number of the block that should be allocated first, or -1
+ *        if there is no preference.
+ * @return the allocated runs of blocks.
+ */
+std::vector<Bitmap::Run> MyFs::_allocateBlocks(int count, int goal)
+{
+    std::lock_guard lock(this->_allocatorLock);
+    std::vector<Bitmap::Run> runs = this->_blockBitmap.allocateRuns(count, goal);
+
+    if (runs.empty())
+    {
+        throw std::runtime_error("Error: not enough disk space");
+    }
+
+    return runs;
+}
+
+/**
+ * Find a run of contiguous empty blocks and allocate it.
+ * @param length the amount of blocks in the run.
+ * @return the number of the first block in the run.
+ */
+int MyFs::_allocateRun(int length)
+{
+    std::lock_guard lock(this->_allocatorLock);
+    int start = this->_blockBitmap.allocateRun(length);
+
+    if (start == -1)
+    {
+        throw std::runtime_error("Error: not enough disk space");
+    }
+
+    return start;
+}
+
+/**
+ * Deallocate a run of contiguous blocks of disk memory.
+ * The blocks are only freed when the running transaction commits, because
+ * until then the last commit may still use them, and writing file data to
+ * them would corrupt the file system if there's a crash before the commit.
+ * A run that directly follows the run that was freed before it is merged
+ * with it, so the commit clears them together.
+ * @param start the number of the first block.
+ * @param length the amount of blocks.
+ */
+void MyFs::_deallocateBlocks(int start, int length)
+{
+    std::lock_guard lock(this->_allocatorLock);
+
+    if (length == 0)
+    {
+        return;
+    }
+    if (!this->_freedRuns.empty() &&
+        this->_freedRuns.back().start + this->_freedRuns.back().length == start)
+    {
+        this->_freedRuns.back().length += length;
+    }
+    else
+    {
+        this->_freedRuns.push_back({ start, length });
+    }
+    this->_freedCount += length;
+    // the commit clears the bits of the freed blocks
+    this->_blockBitmap.markPending(start, length);
+}
+
+/**
+ * Get the ids of the allocated inodes.
+ */
+std::vector<int> MyFs::_allocatedInodes() const
+{
+    const int INITIALIZED = this->_initializedInodes.load(std::memory_order_relaxed);
+    std::lock_guard lock(this->_allocatorLock);
+    std::vector<int> ids;
+
+    for (int id = 0; id < INITIALIZED; id++)
+    {
+        if (this->_inodeBitmap.test(id))
+        {
+            ids.push_back(id);
+        }
+    }
+
+    return ids;
+}
+
+/**
+ * Count the runs of contiguous blocks on the device that extents are stored
+ * in.
+ * Extents that are not contiguous in the file, like the clusters of a
+ * compressed file, are still in the same run if their blocks are contiguous.
+ * @param extents the extents ordered by their position in the file.
+ */
+int MyFs::_countRuns(const std::vector<Extent>& extents)
+{
+    int runs{};
+
+    for (size_t i = 0; i < extents.size(); i++)
+    {
+        if (i == 0 || extents[i - 1].start + extents[i - 1].length != extents[i].start)
+        {
+            runs++;
+        }
+    }
+
+    return runs;
+}
+
+/**
+ * Move the blocks of a file to as few runs of contiguous blocks as possible,
+ * if that is fewer runs than the file is stored in now.
+ * The data is copied to the new blocks and the extents point to them in the
+ * running transaction, and the old blocks are freed once it commits.
+ * @param id the inode id of the file.
+ * @param pack whether to move a directory to the first free runs, even if
+ *        it's contiguous already, if they are before its blocks.
+ * @param blocksMoved the amount of blocks that were moved, which the blocks
+ *        of the file are added to.
+ * @return whether the file was moved.
+ */
+bool MyFs::_defragInode(int id, bool pack, int& blocksMoved)
+{
+    Operation operation(*this, id);
+    Inode inode = this->_readInode(id);
+    const std::vector<Extent> EXTENTS = this->_readExtents(inode);
+    const int COUNT = MyFs::_countBlocks(EXTENTS, 0, std::numeric_limits<int>::max());
+    const int RUNS = MyFs::_countRuns(EXTENTS);
+    std::vector<Bitmap::Run> runs;
+    std::vector<Extent> moved;
+    size_t run{};
+    int usedFromRun{};
+    int toUse{};
+
+    pack = pack && inode.directory;
+    if (COUNT == 0 || (RUNS == 1 && !pack) || this->statfs().free_blocks < COUNT)
+    {
+        return false;
+    }
+    this->_reserveBlocks(COUNT);
+
+    runs = this->_allocateBlocks(COUNT, pack ? 0 : -1);
+    if (runs.size() >= (size_t)RUNS && !(pack && runs.size() == 1 && runs.front().start < EXTENTS.front().start))
+    {
+        std::lock_guard lock(this->_allocatorLock);
+
+        // the blocks were never used, so they can be freed right away
+        for (const Bitmap::Run& unused : runs)
+        {
+            for (int block = unused.start; block < unused.start + unused.length; block++)
+            {
+                this->_blockBitmap.clear(block);
+            }
+        }
+        return false;
+    }
+
+    for (const Extent& extent : EXTENTS)
+    {
+        for (int done = 0; done < extent.length; done += toUse)
+        {
+            toUse = std::min(extent.length - done, runs[run].length - usedFromRun);
+            moved.push_back({ extent.fileBlock + done, runs[run].start + usedFromRun, toUse });
+            usedFromRun += toUse;
+            if (usedFromRun == runs[run].length)
+            {
+                run++;
+                usedFromRun = 0;
+            }
+        }
+    }
+    this->_copyBlocks(inode, EXTENTS, moved);
+
+    MyFs::_mergeExtents(moved);
+    this->_writeExtents(inode, moved);
+    for (const Extent& extent : EXTENTS)
+    {
+        this->_deallocateBlocks(extent.start, extent.length);
+    }
+    this->_writeInode(inode);
+    blocksMoved += COUNT;
+
+    return true;
+}
+
+/**
+ * Copy the blocks of a file to other blocks, DEFRAG_BUFFER bytes at a time.
+ * Every part is read with as few device accesses as possible and then written
+ * the same way.
+ * @param inode the file's inode.
+ * @param from the extents of the blocks to copy.
+ * @param to the extents of the blocks to copy to, which hold the same file
+ *        blocks as from.
+ */
+void MyFs::_copyBlocks(const MyFs::Inode& inode, const std::vector<Extent>& from,
+                       const std::vector<Extent>& to)
+{
+    const size_t BLOCK_SIZE = this->_parts.blockSize;
+    const int BUFFER_BLOCKS = (int)(DEFRAG_BUFFER / BLOCK_SIZE);
+    std::vector<char> buffer(BUFFER_BLOCKS * BLOCK_SIZE);
+    std::vector<BlockDevice::Request> reads;
+    std::vector<BlockDevice::Request> writes;
+    size_t source{};
+    size_t target{};
+    int sourceDone{};
+    int targetDone{};
+    int buffered{};
+    int length{};
+
+    while (source < from.size())
+    {
+        length = std::min({ from[source].length - sourceDone, to[target].length - targetDone,
+                            BUFFER_BLOCKS - buffered });
+        reads.push_back({ false, this->_getBlockAddress(from[source].start + sourceDone),
+                          length * BLOCK_SIZE, buffer.data() + buffered * BLOCK_SIZE });
+        writes.push_back({ true, this->_getBlockAddress(to[target].start + targetDone),
+                           length * BLOCK_SIZE, buffer.data() + buffered * BLOCK_SIZE });
+        buffered += length;
+        sourceDone += length;
+        targetDone += length;
+        if (sourceDone == from[source].length)
+        {
+            source++;
+            sourceDone = 0;
+        }
+        if (targetDone == to[target].length)
+        {
+            target++;
+            targetDone = 0;
+        }
+
+        if (buffered == BUFFER_BLOCKS || source == from.size())
+        {
+            this->_submit(inode, reads);
+            this->_submit(inode, writes);
+            reads.clear();
+            writes.clear();
+            buffered = 0;
+        }
+    }
+}
+
+/**
+ * Get an inode's physical address.
+ * @param id the inode's id.
+ * @return the inode's address on disk.
+ */
+uint64_t MyFs::_getInodeAddress(int id) const
+{
+    return this->_parts.root + (uint64_t)id * sizeof(Inode);
+}
+
+/**
+ * Get a block's physical address.
+ * @param block the number of the block in the data region.
+ * @return the block's address on disk.
+ */
+uint64_t MyFs::_getBlockAddress(int block) const
+{
+    return this->_parts.data + (uint64_t)block * this->_parts.blockSize;
+}
+
+/**
+ * Add a file to a folder.
+ * A folder that fits in a single block is a list of entries and the file is
+ * appended to it. A bigger folder is a hash index, and the file is written to
+ * a free slot in the bucket of its name. If the bucket is full, the index is
+ * rebuilt with twice the buckets.
+ * @param file the name and inode id of the file that will be written to disk.
+ * @param folder the inode of the folder.
+ */
+void MyFs::_addFileToFolder(const MyFs::DirEntry& file, MyFs::Inode& folder)
+{
+    const size_t SLOTS = this->_getDirSlots();
+    const size_t OFFSET = folder.size;
+    std::vector<DirEntry> entries;
+    size_t buckets{};
+    size_t bucket{};
+
+    if (!(folder.flags & INDEXED_DIR))
+    {
+        if (folder.size + sizeof(file) <= (size_t)this->_parts.blockSize)
+        {
+            folder = this->_reallocateBlocks(folder, folder.size + sizeof(file));
+            this->_writeInodeData(folder, OFFSET, sizeof(file), (const char*)&file);
+            folder.size += sizeof(file);
+            this->_writeInode(folder);
+            return;
+        }
+
+        // start with buckets that are half full on average
+        entries = this->_readDirEntries(folder);
+        entries.push_back(file);
+        buckets = 1;
+        while (buckets * SLOTS < 2 * entries.size())
+        {
+            buckets *= 2;
+        }
+        this->_buildDirIndex(folder, entries, buckets);
+        return;
+    }
+
+    buckets = folder.size / this->_parts.blockSize;
+    bucket = _hashName(_getEntryName(file)) & (buckets - 1);
+    entries.resize(SLOTS);
+    this->_readInodeData(folder, bucket * this->_parts.blockSize, this->_parts.blockSize,
+                         (char*)entries.data());
+    for (size_t i = 0; i < SLOTS; i++)
+    {
+        if (entries[i].name[0] == '\0')
+        {
+            this->_writeInodeData(folder, bucket * this->_parts.blockSize + i * sizeof(DirEntry),
+                                  sizeof(file), (const char*)&file);
+            return;
+        }
+    }
+
+    entries = this->_readDirEntries(folder);
+    entries.push_back(file);
+    this->_buildDirIndex(folder, entries, buckets * 2);
+}
+
+/**
+ * Remove a file from a folder.
+ * The slot of the file in a hash index is emptied. In a list of entries the
+ * entries after the file are moved back, so the order in which the files
+ * were added is kept, and the blocks that the list doesn't need anymore are
+ * freed.
+ * @param folder the inode of the folder.
+ * @param name the name of the file, which must be in the folder.
+ */
+void MyFs::_removeFromFolder(MyFs::Inode& folder, std::string_view name)
+{
+    const size_t SLOTS = this->_getDirSlots();
+    const DirEntry EMPTY{};
+    std::vector<DirEntry> entries;
+    size_t bucket{};
+    size_t index{};
+
+    if (folder.flags & INDEXED_DIR)
+    {
+        bucket = _hashName(name) & (folder.size / this->_parts.blockSize - 1);
+        entries.resize(SLOTS);
+        this->_readInodeData(folder, bucket * this->_parts.blockSize, this->_parts.blockSize,
+                             (char*)entries.data());
+        for (size_t i = 0; i < SLOTS; i++)
+        {
+            if (entries[i].name[0] != '\0' && _getEntryName(entries[i]) == name)
+            {
+                this->_writeInodeData(folder, bucket * this->_parts.blockSize + i * sizeof(DirEntry),
+                                      sizeof(EMPTY), (const char*)&EMPTY);
+                return;
+            }
+        }
+        return;
+    }
+
+    entries = this->_readDirEntries(folder);
+    while (index < entries.size() && _getEntryName(entries[index]) != name)
+    {
+        index++;
+    }
+    if (index == entries.size())
+    {
+        return;
+    }
+    entries.erase(entries.begin() + index);
+    this->_writeInodeData(folder, index * sizeof(DirEntry), (entries.size() - index) * sizeof(DirEntry),
+                          (const char*)(entries.data() + index));
+    folder.size -= sizeof(DirEntry);
+    this->_truncateBlocks(folder, folder.size);
+    this->_writeInode(folder);
+}
+
+/**
+ * Rewrite a folder as a hash index.
+ * Every bucket is a single block of entries, where an empty name marks an
+ * unused slot. The amount of buckets is doubled until every entry fits in the
+ * bucket of its name.
+ * @param dir the folder's inode.
+ * @param entries all the entries of the folder.
+ * @param buckets the minimal amount of buckets, a power of two.
+ */
+void MyFs::_buildDirIndex(MyFs::Inode& dir, const std::vector<DirEntry>& entries, size_t buckets)
+{
+    const size_t SLOTS = this->_getDirSlots();
+    std::vector<DirEntry> index;
+    std::vector<size_t> used;
+    size_t bucket{};
+    bool fits = false;
+
+    while (!fits)
+    {
+        index.assign(buckets * SLOTS, DirEntry{});
+        used.assign(buckets, 0);
+        fits = true;
+        for (size_t i = 0; i < entries.size() && fits; i++)
+        {
+            bucket = _hashName(_getEntryName(entries[i])) & (buckets - 1);
+            if (used[bucket] == SLOTS)
+            {
+                fits = false;
+                buckets *= 2;
+            }
+            else
+            {
+                index[bucket * SLOTS + used[bucket]] = entries[i];
+                used[bucket]++;
+            }
+        }
+    }
+
+    dir = this->_reallocateBlocks(dir, buckets * this->_parts.blockSize);
+    dir.size = buckets * this->_parts.blockSize;
+    dir.flags |= INDEXED_DIR;
+    this->_writeInodeData(dir, 0, dir.size, (const char*)index.data());
+    this->_writeInode(dir);
+}
+
+/**
+ * Get all the entries of a folder.
+ * @param dir the folder's inode.
+ * @return the entries, see list_dir for their order.
+ */
+std::vector<MyFs::DirEntry> MyFs::_readDirEntries(const MyFs::Inode& dir) const
+{
+    std::vector<DirEntry> entries(dir.size / sizeof(DirEntry));
+
+    this->_readInodeData(dir, 0, entries.size() * sizeof(DirEntry), (char*)entries.data());
+    if (dir.flags & INDEXED_DIR)
+    {
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [](const DirEntry& entry) {
+            return entry.name[0] == '\0';
+        }), entries.end());
+    }
+
+    return entries;
+}
+
+/**
+ * Find a file inside a folder by reading the folder.
+ * A hash index only requires reading the bucket of the name.
+ * @param dir the folder's inode.
+ * @param name the file's name.
+ * @return the file's inode id or DentryCache::NOT_FOUND.
+ */
+int MyFs::_findEntry(const MyFs::Inode& dir, std::string_view name) const
+{
+    std::vector<DirEntry> entries;
+    size_t bucket{};
+
+    if (dir.flags & INDEXED_DIR)
+    {
+        bucket = _hashName(name) & (dir.size / this->_parts.blockSize - 1);
+        entries.resize(this->_getDirSlots());
+        this->_readInodeData(dir, bucket * this->_parts.blockSize, this->_parts.blockSize,
+                             (char*)entries.data());
+    }
+    else
+    {
+        entries = this->_readDirEntries(dir);
+    }
+
+    for (const DirEntry& entry : entries)
+    {
+        if (entry.name[0] != '\0' && _getEntryName(entry) == name)
+        {
+            return entry.id;
+        }
+    }
+
+    return DentryCache::NOT_FOUND;
+}
+
+/**
+ * Get the amount of entries that fit in a block of a folder.
+ */
+size_t MyFs::_getDirSlots() const
+{
+    return this->_parts.blockSize / sizeof(DirEntry);
+}
+
+/**
+ * Get the name of a directory entry.
+ */
+std::string_view MyFs::_getEntryName(const MyFs::DirEntry& entry)
+{
+    return std::string_view(entry.name, strnlen(entry.name, FILE_NAME_LEN));
+}
+
+/**
+ * Hash a file name with FNV-1a.
+ * The hash decides where names are stored in a hash index, so it must never
+ * change.
+ */
+uint64_t MyFs::_hashName(std::string_view name)
+{
+    constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+    constexpr uint64_t FNV_PRIME = 0x100000001b3;
+    uint64_t hash = FNV_OFFSET;
+
+    for (char c : name)
+    {
+        hash = (hash ^ (uint8_t)c) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Get all the extents of an inode, including the ones that are stored in the
+ * indirect extent blocks. An inode that stores its data inside it has none.
+ * @param inode the inode.
+ * @return the extents ordered by their position in the file.
+ */
+std::vector<MyFs::Extent> MyFs::_readExtents(const MyFs::Inode& inode) const
+{
+    const int DIRECT = std::min(inode.extentCount, (int)DIRECT_EXTENTS);
+    std::vector<Extent> extents;
+
+    if (inode.flags & INLINE_DATA)
+    {
+        return extents;
+    }
+    extents.assign(inode.extents, inode.extents + DIRECT);
+
+    if (inode.extentCount > DIRECT_EXTENTS)
+    {
+        extents.resize(inode.extentCount);
+        this->_journal.read(
+                this->_getBlockAddress(inode.indirect.start),
+                (inode.extentCount - DIRECT_EXTENTS) * sizeof(Extent),
+                (char*)(extents.data() + DIRECT_EXTENTS)
+        );
+    }
+
+    return extents;
+}
+
+/**
+ * Set the extents of an inode.
+ * The first extents are stored in the inode itself and the rest are written
+ * to a run of indirect extent blocks, which is reallocated when the amount of
+ * blocks it needs changes.
+ * Note: the inode itself is not written to the disk.
+ * @param inode the inode.
+ * @param extents the extents ordered by their position in the file.
+ */
+void MyFs::_writeExtents(MyFs::Inode& inode, const std::vector<Extent>& extents)
+{
+    const int INDIRECT = std::max((int)extents.size() - DIRECT_EXTENTS, 0);
+    const int INDIRECT_SIZE = INDIRECT * (int)sizeof(Extent);
+    const int INDIRECT_BLOCKS = (int)ceilDiv(INDIRECT_SIZE, this->_parts.blockSize);
+
+    memset(inode.extents, 0, sizeof(inode.extents));
+    std::copy(extents.begin(), extents.begin() + (extents.size() - INDIRECT), inode.extents);
+    inode.extentCount = (int)extents.size();
+
+    if (INDIRECT_BLOCKS != inode.indirect.length)
+    {
+        this->_deallocateBlocks(inode.indirect.start, inode.indirect.length);
+        inode.indirect.start = INDIRECT_BLOCKS != 0 ? this->_allocateRun(INDIRECT_BLOCKS) : 0;
+        inode.indirect.length = INDIRECT_BLOCKS;
+    }
+    if (INDIRECT != 0)
+    {
+        this->_journal.write(this->_getBlockAddress(inode.indirect.start),
+                             INDIRECT_SIZE,
+                             (const char*)(extents.data() + DIRECT_EXTENTS));
+    }
+}
+
+/**
+ * Read the data an inode points to.
+ * @param inode the inode.
+ * @return the data that was read.
+ */
+void* MyFs::_readInodeData(const MyFs::Inode& inode) const
+{
+    auto* buffer = new uint8_t[inode.size];
+
+    this->_readInodeData(inode, 0, inode.size, (char*)buffer);
+
+    return buffer;
+}
+
+/**
+ * Read a range of the data an inode points to.
+ * The parts of the range that no extent covers are read as null bytes.
+ * The data of an inode that stores it inside the inode is copied from there,
+ * and the data of a compressed file is decompressed.
+ * @param inode the inode.
+ * @param offset the offset inside the file to start reading from.
+ * @param size the amount of bytes to read.
+ * @param buffer the buffer to read into.
+ */
+void MyFs::_readInodeData(const MyFs::Inode& inode, size_t offset, size_t size,
+                          char* buffer) const
+{
+    std::vector<Extent> extents;
+
+    // the buffer of an empty range may be null, like `data()` of an empty vector
+    if (size == 0)
+    {
+        return;
+    }
+    if (inode.flags & INLINE_DATA)
+    {
+        memset(buffer, 0, size);
+        if (offset < sizeof(inode.inlineData))
+        {
+            memcpy(buffer, inode.inlineData + offset, std::min(size, sizeof(inode.inlineData) - offset));
+        }
+        return;
+    }
+    if (inode.flags & COMPRESSED)
+    {
+        this->_readCompressed(inode, offset, size, buffer);
+        return;
+    }
+
+    extents = this->_readExtents(inode);
+    this->_readExtentData(inode, extents, offset, size, buffer);
+    // the journal reads a directory from the device before it applies the
+    // changes, so directories are read ahead like files
+    this->_readAhead(inode, extents, offset, size);
+}
+
+/**
+ * Read a range of the blocks of an inode as they are stored.
+ * Every extent that overlaps the range is read with a single device access,
+ * and the accesses are submitted to the device as one batch. The parts of the
+ * range that no extent covers are read as null bytes.
+ * @param inode the inode.
+ * @param extents the inode's extents.
+ * @param offset the offset inside the inode's blocks to start reading from.
+ * @param size the amount of bytes to read.
+ * @param buffer the buffer to read into.
+ */
+void MyFs::_readExtentData(const MyFs::Inode& inode, const std::vector<Extent>& extents,
+                           size_t offset, size_t size, char* buffer) const
+{
+    const size_t END = offset + size;
+    std::vector<BlockDevice::Request> requests;
+    size_t filled = offset;
+    size_t extentStart{};
+    size_t from{};
+    size_t to{};
+
+    for (const Extent& extent : extents)
+    {
+        extentStart = (size_t)extent.fileBlock * this->_parts.blockSize;
+        from = std::max(offset, extentStart);
+        to = std::min(END, extentStart + (size_t)extent.length * this->_parts.blockSize);
+        if (from < to)
+        {
+            if (from > filled)
+            {
+                memset(buffer + (filled - offset), 0, from - filled);
+            }
+            requests.push_back({ false,
+                                 this->_getBlockAddress(extent.start) + (from - extentStart),
+                                 to - from,
+                                 buffer + (from - offset) });
+            filled = to;
+        }
+    }
+    if (filled < END)
+    {
+        memset(buffer + (filled - offset), 0, END - filled);
+    }
+    this->_submit(inode, requests);
+}
+
+/**
+ * Read a range of the data of a compressed file.
+ * The blocks of the clusters that the range overlaps are read with a single
+ * batch, and only those clusters are decompressed. A cluster without blocks
+ * is a hole, and a cluster that has all the blocks of its data is stored as
+ * it is.
+ * @param inode the file's inode.
+ * @param offset the offset inside the file to start reading from.
+ * @param size the amount of bytes to read.
+ * @param buffer the buffer to read into.
+ */
+void MyFs::_readCompressed(const MyFs::Inode& inode, size_t offset, size_t size, char* buffer) const
+{
+    const size_t BLOCK_SIZE = this->_parts.blockSize;
+    const int CLUSTER_BLOCKS = (int)(COMPRESSION_CLUSTER / BLOCK_SIZE);
+    const size_t END = std::min(offset + size, inode.size);
+    const size_t FIRST = offset - offset % COMPRESSION_CLUSTER;
+    const std::vector<Extent> EXTENTS = this->_readExtents(inode);
+    std::vector<char> stored;
+    std::vector<char> cluster(COMPRESSION_CLUSTER);
+    const char* data = nullptr;
+    size_t length{};
+    size_t from{};
+    size_t to{};
+    uint32_t compressedSize{};
+    int blocks{};
+
+    memset(buffer, 0, size);
+    if (offset >= END)
+    {
+        return;
+    }
+    stored.resize(alignUp(END, COMPRESSION_CLUSTER) - FIRST);
+    this->_readExtentData(inode, EXTENTS, FIRST, stored.size(), stored.data());
+
+    for (size_t start = FIRST; start < END; start += COMPRESSION_CLUSTER)
+    {
+        length = std::min(COMPRESSION_CLUSTER, inode.size - start);
+        blocks = MyFs::_countBlocks(EXTENTS, (int)(start / BLOCK_SIZE), (int)(start / BLOCK_SIZE) + CLUSTER_BLOCKS);
+        data = stored.data() + (start - FIRST);
+        from = std::max(offset, start);
+        to = std::min(END, start + COMPRESSION_CLUSTER);
+        if (blocks == 0)
+        {
+            continue;
+        }
+        if ((size_t)blocks * BLOCK_SIZE < length)
+        {
+            memcpy(&compressedSize, data, sizeof(compressedSize));
+            if (compressedSize > blocks * BLOCK_SIZE - sizeof(compressedSize))
+            {
+                throw std::runtime_error("Error: corrupted compressed data");
+            }
+            Lz::decompress(data + sizeof(compressedSize), compressedSize, cluster.data(), length);
+            data = cluster.data();
+        }
+        memcpy(buffer + (from - offset), data + (from - start), to - from);
+    }
+}
+
+/**
+ * Write data at an offset inside a compressed file, or replace its content.
+ * Every cluster that the data overlaps is decompressed, changed, compressed
+ * again and written to as many blocks as it needs from the start of the
+ * cluster. The last cluster of the file is also rewritten if the file grows
+ * past it, because the length of its data changes.
+ * A cluster is never overwritten in place, because a crash in the middle of
+ * the write would leave the committed extents pointing at a cluster that
+ * can't be decompressed. Every cluster is written to newly allocated blocks,
+ * and its old blocks are freed when the running transaction commits.
+ * Nothing is changed if there aren't enough free blocks for the new clusters.
+ * Note: the inode is written to the disk.
+ * @param inode the file's inode, which is updated.
+ * @param offset the offset inside the file to write to.
+ * @param data the data to write.
+ * @param replace whether the data replaces the content of the file, in which
+ *        case offset must be 0.
+ */
+void MyFs::_writeCompressed(MyFs::Inode& inode, size_t offset, std::string_view data, bool replace)
+{
+    const size_t BLOCK_SIZE = this->_parts.blockSize;
+    const int CLUSTER_BLOCKS = (int)(COMPRESSION_CLUSTER / BLOCK_SIZE);
+    const size_t OLD_SIZE = replace ? 0 : inode.size;
+    const size_t NEW_SIZE = std::max(OLD_SIZE, offset + data.size());
+    const size_t LAST = (NEW_SIZE - 1) / COMPRESSION_CLUSTER;
+    std::vector<size_t> clusters;
+    std::vector<std::string> stored;
+    std::vector<char> compressed(sizeof(uint32_t) + Lz::bound(COMPRESSION_CLUSTER));
+    std::string cluster;
+    size_t start{};
+    size_t from{};
+    size_t to{};
+    uint32_t compressedSize{};
+    int needed{};
+    int firstBlock{};
+
+    if (data.empty())
+    {
+        return;
+    }
+    if (OLD_SIZE % COMPRESSION_CLUSTER != 0 && OLD_SIZE / COMPRESSION_CLUSTER < offset / COMPRESSION_CLUSTER)
+    {
+        clusters.push_back(OLD_SIZE / COMPRESSION_CLUSTER);
+    }
+    for (size_t i = offset / COMPRESSION_CLUSTER; i <= LAST; i++)
+    {
+        clusters.push_back(i);
+    }
+
+    // build the stored form of every cluster before anything is changed
+    for (size_t i : clusters)
+    {
+        start = i * COMPRESSION_CLUSTER;
+        cluster.assign(std::min(COMPRESSION_CLUSTER, NEW_SIZE - start), '\0');
+        if (start < OLD_SIZE)
+        {
+            this->_readInodeData(inode, start, std::min(cluster.size(), OLD_SIZE - start), cluster.data());
+        }
+        from = std::max(offset, start);
+        to = std::min(offset + data.size(), start + cluster.size());
+        if (from < to)
+        {
+            data.copy(cluster.data() + (from - start), to - from, from - offset);
+        }
+
+        compressedSize = (uint32_t)Lz::compress(cluster.data(), cluster.size(),
+                                                compressed.data() + sizeof(compressedSize),
+                                                compressed.size() - sizeof(compressedSize));
+        if (compressedSize != 0 &&
+            ceilDiv(sizeof(compressedSize) + compressedSize, BLOCK_SIZE) < ceilDiv(cluster.size(), BLOCK_SIZE))
+        {
+            memcpy(compressed.data(), &compressedSize, sizeof(compressedSize));
+            stored.emplace_back(compressed.data(), sizeof(compressedSize) + compressedSize);
+        }
+        else
+        {
+            stored.push_back(std::move(cluster));
+        }
+        needed += (int)ceilDiv(stored.back().size(), BLOCK_SIZE);
+    }
+    // the blocks that the clusters hold now are only freed once the new
+    // clusters are committed
+    this->_reserveBlocks(needed);
+
+    if (inode.flags & INLINE_DATA)
+    {
+        inode.flags &= ~INLINE_DATA;
+        memset(inode.inlineData, 0, sizeof(inode.inlineData));
+        inode.extentCount = 0;
+    }
+    if (replace)
+    {
+        this->_freeBlockRange(inode, (int)(LAST + 1) * CLUSTER_BLOCKS, std::numeric_limits<int>::max());
+    }
+    // the file is never small enough to be stored inline from here on
+    inode.size = NEW_SIZE;
+    for (size_t i = 0; i < clusters.size(); i++)
+    {
+        firstBlock = (int)clusters[i] * CLUSTER_BLOCKS;
+        this->_freeBlockRange(inode, firstBlock, firstBlock + CLUSTER_BLOCKS);
+        this->_allocateRange(inode, clusters[i] * COMPRESSION_CLUSTER, stored[i].size());
+        this->_writeInodeData(inode, clusters[i] * COMPRESSION_CLUSTER, stored[i].size(), stored[i].data());
+    }
+    this->_writeInode(inode);
+}
+
+/**
+ * Hint the device to read ahead the blocks of a file that follow a read, if
+ * the read continues the previous read of the file.
+ * The blocks that follow a range in the file aren't necessarily the blocks
+ * that follow it on the device, so only the file system can tell which
+ * blocks a sequential reader needs next. The read-ahead window doubles with
+ * every sequential read, up to READ_AHEAD_MAX.
+ * Every thread has a stream of its own, so the reads of one thread don't
+ * break the sequence of another.
+ * @param inode the file's inode.
+ * @param extents the file's extents.
+ * @param offset the offset of the read inside the file.
+ * @param size the size of the read.
+ */
+void MyFs::_readAhead(const MyFs::Inode& inode, const std::vector<Extent>& extents,
+                      size_t offset, size_t size) const
+{
+    static thread_local ReadStream stream{ nullptr, -1, 0, 0, 0 };
+    size_t aheadEnd{};
+    size_t extentStart{};
+    size_t from{};
+    size_t to{};
+
+    if (stream.fs != this || stream.inode != inode.id || stream.end != offset)
+    {
+        stream = { this, inode.id, offset + size, 0, offset + size };
+        return;
+    }
+    stream.end = offset + size;
+    stream.window = std::clamp(stream.window * 2, (size_t)READ_AHEAD_MIN, (size_t)READ_AHEAD_MAX);
+    aheadEnd = std::min(stream.end + stream.window, inode.size);
+
+    // only the part that wasn't read ahead by the previous reads
+    for (const Extent& extent : extents)
+    {
+        extentStart = (size_t)extent.fileBlock * this->_parts.blockSize;
+        from = std::max(std::max(stream.end, stream.readAhead), extentStart);
+        to = std::min(aheadEnd, extentStart + (size_t)extent.length * this->_parts.blockSize);
+        if (from < to)
+        {
+            this->blkdevsim->prefetch(this->_getBlockAddress(extent.start) + (from - extentStart), to - from);
+        }
+    }
+    stream.readAhead = std::max(stream.readAhead, aheadEnd);
+}
+
+/**
+ * Write data at an offset inside a file, see write.
+ * Note: the caller must hold the file's lock exclusively.
+ * @param inode the file's inode, which is updated.
+ * @param offset the offset inside the file to write to.
+ * @param data the data to write.
+ */
+void MyFs::_write(MyFs::Inode& inode, size_t offset, std::string_view data)
+{
+    if (data.empty())
+    {
+        return;
+    }
+    if ((inode.flags & COMPRESSED) && !MyFs::_fitsInline(inode, offset + data.size()))
+    {
+        this->_writeCompressed(inode, offset, data, false);
+        return;
+    }
+    this->_checkSpace(inode, offset, data.size());
+    this->_zeroStaleTail(inode, offset);
+    this->_allocateRange(inode, offset, data.size());
+    this->_writeInodeData(inode, offset, data.size(), data.data());
+    inode.size = std::max(inode.size, offset + data.size());
+    this->_writeInode(inode);
+}
+
+/**
+ * Zero the part of the last block of a file that follows the end of the
+ * file, up to where the file grows to.
+ * The end of the last block may hold data that was truncated, and once the
+ * file passes it that part must read as null bytes.
+ * @param inode the file's inode.
+ * @param end the offset that the file grows to.
+ */
+void MyFs::_zeroStaleTail(MyFs::Inode& inode, size_t end)
+{
+    const size_t BLOCK_SIZE = this->_parts.blockSize;
+    size_t staleEnd{};
+
+    if (end > inode.size && inode.size % BLOCK_SIZE != 0 && !(inode.flags & INLINE_DATA))
+    {
+        staleEnd = std::min(end, alignUp(inode.size, BLOCK_SIZE));
+        std::vector<char> zeroes(staleEnd - inode.size, 0);
+        this->_writeInodeData(inode, inode.size, zeroes.size(), zeroes.data());
+    }
+}
+
+/**
+ * Set the size of a file, see truncate.
+ * The last cluster of a compressed file is compressed again when the size
+ * changes inside of it, because its length changes.
+ * Note: the caller must hold the file's lock exclusively.
+ * @param inode the file's inode, which is updated.
+ * @param size the new size.
+ */
+void MyFs::_truncate(MyFs::Inode& inode, size_t size)
+{
+    const size_t BLOCK_SIZE = this->_parts.blockSize;
+    const size_t CLUSTER_START = size - size % COMPRESSION_CLUSTER;
+    std::string tail;
+
+    if (size == inode.size)
+    {
+        return;
+    }
+    if ((inode.flags & COMPRESSED) && !MyFs::_fitsInline(inode, size))
+    {
+        if (size > inode.size)
+        {
+            // the rest of the file is a hole, so only the last cluster takes blocks
+            this->_writeCompressed(inode, size - 1, std::string_view("", 1), false);
+            return;
+        }
+
+        tail.resize(size - CLUSTER_START);
+        this->_readInodeData(inode, CLUSTER_START, tail.size(), tail.data());
+        this->_freeBlockRange(inode, (int)(CLUSTER_START / BLOCK_SIZE), std::numeric_limits<int>::max());
+        inode.size = CLUSTER_START;
+        this->_write(inode, CLUSTER_START, tail);
+        this->_writeInode(inode);
+        return;
+    }
+
+    if (size < inode.size)
+    {
+        this->_truncateBlocks(inode, size);
+    }
+    else if ((inode.flags & INLINE_DATA) && size > INLINE_SIZE)
+    {
+        this->_moveInlineData(inode);
+    }
+    else
+    {
+        this->_zeroStaleTail(inode, size);
+    }
+    inode.size = size;
+    this->_writeInode(inode);
+}
+
+/**
+ * Set the whole content of a file, see set_content.
+ * @param path_str the file's path.
+ * @param content the content.
+ * @param compressed whether to store the file compressed, or nullopt to
+ *        keep storing it the way it is stored.
+ */
+void MyFs::_setContent(const std::string& path_str, std::string_view content,
+                       std::optional<bool> compressed)
+{
+    static const int METRIC = Stats::metric("myfs.set_content");
+    Stats::Timer timer(METRIC, content.size());
+    const int FILE_ID = this->_getInodeId(path_str);
+    Inode file{};
+
+    {
+        Operation operation(*this, FILE_ID);
+
+        file = this->_readInode(FILE_ID);
+        if (compressed.has_value() && !file.directory)
+        {
+            // the clusters of a file that was compressed are all rewritten
+            // below, so they don't have to be decompressed first
+            file.flags = *compressed ? file.flags | COMPRESSED : file.flags & ~COMPRESSED;
+        }
+        if ((file.flags & COMPRESSED) && content.size() > INLINE_SIZE)
+        {
+            this->_writeCompressed(file, 0, content, true);
+        }
+        else
+        {
+            this->_checkSpace(file, 0, content.size());
+            // the blocks of a file that shrinks enough are freed, so that its
+            // content is stored inside the inode
+            if (content.size() <= INLINE_SIZE)
+            {
+                this->_truncateBlocks(file, 0);
+                file.size = 0;
+            }
+            file = this->_reallocateBlocks(file, content.size());
+            file.size = content.size();
+            this->_writeInodeData(file, 0, file.size, content.data());
+            this->_writeInode(file);
+        }
+    }
+    this->_commitIfFull();
+}
+
+/**
+ * Write to a range of the data an inode points to.
+ * Every extent that overlaps the range is written with a single device access,
+ * and the accesses are submitted to the device as one batch.
+ * The data of an inode that stores it inside the inode is copied there, and
+ * the caller has to write the inode.
+ * Note: the range must already be allocated.
+ * @param inode the inode.
+ * @param offset the offset inside the file to start writing to.
+ * @param size the amount of bytes to write.
+ * @param data the data to write.
+ */
+void MyFs::_writeInodeData(MyFs::Inode& inode, size_t offset, size_t size,
+                           const char* data)
+{
+    const size_t END = offset + size;
+    std::vector<BlockDevice::Request> requests;
+    size_t extentStart{};
+    size_t from{};
+    size_t to{};
+
+    if (inode.flags & INLINE_DATA)
+    {
+        memcpy(inode.inlineData + offset, data, size);
+        return;
+    }
+
+    for (const Extent& extent : this->_readExtents(inode))
+    {
+        extentStart = (size_t)extent.fileBlock * this->_parts.blockSize;
+        from = std::max(offset, extentStart);
+        to = std::min(END, extentStart + (size_t)extent.length * this->_parts.blockSize);
+        if (from < to)
+        {
+            requests.push_back({ true,
+                                 this->_getBlockAddress(extent.start) + (from - extentStart),
+                                 to - from,
+                                 const_cast<char*>(data) + (from - offset) });
+        }
+    }
+    this->_submit(inode, requests);
+}
+
+/**
+ * Perform a batch of reads and writes of the data of an inode.
+ * The data of a directory is metadata, so it goes through the journal and
+ * its writes are part of the running transaction. The data of a file is
+ * accessed right away.
+ * @param inode the inode.
+ * @param requests the requests.
+ */
+void MyFs::_submit(const MyFs::Inode& inode, std::span<const BlockDevice::Request> requests) const
+{
+    if (!inode.directory)
+    {
+        this->blkdevsim->submit(requests);
+        return;
+    }
+
+    for (const BlockDevice::Request& request : requests)
+    {
+        if (request.write)
+        {
+            this->_journal.write(request.addr, request.size, request.data);
+        }
+        else
+        {
+            this->_journal.read(request.addr, request.size, request.data);
+        }
+    }
+}
+
+/**
+ * Commit the running transaction once no operation is in the middle of
+ * changing the file system.
+ * New operations wait until the commit is finished. An operation that needs
+ * the space that the commit frees commits before it changes anything, and
+ * pauses until the commit is finished instead. The transaction is committed
+ * by a single thread, so if another thread is already committing, this waits
+ * for its commit.
+ * @param paused whether this is called in the middle of an operation.
+ */
+void MyFs::_commit(bool paused)
+{
+    std::unique_lock lock(this->_transactionLock);
+
+    if (paused)
+    {
+        this->_pausedOperations++;
+        this->_transactionChanged.notify_all();
+    }
+    if (this->_committing)
+    {
+        this->_transactionChanged.wait(lock, [this] { return !this->_committing; });
+        this->_pausedOperations -= paused;
+        return;
+    }
+
+    this->_committing = true;
+    this->_transactionChanged.wait(lock, [this] {
+        return this->_activeOperations == this->_pausedOperations;
+    });
+    // the other operations stay paused until the commit is finished
+    this->_pausedOperations -= paused;
+    try
+    {
+        this->_commitTransaction();
+    }
+    catch (...)
+    {
+        this->_committing = false;
+        this->_transactionChanged.notify_all();
+        throw;
+    }
+    this->_committing = false;
+    this->_transactionChanged.notify_all();
+}
+
+/**
+ * Release the freed blocks and commit the metadata changes to the journal.
+ * Note: no operation may change the file system at the same time.
+ */
+void MyFs::_commitTransaction()
+{
+    {
+        std::lock_guard lock(this->_allocatorLock);
+
+        for (const Bitmap::Run& run : this->_freedRuns)
+        {
+            this->_blockBitmap.clearRange(run.start, run.length);
+        }
+        this->_freedRuns.clear();
+        this->_freedCount = 0;
+    }
+    this->_flushInodes();
+    {
+        std::lock_guard lock(this->_allocatorLock);
+
+        this->_blockBitmap.flush(this->_journal);
+        this->_inodeBitmap.flush(this->_journal);
+        this->_writeHeader();
+    }
+    this->_journal.commit();
+}
+
+/**
+ * Write the amounts of free blocks and inodes and the initialized part of the
+ * inode table to the header as part of the running transaction, if they
+ * changed since the last commit.
+ * Note: must be called with the allocator lock held.
+ */
+void MyFs::_writeHeader()
+{
+    myfs_header header = this->_header;
+
+    header.freeBlocks = this->_blockBitmap.countFree();
+    header.freeInodes = this->_inodeBitmap.countFree();
+    header.initializedInodes = this->_initializedInodes.load(std::memory_order_relaxed);
+    if (memcmp(&header, &this->_header, sizeof(header)) != 0)
+    {
+        this->_journal.write(0, sizeof(header), (const char*)&header);
+        this->_header = header;
+    }
+}
+
+/**
+ * Get the amount of blocks that the running transaction writes to the
+ * journal if it is committed now: the changed blocks in the journal, the
+ * blocks of the bitmaps that are flushed, the inode table blocks of the dirty
+ * inodes and the header.
+ * A block may be counted both as changed and as dirty, so the amount may be
+ * more than the blocks that are written, but never less.
+ */
+size_t MyFs::_pendingBlocks() const
+{
+    size_t blocks = this->_journal.pending() + 1;
+
+    {
+        std::lock_guard lock(this->_dirtyInodeBlocksLock);
+        blocks += this->_dirtyInodeBlocks.size();
+    }
+    std::lock_guard lock(this->_allocatorLock);
+
+    return blocks + this->_blockBitmap.dirtyBlocks() + this->_inodeBitmap.dirtyBlocks();
+}
+
+/**
+ * Commit the running transaction if it fills half the journal, so the next
+ * operation still fits in the journal.
+ * Note: must be called after the operation is finished.
+ */
+void MyFs::_commitIfFull()
+{
+    if (this->_pendingBlocks() >= this->_journal.capacity() / 2)
+    {
+        this->_commit(false);
+    }
+}
+
+/**
+ * Get file's inode id by path.
+ * Empty path components are ignored, so both "" and "/" refer to the root
+ * directory.
+ * The directories on the way are only read if their entries aren't in the
+ * dentry cache.
+ * @param path the file's path.
+ * @return the file's inode id.
+ */
+int MyFs::_getInodeId(std::string_view path) const
+{
+    std::string_view name;
+    size_t nameEnd{};
+    int id = ROOT_INODE;
+
+    while (!path.empty())
+    {
+        nameEnd = std::min(path.find('/'), path.size());
+        // names are truncated the same way as when the files are created
+        name = path.substr(0, nameEnd).substr(0, FILE_NAME_LEN - 1);
+        path.remove_prefix(std::min(nameEnd + 1, path.size()));
+        if (name.empty())
+        {
+            continue;
+        }
+
+        id = this->_lookup(id, name);
+        if (id == DentryCache::NOT_FOUND)
+        {
+            throw std::runtime_error("Error: the file was not found");
+        }
+    }
+
+    return id;
+}
+
+/**
+ * Get the reader-writer lock of an inode.
+ * The inodes are spread over a fixed amount of locks, so inodes that share a
+ * lock also share its waits. A thread never holds more than one of them.
+ * @param id the inode's id.
+ */
+std::shared_mutex& MyFs::_inodeLock(int id) const
+{
+    return this->_inodeLocks[(unsigned)id % INODE_LOCKS];
+}
+
+/**
+ * Read an inode, from the inode cache if it's cached.
+ * @param id the inode's id.
+ * @return the inode.
+ */
+MyFs::Inode MyFs::_readInode(int id) const
+{
+    InodeCacheShard& shard = this->_inodeCache[(unsigned)id % INODE_CACHE_SHARDS];
+    Inode inode{};
+
+    {
+        std::shared_lock lock(shard.lock);
+        const auto FOUND = shard.inodes.find(id);
+
+        if (FOUND != shard.inodes.end())
+        {
+            FOUND->second.referenced.store(true, std::memory_order_relaxed);
+            return FOUND->second.inode;
+        }
+    }
+
+    // the entry of an inode that was never allocated may hold anything
+    if (id >= this->_initializedInodes.load(std::memory_order_relaxed))
+    {
+        inode.id = id;
+        return inode;
+    }
+    this->_journal.read(this->_getInodeAddress(id), sizeof(inode), (char*)&inode);
+
+    // another thread may have cached the inode in the meantime
+    return this->_cacheInode(inode, false);
+}
+
+/**
+ * Read many inodes at once.
+ * The inodes that aren't cached are read in the order of their ids, and ids
+ * that are close to each other in the inode table are read together with a
+ * single read. The inodes are not added to the inode cache, so listing a
+ * large directory doesn't evict the whole cache.
+ * @param ids the ids of the inodes, in any order.
+ * @return the inodes, in the order of their ids in `ids`.
+ */
+std::vector<MyFs::Inode> MyFs::_readInodes(const std::vector<int>& ids) const
+{
+    std::vector<Inode> inodes(ids.size());
+    std::vector<size_t> missing; // indexes in `ids` of the inodes that aren't cached
+    std::vector<Inode> run;
+    size_t last{};
+    int firstId{};
+
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        InodeCacheShard& shard = this->_inodeCache[(unsigned)ids[i] % INODE_CACHE_SHARDS];
+        std::shared_lock lock(shard.lock);
+        const auto FOUND = shard.inodes.find(ids[i]);
+
+        if (FOUND != shard.inodes.end())
+        {
+            inodes[i] = FOUND->second.inode;
+        }
+        else
+        {
+            missing.push_back(i);
+        }
+    }
+    std::sort(missing.begin(), missing.end(), [&ids](size_t first, size_t second) {
+        return ids[first] < ids[second];
+    });
+
+    for (size_t first = 0; first < missing.size(); first = last + 1)
+    {
+        last = first;
+        while (last + 1 < missing.size() &&
+               ids[missing[last + 1]] - ids[missing[last]] <= INODE_READ_GAP)
+        {
+            last++;
+        }
+        firstId = ids[missing[first]];
+        run.resize(ids[missing[last]] - firstId + 1);
+        this->_journal.read(this->_getInodeAddress(firstId),
+                            run.size() * sizeof(Inode),
+                            (char*)run.data());
+        for (size_t i = first; i <= last; i++)
+        {
+            inodes[missing[i]] = run[ids[missing[i]] - firstId];
+        }
+    }
+
+    return inodes;
+}
+
+/**
+ * Find a file inside a directory that is identified by its inode id.
+ * A cached entry is found without reading the directory's inode, and only
+ * when the entry isn't cached the directory is locked to read its entries.
+ * @param dir the directory's inode id.
+ * @param name the file's name.
+ * @return the file's inode id or DentryCache::NOT_FOUND, which is also the
+ *         result if `dir` is not a directory.
+ */
+int MyFs::_lookup(int dir, std::string_view name) const
+{
+    int id{};
+
+    if (this->_dentries.lookup(dir, name, id))
+    {
+        return id;
+    }
+
+    std::shared_lock lock(this->_inodeLock(dir));
+    const Inode DIR = this->_readInode(dir);
+
+    return DIR.directory ? this->_lookup(DIR, name) : DentryCache::NOT_FOUND;
+}
+
+/**
+ * Find a file inside a directory.
+ * The result is cached, including when the file was not found.
+ * Note: the caller must hold the directory's lock.
+ * @param dir the directory's inode.
+ * @param name the file's name.
+ * @return the file's inode id or DentryCache::NOT_FOUND.
+ */
+int MyFs::_lookup(const MyFs::Inode& dir, std::string_view name) const
+{
+    int id{};
+
+    static_assert(DentryCache::MAX_NAME_LEN == FILE_NAME_LEN - 1,
+                  "the dentry cache must fit every name that can be stored in a directory");
+    if (this->_dentries.lookup(dir.id, name, id))
+    {
+        return id;
+    }
+
+    // longer names can't be stored in a directory
+    id = name.size() < FILE_NAME_LEN ? this->_findEntry(dir, name) : DentryCache::NOT_FOUND;
+    this->_dentries.insert(dir.id, name, id);
+
+    return id;
+}
+
+/**
+ * Write an inode.
+ * The inode is only updated in the inode cache, and is written to the disk
+ * when it is evicted from the cache or on sync.
+ * @param inode the inode.
+ */
+void MyFs::_writeInode(const MyFs::Inode& inode)
+{
+    this->_cacheInode(inode, true);
+}
+
+/**
+ * Put an inode in the inode cache.
+ * If the shard of the inode is full, the clock hand of the shard picks an
+ * inode that wasn't read since the hand last passed it, which is evicted and
+ * written to the disk if it is dirty.
+ * @param inode the inode.
+ * @param dirty whether the inode has to be written to the disk. A clean
+ *        inode doesn't replace a cached copy, which may be newer.
+ * @return the cached inode.
+ */
+MyFs::Inode MyFs::_cacheInode(const MyFs::Inode& inode, bool dirty) const
+{
+    InodeCacheShard& shard = this->_inodeCache[(unsigned)inode.id % INODE_CACHE_SHARDS];
+    std::unique_lock lock(shard.lock);
+    auto found = shard.inodes.find(inode.id);
+    size_t position{};
+
+    if (found != shard.inodes.end())
+    {
+        if (dirty)
+        {
+            found->second.inode = inode;
+            if (!found->second.dirty)
+            {
+                this->_countDirtyInode(inode.id, 1);
+            }
+            found->second.dirty = true;
+        }
+        found->second.referenced.store(true, std::memory_order_relaxed);
+        return found->second.inode;
+    }
+
+    if (shard.clock.size() >= INODE_CACHE_SIZE / INODE_CACHE_SHARDS)
+    {
+        while (shard.inodes.at(shard.clock[shard.hand]).referenced.exchange(false, std::memory_order_relaxed))
+        {
+            shard.hand = (shard.hand + 1) % shard.clock.size();
+        }
+        found = shard.inodes.find(shard.clock[shard.hand]);
+        if (found->second.dirty)
+        {
+            this->_journal.write(this->_getInodeAddress(found->first),
+                                 sizeof(Inode),
+                                 (const char*)&found->second.inode);
+            this->_countDirtyInode(found->first, -1);
+        }
+        shard.inodes.erase(found);
+        position = shard.hand;
+        shard.clock[position] = inode.id;
+        shard.hand = (shard.hand + 1) % shard.clock.size();
+    }
+    else
+    {
+        position = shard.clock.size();
+        shard.clock.push_back(inode.id);
+    }
+
+    if (dirty)
+    {
+        this->_countDirtyInode(inode.id, 1);
+    }
+    return shard.inodes.try_emplace(inode.id, inode, dirty, position, true).first->second.inode;
+}
+
+/**
+ * Count an inode that became dirty or was written to the journal in the
+ * blocks of the inode table that hold it.
+ * @param id the id of the inode.
+ * @param change 1 if the inode became dirty or -1 if it was written.
+ */
+void MyFs::_countDirtyInode(int id, int change) const
+{
+    const uint64_t ADDRESS = this->_getInodeAddress(id);
+    const uint64_t FIRST = ADDRESS / this->_parts.blockSize;
+    const uint64_t LAST = (ADDRESS + sizeof(Inode) - 1) / this->_parts.blockSize;
+    std::lock_guard lock(this->_dirtyInodeBlocksLock);
+
+    for (uint64_t block = FIRST; block <= LAST; block++)
+    {
+        if ((this->_dirtyInodeBlocks[block] += change) == 0)
+        {
+            this->_dirtyInodeBlocks.erase(block);
+        }
+    }
+}
+
+/**
+ * Write every dirty inode in the inode cache to the disk.
+ * Dirty inodes that are adjacent in the inode table are written together.
+ */
+void MyFs::_flushInodes()
+{
+    std::vector<Inode> dirty;
+    std::vector<Inode> run;
+
+    for (InodeCacheShard& shard : this->_inodeCache)
+    {
+        std::unique_lock lock(shard.lock);
+
+        for (auto& [id, cached] : shard.inodes)
+        {
+            if (cached.dirty)
+            {
+                dirty.push_back(cached.inode);
+                cached.dirty = false;
+                this->_countDirtyInode(id, -1);
+            }
+        }
+    }
+    std::sort(dirty.begin(), dirty.end(), [](const Inode& first, const Inode& second) {
+        return first.id < second.id;
+    });
+
+    for (size_t i = 0; i < dirty.size(); i++)
+    {
+        run.push_back(dirty[i]);
+        if (i + 1 == dirty.size() || dirty[i + 1].id != dirty[i].id + 1)
+        {
+            this->_journal.write(this->_getInodeAddress(dirty[i].id + 1 - (int)run.size()),
+                                 run.size() * sizeof(Inode),
+                                 (const char*)run.data());
+            run.clear();
+        }
+    }
 }
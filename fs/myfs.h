@@ -1,7 +1,16 @@
 #ifndef __MYFS_H__
 #define __MYFS_H__
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <unordered_map>
+#include <string_view>
 #include <vector>
 #include <cstdint>
 #include <cstring>
@@ -9,10 +18,41 @@
 #include <cstdint>
 #include <iostream>
 #include "blkdev.h"
+#include "bitmap.h"
+#include "dentry_cache.h"
+#include "journal.h"
 
+/**
+ * Thread safety: the methods of a mounted instance may be called by several
+ * threads at once, except format, which must not run together with any other
+ * method.
+ * Every inode has a reader-writer lock, so reads of a file or a directory run
+ * in parallel with each other and only wait for changes to the same inode.
+ * Paths are resolved through the dentry cache without taking any lock, and a
+ * directory is only locked when its entries have to be read. The allocation
+ * bitmaps have a lock of their own, and a commit waits until the operations
+ * that change the file system are finished, so a transaction never holds half
+ * of an operation.
+ */
 class MyFs {
 public:
-	MyFs(BlockDeviceSimulator *blkdevsim_);
+	/**
+	 * Mount the myfs instance on the block device.
+	 * @param blkdevsim_ the block device.
+	 * @param block_size the block size to format the device with if it
+	 *	doesn't contain a myfs instance.
+	 */
+	MyFs(BlockDevice *blkdevsim_, int block_size = DEFAULT_BLOCK_SIZE);
+
+	/**
+	 * Write the pending changes to the block device before unmounting.
+	 */
+	~MyFs();
+
+	static constexpr int MIN_BLOCK_SIZE = 512;
+	static constexpr int MAX_BLOCK_SIZE = 64 * 1024;
+	static constexpr int DEFAULT_BLOCK_SIZE = 4096;
+	static constexpr size_t COMPRESSION_CLUSTER = MAX_BLOCK_SIZE;
 
 	/**
 	 * dir_list_entry struct
@@ -34,23 +74,140 @@ public:
 		 * File size
 		 */
 		int file_size;
+
+		/**
+		 * The inode id of the file
+		 */
+		int id;
 	};
 	typedef std::vector<struct dir_list_entry> dir_list;
 
+	/**
+	 * fs_stats struct
+	 * This struct is used by statfs method to return the usage of the
+	 * file system.
+	 */
+	struct fs_stats {
+		/**
+		 * The size of a data block in bytes
+		 */
+		int block_size;
+
+		/**
+		 * The amount of blocks in the data region, and how many of
+		 * them are free
+		 */
+		int blocks;
+		int free_blocks;
+
+		/**
+		 * The amount of inodes in the inode table, and how many of
+		 * them are free
+		 */
+		int inodes;
+		int free_inodes;
+	};
+
+	/**
+	 * defrag_stats struct
+	 * This struct is used by defrag method to return what it did.
+	 */
+	struct defrag_stats {
+		/**
+		 * The fragmentation of the file system before and after the
+		 * defragmentation, see fragmentation
+		 */
+		double fragmentation_before;
+		double fragmentation_after;
+
+		/**
+		 * The amount of files that were moved, and of the blocks that
+		 * were moved with them
+		 */
+		int files_moved;
+		int blocks_moved;
+	};
+
+	/**
+	 * tree_entry struct
+	 * This struct is used by tree_walker to return the files of a
+	 * directory tree.
+	 */
+	struct tree_entry : dir_list_entry {
+		/**
+		 * The depth of the entry below the directory the walk started
+		 * at, the entries of that directory are at depth 0
+		 */
+		int depth;
+
+		/**
+		 * whether the entry is the last entry in its directory
+		 */
+		bool is_last;
+	};
+
+	/**
+	 * tree_walker class
+	 * Walks a directory tree in pre-order: every directory is returned
+	 * right before its content.
+	 * A directory is listed by its inode id when the walk reaches it, so
+	 * no path is resolved during the walk. Only the listings of the
+	 * directories on the way from the root of the walk to the current
+	 * entry are kept in memory.
+	 * Note: the file system shouldn't be modified while walking it, or
+	 * the walk may miss the changes.
+	 */
+	class tree_walker {
+	public:
+		/**
+		 * next method
+		 * Moves to the next entry in the tree.
+		 * @param entry set to the next entry
+		 * @return false if the whole tree was walked, in which case
+		 *	entry isn't changed.
+		 */
+		bool next(tree_entry& entry);
+
+	private:
+		friend class MyFs;
+
+		struct Frame
+		{
+			dir_list entries;
+			size_t next; // index of the next entry to return
+		};
+
+		tree_walker(const MyFs& fs, int dir);
+
+		const MyFs& _fs;
+		std::vector<Frame> _frames; // the directories that are being walked, innermost last
+	};
+
 	/**
 	 * format method
 	 * This function discards the current content in the blockdevice and
 	 * create a fresh new MYFS instance in the blockdevice.
+	 * The instance spans the whole device and its geometry is recorded
+	 * in the header, so it is applied again when the device is mounted.
+	 * @param block_size the size of a data block in bytes, a power of two
+	 *	between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE.
+	 * @param lazy_inodes whether to leave the inode table as it is, in
+	 *	which case its entries are only written once their inodes are
+	 *	first allocated, so formatting takes the same time on any device.
+	 *	Otherwise the whole table is zeroed, which also erases the inodes
+	 *	of the instance that was on the device before.
 	 */
-	void format();
+	void format(int block_size = DEFAULT_BLOCK_SIZE, bool lazy_inodes = true);
 
 	/**
 	 * create_file method
 	 * Creates a new file in the required path.
 	 * @param path_str the file path (e.g. "/newfile")
 	 * @param directory boolean indicating whether this is a file or directory
+	 * @param compressed whether the data of the file is stored compressed,
+	 *	see set_content. Directories are never compressed.
 	 */
-	void create_file(const std::string& path_str, bool directory);
+	void create_file(const std::string& path_str, bool directory, bool compressed = false);
 
 	/**
 	 * get_content method
@@ -62,9 +219,62 @@ public:
 	 */
 	std::string get_content(const std::string& path_str) const;
 
+	/**
+	 * get_file_id method
+	 * Returns the inode id of a file, which can be used to access the file
+	 * without resolving its path again.
+	 * @param path_str the file path (e.g. "/somefile")
+	 * @return the inode id of the file
+	 */
+	int get_file_id(const std::string& path_str) const;
+
+	/**
+	 * read method
+	 * Reads a range of a file straight into a buffer of the caller, without
+	 * copying the rest of the file.
+	 * Holes in the file are read as null bytes.
+	 * @param path_str the file path (e.g. "/somefile")
+	 * @param offset the offset inside the file to start reading from
+	 * @param length the amount of bytes to read
+	 * @param dst the buffer to read into, must have room for length bytes
+	 * @return the amount of bytes that were read, which is smaller than
+	 *	length if the range passes the end of the file.
+	 */
+	size_t read(const std::string& path_str, size_t offset, size_t length, char* dst) const;
+
+	/**
+	 * read method
+	 * Same as above, for a file that is identified by its inode id.
+	 */
+	size_t read(int file, size_t offset, size_t length, char* dst) const;
+
+	/**
+	 * read method
+	 * Same as above, reading as many bytes as fit in dst.
+	 */
+	size_t read(int file, size_t offset, std::span<char> dst) const;
+
+	/**
+	 * view method
+	 * Returns a pointer to a range of a file inside the block device,
+	 * without copying it.
+	 * The pointer is borrowed from the block device and the data it points
+	 * to is only valid until the file is changed.
+	 * @param file the inode id of the file
+	 * @param offset the offset inside the file
+	 * @param length the length of the range
+	 * @return a pointer to the range, or nullptr if the range is not inside
+	 *	the file, is not stored contiguously on the device (or is stored
+	 *	inside the file's inode) or the device isn't in memory.
+	 */
+	const char* view(int file, size_t offset, size_t length) const;
+
 	/**
 	 * set_content method
 	 * Sets the whole content of the file indicated by path_str param.
+	 * Content that is small enough is stored inside the file's inode, so
+	 * reading it doesn't read any block. Files and directories move to
+	 * blocks once they grow past it.
 	 * Note: this method assumes path_str refers to a file and not a
 	 * directory.
 	 * @param path_str the file path (e.g. "/somefile")
@@ -72,22 +282,169 @@ public:
 	 */
 	void set_content(const std::string& path_str, const std::string& content);
 
+	/**
+	 * set_content method
+	 * Same as above, also setting whether the file is stored compressed.
+	 * The data of a compressed file is split into clusters of
+	 * COMPRESSION_CLUSTER bytes that are compressed separately, and every
+	 * cluster only takes the blocks its compressed data needs. A cluster
+	 * that doesn't shrink by at least a block is stored as it is. Reads of
+	 * a range only read and decompress the clusters that the range
+	 * overlaps, and writes rewrite them.
+	 * Note: compressed files can't be viewed.
+	 */
+	void set_content(const std::string& path_str, const std::string& content, bool compressed);
+
+	/**
+	 * write method
+	 * Writes data at an offset inside a file, only touching the blocks in
+	 * the written range.
+	 * If the data passes the end of the file the file is extended. If the
+	 * offset is beyond the end of the file, the gap becomes a hole that
+	 * reads as null bytes and takes no blocks until it is written.
+	 * @param file the inode id of the file
+	 * @param offset the offset inside the file to write to
+	 * @param data the data to write
+	 */
+	void write(int file, size_t offset, std::string_view data);
+
+	/**
+	 * write method
+	 * Same as above, for a file that is identified by its path.
+	 */
+	void write(const std::string& path_str, size_t offset, std::string_view data);
+
+	/**
+	 * append method
+	 * Writes data at the end of a file.
+	 * @param file the inode id of the file
+	 * @param data the data to write
+	 */
+	void append(int file, std::string_view data);
+
+	/**
+	 * append method
+	 * Same as above, for a file that is identified by its path.
+	 */
+	void append(const std::string& path_str, std::string_view data);
+
+	/**
+	 * truncate method
+	 * Sets the size of a file, dropping the data past the new size or
+	 * extending the file with a hole that reads as null bytes.
+	 * The blocks past the new size are freed with a single pass over the
+	 * file's extents.
+	 * @param file the inode id of the file
+	 * @param size the new size of the file
+	 */
+	void truncate(int file, size_t size);
+
+	/**
+	 * truncate method
+	 * Same as above, for a file that is identified by its path.
+	 */
+	void truncate(const std::string& path_str, size_t size);
+
+	/**
+	 * remove_file method
+	 * Removes a file or an empty directory from its directory and frees
+	 * its inode and its blocks.
+	 * The blocks are only reused once the running transaction commits, see
+	 * sync.
+	 * @param path_str the file path (e.g. "/somefile")
+	 */
+	void remove_file(const std::string& path_str);
+
 	/**
 	 * list_dir method
 	 * Returns a list of a files in a directory.
 	 * Note: this method assumes path_str refers to a directory and not a
 	 * file.
 	 * @param path_str the file path (e.g. "/somedir")
+	 * The entries of a small directory are listed in the order they were
+	 * added. Once a directory is converted to a hash index the order
+	 * follows the hash buckets instead, which is arbitrary but stays the
+	 * same as long as the directory isn't modified.
 	 * @return a vector of dir_list_entry structures, one for each file in
 	 *	the directory.
 	 */
-	dir_list list_dir(const std::string& path_str);
+	dir_list list_dir(const std::string& path_str) const;
+
+	/**
+	 * list_dir method
+	 * Same as above, for a directory that is identified by its inode id.
+	 * The inodes of the files are read in as few reads as possible, in the
+	 * order they are stored on the device.
+	 */
+	dir_list list_dir(int dir) const;
+
+	/**
+	 * walk method
+	 * Returns a walker over every file under a directory, see tree_walker.
+	 * @param path_str the directory path (e.g. "/somedir")
+	 * @return the walker, positioned before the first entry.
+	 */
+	tree_walker walk(const std::string& path_str) const;
+
+	/**
+	 * sync method
+	 * Commits every change that is only kept in memory to the block device.
+	 * Changes to the metadata (the allocation bitmaps, the inodes, the
+	 * directories and the extent tables) are grouped in a transaction that
+	 * is written to the journal first, so after a crash the file system is
+	 * in the state of the last commit. Until then, the metadata changes are
+	 * only kept in memory, and the blocks that were freed are not reused.
+	 * A commit also happens when the transaction fills half the journal.
+	 */
+	void sync();
+
+	/**
+	 * statfs method
+	 * Returns the size of the file system and how much of it is free,
+	 * without scanning the allocation bitmaps.
+	 * The blocks that were freed in the running transaction are counted as
+	 * free, because they are reused once it is committed.
+	 * @return the usage of the file system.
+	 */
+	fs_stats statfs() const;
+
+	/**
+	 * fragmentation method
+	 * Returns how fragmented the files are, as the percentage of the
+	 * blocks of the files that don't directly follow the block before
+	 * them in their file on the device. The first block of every file is
+	 * not counted, so 0 means that every file is contiguous.
+	 * Note: every allocated inode is read.
+	 * @return the fragmentation score, between 0 and 100.
+	 */
+	double fragmentation() const;
+
+	/**
+	 * defrag method
+	 * Moves the blocks of every fragmented file into as few runs of
+	 * contiguous blocks as the free space allows, or into a single run
+	 * if there is one that is long enough.
+	 * Every file is moved by a single operation: its data is copied to
+	 * the new blocks first, and its extents are changed in the running
+	 * transaction. The old blocks are only reused once it commits, so
+	 * after a crash every file points to either its old or its new
+	 * blocks. Other operations may run at the same time.
+	 * Note: the pointers that view returned for the moved files are left
+	 * pointing to their old blocks.
+	 * @param pack_directories whether to also move the directories,
+	 *	contiguous or not, to the first free runs of the data region,
+	 *	which is right after the inode table, so that path lookups read
+	 *	blocks that are close to each other.
+	 * @return what was done and the fragmentation before and after it.
+	 */
+	defrag_stats defrag(bool pack_directories = false);
 
 private:
 
 	/**
 	 * This struct represents the first bytes of a myfs filesystem.
-	 * It holds some magic characters and a number indicating the version.
+	 * It holds some magic characters, a number indicating the version and
+	 * the geometry the instance was formatted with.
 	 * Upon class construction, the magic and the header are tested - if
 	 * they both exist than the file is assumed to contain a valid myfs
 	 * instance. Otherwise, the blockdevice is formatted and a new instance is
@@ -96,32 +453,90 @@ private:
 	struct myfs_header {
 		char magic[4];
 		uint8_t version;
+		uint32_t blockSize;
+		uint64_t deviceSize;
+		uint32_t freeBlocks; // free blocks and inodes at the last commit
+		uint32_t freeInodes;
+		uint32_t initializedInodes; // see _initializedInodes
 	};
 
     struct DiskParts
     {
-        int blockBitMap; // pointer to the block bit map
-        int inodeBitMap; // pointer to the Inode bit map
-        int root; // pointer to where the inodes are stored
-        int unused; // unused bytes
-        int data; // pointer to where the data is stored
+        uint64_t blockBitMap; // pointer to the block bit map
+        uint64_t inodeBitMap; // pointer to the Inode bit map
+        uint64_t root; // pointer to where the inodes are stored
+        uint64_t unused; // unused bytes
+        uint64_t journal; // pointer to the journal region
+        uint64_t data; // pointer to where the data is stored
+        int blockSize; // size of a data block in bytes
+        int blockCount; // amount of blocks in the data region
+        int inodeCount; // amount of inodes in the inode table
+        int journalBlocks; // amount of blocks in the journal region
     };
 
     enum Constants
     {
-        DIRECT_POINTERS=12,
+        DIRECT_EXTENTS=4,
         FILE_NAME_LEN=11,
-        BLOCK_SIZE=16,
         BITS_IN_BYTE=8,
-        BYTES_PER_INODE=16 * 1024 // an inode for every 16-KB of data
+        BYTES_PER_INODE=16 * 1024, // an inode for every 16-KB of data
+        DENTRY_CACHE_SIZE=4096, // amount of cached directory entries
+        INODE_CACHE_SIZE=1024, // amount of cached inodes
+        INODE_CACHE_SHARDS=16, // parts of the inode cache that are locked separately
+        INODE_LOCKS=64, // reader-writer locks that the inodes are spread over
+        ROOT_INODE=0, // the root directory is the first inode that is allocated
+        INODE_READ_GAP=16, // unneeded inodes that a batched inode read may read over
+        JOURNAL_RATIO=64, // the journal takes this part of the device
+        JOURNAL_MIN_SIZE=64 * 1024,
+        JOURNAL_MAX_SIZE=32 * 1024 * 1024,
+        JOURNAL_MIN_BLOCKS=4,
+        READ_AHEAD_MIN=16 * 1024, // bytes that are read ahead of the second sequential read of a file
+        READ_AHEAD_MAX=256 * 1024,
+        INODE_TABLE_CHUNK=1024 * 1024, // bytes of the inode table that a format zeroes at a time
+        DEFRAG_BUFFER=1024 * 1024 // bytes of a file that defrag copies at a time
+    };
+
+    /**
+     * A run of contiguous blocks in the data region that holds a contiguous
+     * part of a file.
+     */
+    struct Extent
+    {
+        int fileBlock; // index of the first block inside the file
+        int start; // number of the first block in the data region
+        int length; // amount of blocks in the run
+    };
+
+    // the bytes of data that fit in an inode in place of its extents
+    static constexpr size_t INLINE_SIZE = (DIRECT_EXTENTS + 1) * sizeof(Extent);
+
+    enum InodeFlags
+    {
+        // the directory's data is a hash index instead of a list of entries
+        INDEXED_DIR=1,
+        // the data is stored in the inode instead of in blocks, and the
+        // bytes after the end of the data are zeroes
+        INLINE_DATA=2,
+        // the data is split into clusters that are compressed separately
+        COMPRESSED=4
     };
 
     struct Inode
     {
         int id; // inode id
         bool directory;
+        uint8_t flags; // InodeFlags
         size_t size;
-        int addresses[DIRECT_POINTERS];
+        int extentCount; // amount of extents, including the indirect ones
+        union
+        {
+            struct
+            {
+                Extent extents[DIRECT_EXTENTS];
+                Extent indirect; // blocks that hold the extents that don't fit in the inode
+            };
+            char inlineData[INLINE_SIZE]; // the data of an INLINE_DATA inode
+        };
     };
 
     struct DirEntry
@@ -130,27 +545,163 @@ private:
         int id; // inode id
     };
 
-	BlockDeviceSimulator* blkdevsim;
-    const DiskParts _parts;
+    /**
+     * The sequential reads of a file by a thread, which the blocks that
+     * follow them are read ahead for.
+     */
+    struct ReadStream
+    {
+        const MyFs* fs; // the file system of the file
+        int inode; // inode id of the file, or -1
+        size_t end; // the end of the last read in the file
+        size_t window; // the amount of bytes to read ahead after the end
+        size_t readAhead; // the end of the range that was read ahead already
+    };
+
+    struct CachedInode
+    {
+        Inode inode;
+        bool dirty; // whether the inode changed since it was written to the disk
+        size_t clockPosition; // index in the clock of the shard
+        std::atomic<bool> referenced; // set by reads, cleared by the clock hand
+    };
+
+    /**
+     * A part of the inode cache, which holds the inodes whose id modulo
+     * INODE_CACHE_SHARDS is the index of the shard.
+     * Reads of cached inodes only share the lock, and the inode to evict is
+     * chosen with the CLOCK algorithm so a read doesn't have to reorder
+     * anything.
+     */
+    struct InodeCacheShard
+    {
+        std::shared_mutex lock;
+        std::unordered_map<int, CachedInode> inodes;
+        std::vector<int> clock; // the ids of the cached inodes
+        size_t hand = 0;
+    };
+
+    /**
+     * An operation that changes the file system.
+     * The inode that the operation changes is locked exclusively for the
+     * whole operation, and commits wait until the operation is finished.
+     */
+    class Operation
+    {
+    public:
+        Operation(MyFs& fs, int inode);
+        /**
+         * An operation that changes two inodes, which are locked together
+         * so that operations which lock the same inodes can't deadlock.
+         */
+        Operation(MyFs& fs, int inode, int other);
+        ~Operation();
+
+    private:
+        MyFs& _fs;
+        std::unique_lock<std::shared_mutex> _inodeLock;
+        std::unique_lock<std::shared_mutex> _otherLock; // not owned if both inodes share a lock
+    };
+
+	BlockDevice* blkdevsim;
+    DiskParts _parts;
+    myfs_header _header; // the header as it was last committed
+    Bitmap _blockBitmap;
+    Bitmap _inodeBitmap;
+    mutable Journal _journal;
+    std::vector<Bitmap::Run> _freedRuns; // blocks that are freed once the running transaction commits
+    int _freedCount = 0; // the amount of blocks in the freed runs
+    mutable std::mutex _allocatorLock; // guards the bitmaps and the freed blocks
+    // the inodes past it were never allocated since the format, and their
+    // entries in the inode table may hold anything
+    std::atomic<int> _initializedInodes = 0;
+    mutable DentryCache _dentries;
+    mutable InodeCacheShard _inodeCache[INODE_CACHE_SHARDS];
+    // the amount of cached inodes that weren't written to the journal, by the
+    // blocks of the inode table that hold them
+    mutable std::unordered_map<uint64_t, int> _dirtyInodeBlocks;
+    mutable std::mutex _dirtyInodeBlocksLock;
+    mutable std::shared_mutex _inodeLocks[INODE_LOCKS];
+    std::mutex _transactionLock; // guards the counters of the operations
+    std::condition_variable _transactionChanged;
+    int _activeOperations = 0; // operations that started and didn't finish
+    int _pausedOperations = 0; // active operations that wait for a commit
+    bool _committing = false;
 
-    int _getInodeAddress(int id) const;
-    Inode _getRootDir() const;
-    Inode _getInode(std::string path) const;
+    uint64_t _getInodeAddress(int id) const;
+    uint64_t _getBlockAddress(int block) const;
+    int _getInodeId(std::string_view path) const;
+    std::shared_mutex& _inodeLock(int id) const;
+    Inode _readInode(int id) const;
+    std::vector<Inode> _readInodes(const std::vector<int>& ids) const;
+    int _lookup(int dir, std::string_view name) const;
+    int _lookup(const Inode& dir, std::string_view name) const;
+    int _findEntry(const Inode& dir, std::string_view name) const;
+    std::vector<DirEntry> _readDirEntries(const Inode& dir) const;
+    void _buildDirIndex(Inode& dir, const std::vector<DirEntry>& entries, size_t buckets);
+    size_t _getDirSlots() const;
+    static std::string_view _getEntryName(const DirEntry& entry);
+    static uint64_t _hashName(std::string_view name);
 
+    std::vector<Extent> _readExtents(const Inode& inode) const;
+    void _writeExtents(Inode& inode, const std::vector<Extent>& extents);
     void* _readInodeData(const Inode& inode) const;
+    void _readInodeData(const Inode& inode, size_t offset, size_t size,
+                        char* buffer) const;
+    void _readExtentData(const Inode& inode, const std::vector<Extent>& extents,
+                         size_t offset, size_t size, char* buffer) const;
+    void _readCompressed(const Inode& inode, size_t offset, size_t size, char* buffer) const;
+    void _writeCompressed(Inode& inode, size_t offset, std::string_view data, bool replace);
+    void _setContent(const std::string& path_str, std::string_view content,
+                     std::optional<bool> compressed);
+    void _writeInodeData(Inode& inode, size_t offset, size_t size,
+                         const char* data);
+    void _submit(const Inode& inode, std::span<const BlockDevice::Request> requests) const;
+    void _readAhead(const Inode& inode, const std::vector<Extent>& extents,
+                    size_t offset, size_t size) const;
+    void _write(Inode& inode, size_t offset, std::string_view data);
+    void _zeroStaleTail(Inode& inode, size_t end);
+    void _truncate(Inode& inode, size_t size);
+    void _commit(bool paused);
+    void _commitTransaction();
+    void _writeHeader();
+    size_t _pendingBlocks() const;
+    void _commitIfFull();
     void _writeInode(const Inode& inode);
+    Inode _cacheInode(const Inode& inode, bool dirty) const;
+    void _countDirtyInode(int id, int change) const;
+    void _flushInodes();
     void _addFileToFolder(const DirEntry& file, Inode& folder);
+    void _removeFromFolder(Inode& folder, std::string_view name);
 
-    int _allocate(int bitmapStart);
-    void _deallocate(int bitmapStart, int n);
+    void _loadBitmaps();
+    int _allocate(Bitmap& bitmap);
+    void _deallocate(Bitmap& bitmap, int n);
     Inode _reallocateBlocks(const Inode& inode, size_t newSize);
+    void _allocateRange(Inode& inode, size_t offset, size_t length);
+    void _checkSpace(const Inode& inode, size_t offset, size_t length);
+    void _reserveBlocks(int count);
+    static bool _fitsInline(const Inode& inode, size_t end);
+    void _moveInlineData(Inode& inode);
+    static int _findHoles(const std::vector<Extent>& extents, int first, int end,
+                          std::vector<Extent>& holes);
+    void _truncateBlocks(Inode& inode, size_t size);
+    void _freeBlockRange(Inode& inode, int first, int end);
+    static int _countBlocks(const std::vector<Extent>& extents, int first, int end);
+    static void _mergeExtents(std::vector<Extent>& extents);
     int _allocateInode();
-    int _allocateBlock();
-    void _deallocateBlock(int address);
+    std::vector<Bitmap::Run> _allocateBlocks(int count, int goal);
+    int _allocateRun(int length);
+    void _deallocateBlocks(int start, int length);
+    std::vector<int> _allocatedInodes() const;
+    static int _countRuns(const std::vector<Extent>& extents);
+    bool _defragInode(int id, bool pack, int& blocksMoved);
+    void _copyBlocks(const Inode& inode, const std::vector<Extent>& from,
+                     const std::vector<Extent>& to);
 
-    static constexpr DiskParts _calcParts();
+    static DiskParts _calcParts(uint64_t deviceSize, int blockSize);
 
-	static const uint8_t CURR_VERSION = 0x03;
+	static const uint8_t CURR_VERSION = 0x08;
 	static const char* MYFS_MAGIC;
 };
 
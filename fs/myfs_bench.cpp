@@ -0,0 +1,499 @@
+#include "blkdev.h"
+#include "file_blkdev.h"
+#include "ram_blkdev.h"
+#include "myfs.h"
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+const std::string DEVICE_OPTION = "--device=";
+const std::string IMAGE_OPTION = "--image=";
+const std::string JSON_OPTION = "--json=";
+const std::string FILTER_OPTION = "--filter=";
+const std::string MMAP_DEVICE = "mmap";
+const std::string FILE_DEVICE = "file";
+const std::string RAM_DEVICE = "ram";
+
+const std::string DEFAULT_IMAGE = "/tmp/myfs_bench.img";
+
+// the inodes and blocks that a fixture needs besides the files of the benchmark
+const uint64_t FIXTURE_SLACK = 8 << 20;
+const uint64_t BYTES_PER_FILE = 20 * 1024;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/**
+ * The options that every benchmark runs with.
+ */
+struct bench_options {
+	std::string device_type = MMAP_DEVICE;
+	std::string image = DEFAULT_IMAGE;
+	std::string json;
+	std::string filter;
+};
+
+/**
+ * The measurements of a single benchmark.
+ */
+struct bench_result {
+	std::string name;
+	std::string param;
+	std::vector<uint64_t> latencies; // of every operation, in nanoseconds
+	double seconds; // the time from the first operation to the last
+	unsigned threads;
+};
+
+/**
+ * A file system on a new device, which is removed when the fixture is
+ * destroyed.
+ */
+class fixture {
+public:
+	fixture(const bench_options& options, uint64_t size, int block_size = MyFs::DEFAULT_BLOCK_SIZE) :
+			image(options.image) {
+		std::streambuf* out = std::cout.rdbuf();
+
+		unlink(image.c_str());
+		if (options.device_type == MMAP_DEVICE)
+			device = std::make_unique<BlockDeviceSimulator>(image, size);
+		else if (options.device_type == FILE_DEVICE)
+			device = std::make_unique<FileBlockDevice>(image, size);
+		else if (options.device_type == RAM_DEVICE)
+			device = std::make_unique<RamBlockDevice>(size);
+		else
+			throw std::invalid_argument("unknown device type: " + options.device_type);
+
+		// the new device is formatted, which is reported on the standard output
+		std::cout.rdbuf(nullptr);
+		try {
+			fs = std::make_unique<MyFs>(device.get(), block_size);
+		} catch (...) {
+			std::cout.rdbuf(out);
+			throw;
+		}
+		std::cout.rdbuf(out);
+	}
+
+	~fixture() {
+		fs.reset();
+		device.reset();
+		unlink(image.c_str());
+	}
+
+	std::unique_ptr<BlockDevice> device;
+	std::unique_ptr<MyFs> fs;
+
+private:
+	std::string image;
+};
+
+static uint64_t elapsed_ns(bench_clock::time_point start, bench_clock::time_point end) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+/**
+ * Run an operation a fixed amount of times and record the latency of every
+ * run.
+ * @param op the operation, which gets the index of the run.
+ */
+static void measure(bench_result& result, size_t ops, const std::function<void(size_t)>& op) {
+	bench_clock::time_point start;
+	bench_clock::time_point before;
+	bench_clock::time_point after;
+
+	result.latencies.reserve(result.latencies.size() + ops);
+	start = bench_clock::now();
+	after = start;
+	for (size_t i = 0; i < ops; i++) {
+		before = after;
+		op(i);
+		after = bench_clock::now();
+		result.latencies.push_back(elapsed_ns(before, after));
+	}
+	result.seconds += elapsed_ns(start, after) / 1e9;
+}
+
+/**
+ * Get a percentile of the latencies, with the nearest-rank method.
+ * @param sorted the latencies, sorted.
+ * @param fraction the percentile as a fraction, e.g. 0.99.
+ */
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double fraction) {
+	size_t rank;
+
+	if (sorted.empty())
+		return 0;
+	rank = (size_t)std::ceil(fraction * sorted.size());
+
+	return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+static std::string file_name(size_t index) {
+	return "f" + std::to_string(index);
+}
+
+/**
+ * Get the size of a device that fits a file system with an amount of files.
+ */
+static uint64_t device_size_for(size_t files) {
+	return files * BYTES_PER_FILE + FIXTURE_SLACK;
+}
+
+static bench_result bench_create_file(const bench_options& options, size_t entries) {
+	bench_result result{ "create_file", "entries=" + std::to_string(entries), {}, 0, 1 };
+	fixture fix(options, device_size_for(entries));
+
+	fix.fs->create_file("/dir", true);
+	measure(result, entries, [&](size_t i) {
+		fix.fs->create_file("/dir/" + file_name(i), false);
+	});
+
+	return result;
+}
+
+/**
+ * Resolve the path of a file under `depth` nested directories, each of which
+ * has other files in it as well.
+ */
+static bench_result bench_lookup(const bench_options& options, size_t depth) {
+	constexpr size_t SIBLINGS = 32;
+	constexpr size_t OPS = 200000;
+	bench_result result{ "lookup", "depth=" + std::to_string(depth), {}, 0, 1 };
+	fixture fix(options, device_size_for(depth * SIBLINGS));
+	std::string path;
+
+	for (size_t level = 1; level < depth; level++) {
+		path += "/d";
+		fix.fs->create_file(path, true);
+		for (size_t i = 0; i < SIBLINGS; i++)
+			fix.fs->create_file(path + "/" + file_name(i), false);
+	}
+	path += "/target";
+	fix.fs->create_file(path, false);
+
+	fix.fs->get_file_id(path);
+	measure(result, OPS, [&](size_t) {
+		fix.fs->get_file_id(path);
+	});
+
+	return result;
+}
+
+/**
+ * Get the amount of operations on files of a size, so every benchmark
+ * moves about the same amount of data.
+ */
+static size_t ops_for_size(size_t size) {
+	return std::clamp<size_t>((256 << 20) / std::max<size_t>(size, 1), 100, 100000);
+}
+
+static bench_result bench_get_content(const bench_options& options, size_t size) {
+	const size_t OPS = ops_for_size(size);
+	bench_result result{ "get_content", "size=" + std::to_string(size), {}, 0, 1 };
+	fixture fix(options, size * 2 + FIXTURE_SLACK);
+	size_t total = 0;
+
+	fix.fs->create_file("/file", false);
+	fix.fs->set_content("/file", std::string(size, 'x'));
+	fix.fs->get_content("/file");
+	measure(result, OPS, [&](size_t) {
+		total += fix.fs->get_content("/file").size();
+	});
+	if (total != OPS * size)
+		throw std::runtime_error("get_content returned a wrong size");
+
+	return result;
+}
+
+static bench_result bench_set_content(const bench_options& options, size_t size) {
+	const size_t OPS = ops_for_size(size);
+	bench_result result{ "set_content", "size=" + std::to_string(size), {}, 0, 1 };
+	// the blocks of a rewritten file are only freed on commit
+	fixture fix(options, size * 4 + FIXTURE_SLACK);
+	const std::string CONTENT[] = { std::string(size, 'x'), std::string(size, 'y') };
+
+	fix.fs->create_file("/file", false);
+	measure(result, OPS, [&](size_t i) {
+		fix.fs->set_content("/file", CONTENT[i % 2]);
+	});
+
+	return result;
+}
+
+static bench_result bench_list_dir(const bench_options& options, size_t entries) {
+	const size_t OPS = std::clamp<size_t>(1000000 / entries, 10, 10000);
+	bench_result result{ "list_dir", "entries=" + std::to_string(entries), {}, 0, 1 };
+	fixture fix(options, device_size_for(entries));
+
+	fix.fs->create_file("/dir", true);
+	for (size_t i = 0; i < entries; i++)
+		fix.fs->create_file("/dir/" + file_name(i), false);
+
+	fix.fs->list_dir("/dir");
+	measure(result, OPS, [&](size_t) {
+		if (fix.fs->list_dir("/dir").size() != entries)
+			throw std::runtime_error("list_dir returned a wrong amount of entries");
+	});
+
+	return result;
+}
+
+/**
+ * Append a block at a time to files of an image that is nearly full, whose
+ * free blocks are scattered in short runs between the blocks of other files.
+ * The block after the end of every appended file is taken, so every append
+ * has to search the bitmap for a free block.
+ */
+static bench_result bench_alloc_full(const bench_options& options) {
+	constexpr size_t FILE_BLOCKS = 5;
+	constexpr size_t FILES_PER_DIR = 256;
+	const int BLOCK_SIZE = MyFs::DEFAULT_BLOCK_SIZE;
+	bench_result result{ "alloc_full", "device=64M", {}, 0, 1 };
+	fixture fix(options, 64 << 20, BLOCK_SIZE);
+	const std::string BLOCK(BLOCK_SIZE, 'x');
+	std::vector<int> appended;
+	std::string dir;
+	size_t freed = 0;
+	size_t files = 0;
+
+	// fill the image with files until the blocks run out
+	try {
+		while (true) {
+			if (files % FILES_PER_DIR == 0) {
+				dir = "/d" + std::to_string(files / FILES_PER_DIR);
+				fix.fs->create_file(dir, true);
+			}
+			fix.fs->create_file(dir + "/" + file_name(files), false);
+			fix.fs->set_content(dir + "/" + file_name(files), std::string(FILE_BLOCKS * BLOCK_SIZE, 'x'));
+			files++;
+		}
+	} catch (std::runtime_error&) {
+	}
+
+	// free the last two blocks of every third file, and append to the file
+	// that follows it
+	for (size_t i = 0; i + 1 < files; i += 3) {
+		std::string path = "/d" + std::to_string(i / FILES_PER_DIR) + "/" + file_name(i);
+
+		fix.fs->set_content(path, std::string((FILE_BLOCKS - 2) * BLOCK_SIZE, 'x'));
+		freed += 2;
+		appended.push_back(fix.fs->get_file_id("/d" + std::to_string((i + 1) / FILES_PER_DIR) + "/" +
+						       file_name(i + 1)));
+	}
+	fix.fs->sync();
+
+	// use half the freed blocks, so the image stays nearly full
+	measure(result, freed / 2, [&](size_t i) {
+		fix.fs->append(appended[(i * 7919) % appended.size()], BLOCK);
+	});
+
+	return result;
+}
+
+/**
+ * A mix of reads, rewrites and creates on a tree of small files.
+ */
+static bench_result bench_mixed(const bench_options& options) {
+	constexpr size_t DIRS = 16;
+	constexpr size_t FILES = 4096;
+	constexpr size_t OPS = 100000;
+	constexpr size_t FILE_SIZE = 4096;
+	bench_result result{ "mixed", "files=" + std::to_string(FILES), {}, 0, 1 };
+	fixture fix(options, device_size_for(FILES + OPS / 20) + FILES * FILE_SIZE);
+	const std::string CONTENT(FILE_SIZE, 'x');
+	std::mt19937 random(1);
+	size_t created = FILES;
+
+	for (size_t d = 0; d < DIRS; d++)
+		fix.fs->create_file("/d" + std::to_string(d), true);
+	for (size_t i = 0; i < FILES; i++) {
+		fix.fs->create_file("/d" + std::to_string(i % DIRS) + "/" + file_name(i), false);
+		fix.fs->set_content("/d" + std::to_string(i % DIRS) + "/" + file_name(i), CONTENT);
+	}
+
+	// 80% reads, 15% rewrites and 5% creates
+	measure(result, OPS, [&](size_t) {
+		const unsigned KIND = random() % 100;
+		const size_t FILE = random() % FILES;
+		const std::string PATH = "/d" + std::to_string(FILE % DIRS) + "/" + file_name(FILE);
+
+		if (KIND < 80) {
+			fix.fs->get_content(PATH);
+		} else if (KIND < 95) {
+			fix.fs->set_content(PATH, CONTENT);
+		} else {
+			fix.fs->create_file("/d" + std::to_string(created % DIRS) + "/" + file_name(created), false);
+			created++;
+		}
+	});
+
+	return result;
+}
+
+/**
+ * Read different files from several threads at once.
+ */
+static bench_result bench_parallel_get_content(const bench_options& options, unsigned threads) {
+	constexpr size_t FILES = 1024;
+	constexpr size_t OPS_PER_THREAD = 50000;
+	constexpr size_t FILE_SIZE = 4096;
+	bench_result result{ "parallel_get_content", "threads=" + std::to_string(threads), {}, 0, threads };
+	fixture fix(options, device_size_for(FILES) + FILES * FILE_SIZE);
+	std::vector<bench_result> partial(threads);
+	std::vector<std::thread> workers;
+	bench_clock::time_point start;
+
+	fix.fs->create_file("/dir", true);
+	for (size_t i = 0; i < FILES; i++) {
+		fix.fs->create_file("/dir/" + file_name(i), false);
+		fix.fs->set_content("/dir/" + file_name(i), std::string(FILE_SIZE, 'x'));
+		fix.fs->get_content("/dir/" + file_name(i));
+	}
+
+	start = bench_clock::now();
+	for (unsigned t = 0; t < threads; t++) {
+		workers.emplace_back([&, t] {
+			measure(partial[t], OPS_PER_THREAD, [&](size_t i) {
+				fix.fs->get_content("/dir/" + file_name((i * threads + t) % FILES));
+			});
+		});
+	}
+	for (std::thread& worker : workers)
+		worker.join();
+	result.seconds = elapsed_ns(start, bench_clock::now()) / 1e9;
+	for (const bench_result& part : partial)
+		result.latencies.insert(result.latencies.end(), part.latencies.begin(), part.latencies.end());
+
+	return result;
+}
+
+static void print_header() {
+	std::cout << std::left << std::setw(22) << "benchmark"
+		<< std::setw(18) << "param"
+		<< std::right << std::setw(10) << "ops"
+		<< std::setw(14) << "ops/sec"
+		<< std::setw(12) << "p50 (us)"
+		<< std::setw(12) << "p99 (us)"
+		<< std::setw(12) << "p999 (us)" << std::endl;
+}
+
+static void print_result(const bench_result& result, const std::vector<uint64_t>& sorted) {
+	std::cout << std::left << std::setw(22) << result.name
+		<< std::setw(18) << result.param
+		<< std::right << std::setw(10) << sorted.size()
+		<< std::setw(14) << std::fixed << std::setprecision(0) << sorted.size() / result.seconds
+		<< std::setprecision(2)
+		<< std::setw(12) << percentile(sorted, 0.5) / 1e3
+		<< std::setw(12) << percentile(sorted, 0.99) / 1e3
+		<< std::setw(12) << percentile(sorted, 0.999) / 1e3 << std::endl;
+}
+
+static void write_json(const std::string& fname, const bench_options& options,
+		       const std::vector<bench_result>& results) {
+	std::ofstream out(fname);
+
+	if (!out)
+		throw std::runtime_error("Could not open " + fname);
+
+	out << "{\n  \"device\": \"" << options.device_type << "\",\n  \"benchmarks\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		std::vector<uint64_t> sorted = results[i].latencies;
+
+		std::sort(sorted.begin(), sorted.end());
+		out << (i == 0 ? "\n" : ",\n")
+			<< "    {\"name\": \"" << results[i].name << "\""
+			<< ", \"param\": \"" << results[i].param << "\""
+			<< ", \"threads\": " << results[i].threads
+			<< ", \"ops\": " << sorted.size()
+			<< ", \"seconds\": " << std::setprecision(6) << results[i].seconds
+			<< ", \"ops_per_sec\": " << std::fixed << std::setprecision(1)
+			<< sorted.size() / results[i].seconds << std::defaultfloat
+			<< ", \"p50_ns\": " << percentile(sorted, 0.5)
+			<< ", \"p99_ns\": " << percentile(sorted, 0.99)
+			<< ", \"p999_ns\": " << percentile(sorted, 0.999)
+			<< ", \"max_ns\": " << (sorted.empty() ? 0 : sorted.back()) << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+static void usage(const char* program) {
+	std::cerr << "Usage: " << program
+		<< " [" << DEVICE_OPTION << "<type>] [" << IMAGE_OPTION << "<file>]"
+		<< " [" << JSON_OPTION << "<file>] [" << FILTER_OPTION << "<name>]" << std::endl;
+	std::cerr << "Every benchmark runs on a new image, which is created at the image path"
+		<< " (" << DEFAULT_IMAGE << " by default) and removed afterwards." << std::endl;
+	std::cerr << "The device type is " << MMAP_DEVICE << " (the default), "
+		<< FILE_DEVICE << " or " << RAM_DEVICE << "." << std::endl;
+	std::cerr << "With " << FILTER_OPTION << ", only the benchmarks whose name starts"
+		<< " with the name are run." << std::endl;
+	std::cerr << "With " << JSON_OPTION << ", the results are written to the file as JSON"
+		<< " as well." << std::endl;
+}
+
+int main(int argc, char **argv) {
+	bench_options options;
+	std::vector<std::pair<std::string, std::function<bench_result()>>> benchmarks;
+	std::vector<bench_result> results;
+	std::string option;
+
+	for (int i = 1; i < argc; i++) {
+		option = argv[i];
+		if (option.starts_with(DEVICE_OPTION)) {
+			options.device_type = option.substr(DEVICE_OPTION.size());
+		} else if (option.starts_with(IMAGE_OPTION)) {
+			options.image = option.substr(IMAGE_OPTION.size());
+		} else if (option.starts_with(JSON_OPTION)) {
+			options.json = option.substr(JSON_OPTION.size());
+		} else if (option.starts_with(FILTER_OPTION)) {
+			options.filter = option.substr(FILTER_OPTION.size());
+		} else {
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	benchmarks.push_back({ "create_file", [&] { return bench_create_file(options, 10000); } });
+	for (size_t depth : { 1, 2, 4, 8, 16 })
+		benchmarks.push_back({ "lookup", [&, depth] { return bench_lookup(options, depth); } });
+	for (size_t size : { 64, 4096, 65536, 1 << 20 })
+		benchmarks.push_back({ "get_content", [&, size] { return bench_get_content(options, size); } });
+	for (size_t size : { 64, 4096, 65536, 1 << 20 })
+		benchmarks.push_back({ "set_content", [&, size] { return bench_set_content(options, size); } });
+	for (size_t entries : { 10, 100, 1000, 10000, 100000 })
+		benchmarks.push_back({ "list_dir", [&, entries] { return bench_list_dir(options, entries); } });
+	benchmarks.push_back({ "alloc_full", [&] { return bench_alloc_full(options); } });
+	benchmarks.push_back({ "mixed", [&] { return bench_mixed(options); } });
+	for (unsigned threads : { 1, 2, 4, 8 })
+		benchmarks.push_back({ "parallel_get_content", [&, threads] {
+			return bench_parallel_get_content(options, threads);
+		} });
+
+	print_header();
+	try {
+		for (const auto& [name, run] : benchmarks) {
+			if (!name.starts_with(options.filter))
+				continue;
+
+			results.push_back(run());
+			std::vector<uint64_t> sorted = results.back().latencies;
+			std::sort(sorted.begin(), sorted.end());
+			print_result(results.back(), sorted);
+		}
+		if (options.json != "")
+			write_json(options.json, options, results);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+}
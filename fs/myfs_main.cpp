@@ -1,5 +1,11 @@
 #include "blkdev.h"
+#include "file_blkdev.h"
+#include "ram_blkdev.h"
+#include "cached_blkdev.h"
 #include "myfs.h"
+#include "stats.h"
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -8,21 +14,50 @@
 
 const std::string FS_NAME = "myfs";
 
+const std::string DEVICE_OPTION = "--device=";
+const std::string CACHE_OPTION = "--cache=";
+const std::string BATCH_OPTION = "--batch";
+const std::string MMAP_DEVICE = "mmap";
+const std::string FILE_DEVICE = "file";
+const std::string RAM_DEVICE = "ram";
+
 const std::string LIST_CMD = "ls";
 const std::string CONTENT_CMD = "cat";
 const std::string CREATE_FILE_CMD = "touch";
+const std::string COMPRESSED_ARG = "compressed";
 const std::string CREATE_DIR_CMD = "mkdir";
 const std::string EDIT_CMD = "edit";
+const std::string REMOVE_CMD = "rm";
+const std::string TRUNCATE_CMD = "truncate";
 const std::string TREE_CMD = "tree";
+const std::string FORMAT_CMD = "format";
+const std::string FORMAT_EAGER_ARG = "eager";
+const std::string DF_CMD = "df";
+const std::string DEFRAG_CMD = "defrag";
+const std::string DEFRAG_PACK_ARG = "pack";
+const std::string IMPORT_CMD = "import";
+const std::string STATS_CMD = "stats";
+const std::string STATS_RESET_ARG = "reset";
 const std::string HELP_CMD = "help";
 const std::string EXIT_CMD = "exit";
 
 const std::string HELP_STRING = "The following commands are supported: \n"
 	+ LIST_CMD + " [<directory>] - list directory content. \n"
 	+ CONTENT_CMD + " <path> - show file content. \n"
-	+ CREATE_FILE_CMD + " <path> - create empty file. \n"
+	+ CREATE_FILE_CMD + " <path> [" + COMPRESSED_ARG + "] - create empty file, "
+		+ COMPRESSED_ARG + " stores its content compressed. \n"
 	+ CREATE_DIR_CMD + " <path> - create empty directory. \n"
 	+ EDIT_CMD + " <path> - re-set file content. \n"
+	+ REMOVE_CMD + " <path> - remove a file or an empty directory. \n"
+	+ TRUNCATE_CMD + " <path> <size> - shrink or extend a file. \n"
+	+ TREE_CMD + " - show the whole directory tree. \n"
+	+ FORMAT_CMD + " [<block-size> [" + FORMAT_EAGER_ARG + "]] - erase the device and create a new instance, "
+		+ FORMAT_EAGER_ARG + " also zeroes the inode table. \n"
+	+ DF_CMD + " - show how much of the file system is used. \n"
+	+ DEFRAG_CMD + " [" + DEFRAG_PACK_ARG + "] - move every fragmented file to contiguous blocks, "
+		+ DEFRAG_PACK_ARG + " also moves the directories to the start of the data region. \n"
+	+ IMPORT_CMD + " <host-dir> <directory> [" + COMPRESSED_ARG + "] - copy a directory tree of the host into a directory. \n"
+	+ STATS_CMD + " [" + STATS_RESET_ARG + "] - show the counters of the operations, or restart them. \n"
 	+ HELP_CMD + " - show this help messege. \n"
 	+ EXIT_CMD + " - gracefully exit. \n";
 
@@ -37,52 +72,255 @@ std::vector<std::string> split_cmd(std::string cmd) {
 	return ans;
 }
 
-static void recursive_print(MyFs &myfs, std::string path, std::string prefix="") {
-	MyFs::dir_list dlist = myfs.list_dir(path);
-	for (size_t i=0; i < dlist.size(); i++) {
-		MyFs::dir_list_entry &curr_entry = dlist[i];
+/**
+ * Parse a size in bytes, optionally followed by a K, M or G suffix.
+ */
+static uint64_t parse_size(const std::string& str) {
+	size_t end = 0;
+	uint64_t size = std::stoull(str, &end);
+	std::string suffix = str.substr(end);
 
-		std::string entry_prefix = prefix;
-		if (i == dlist.size()-1)
-			entry_prefix += "└── ";
-		else
-			entry_prefix += "├── ";
+	if (suffix == "K")
+		size <<= 10;
+	else if (suffix == "M")
+		size <<= 20;
+	else if (suffix == "G")
+		size <<= 30;
+	else if (suffix != "")
+		throw std::invalid_argument("unknown size suffix: " + suffix);
+
+	return size;
+}
 
-		std::cout << entry_prefix << curr_entry.name << std::endl;
+/**
+ * Open a block device of one of the supported types.
+ */
+static std::unique_ptr<BlockDevice> open_device(const std::string& type,
+		const std::string& fname, uint64_t size) {
+	if (type == MMAP_DEVICE)
+		return std::make_unique<BlockDeviceSimulator>(fname, size);
+	if (type == FILE_DEVICE)
+		return std::make_unique<FileBlockDevice>(fname, size);
+	if (type == RAM_DEVICE)
+		return std::make_unique<RamBlockDevice>(size);
+	throw std::invalid_argument("unknown device type: " + type);
+}
+
+static void print_tree(const MyFs &myfs, const std::string &path) {
+	MyFs::tree_walker walker = myfs.walk(path);
+	MyFs::tree_entry entry;
+	// whether each directory above the current entry was the last one in its parent
+	std::vector<bool> last_dirs;
+	std::string prefix;
 
-		if (curr_entry.is_dir) {
-			std::string dir_prefix = prefix;
+	while (walker.next(entry)) {
+		last_dirs.resize(entry.depth);
+		prefix.clear();
+		for (bool last : last_dirs)
+			prefix += last ? "    " : "│   ";
+		prefix += entry.is_last ? "└── " : "├── ";
+
+		std::cout << prefix << entry.name << '\n';
+		last_dirs.push_back(entry.is_last);
+	}
+	std::cout.flush();
+}
+
+/**
+ * Copy a directory tree of the host into a directory of the file system,
+ * creating the directory if it doesn't exist.
+ * Every file is read whole and written to its new inode with a single write,
+ * so its blocks are allocated in one pass and written in one batch. Only one
+ * buffer is used for all the files, and the changes are committed once at
+ * the end (or whenever the journal fills).
+ * A file that can't be copied is reported and skipped.
+ * @param compressed whether to store the content of the files compressed.
+ * @return the amount of entries that couldn't be copied.
+ */
+static size_t import_tree(MyFs &myfs, const std::string &host_dir, const std::string &path,
+		bool compressed) {
+	namespace fs = std::filesystem;
+	const std::string root = path == "/" ? "" : path;
+	std::string buffer;
+	size_t files = 0;
+	size_t dirs = 0;
+	size_t failed = 0;
+	uint64_t bytes = 0;
+
+	if (!fs::is_directory(host_dir))
+		throw std::runtime_error("Error: " + host_dir + " is not a directory on the host");
+	try {
+		myfs.get_file_id(path);
+	} catch (std::runtime_error &) {
+		myfs.create_file(path, true);
+	}
+
+	// the iterator returns every directory before its content
+	for (auto it = fs::recursive_directory_iterator(host_dir); it != fs::recursive_directory_iterator(); it++) {
+		const fs::directory_entry &entry = *it;
+		const std::string target = root + "/" + fs::relative(entry.path(), host_dir).generic_string();
+
+		try {
+			if (entry.is_directory()) {
+				myfs.create_file(target, true);
+				dirs++;
+			} else if (entry.is_regular_file()) {
+				std::ifstream file(entry.path(), std::ios::binary);
 
-			if (i == dlist.size()-1)
-				dir_prefix += "    ";
-			else
-				dir_prefix += "│   ";
-			recursive_print(myfs, path + "/" + curr_entry.name, dir_prefix);
+				buffer.resize(entry.file_size());
+				if (!file.read(buffer.data(), buffer.size()))
+					throw std::runtime_error("Error: can't read " + entry.path().string());
+				myfs.create_file(target, false, compressed);
+				myfs.write(myfs.get_file_id(target), 0, buffer);
+				files++;
+				bytes += buffer.size();
+			}
+		} catch (std::runtime_error &e) {
+			std::cout << target << ": " << e.what() << '\n';
+			failed++;
+			// the content of a directory that wasn't created can't be copied
+			if (entry.is_directory())
+				it.disable_recursion_pending();
 		}
 	}
+	myfs.sync();
+	std::cout << "imported " << files << " files (" << bytes << " bytes) and "
+		<< dirs << " directories" << '\n';
+
+	return failed;
+}
+
+/**
+ * Print how many of the blocks and the inodes are used.
+ */
+static void print_usage(const MyFs::fs_stats &stats) {
+	std::cout << std::setw(10) << std::left << ""
+		<< std::setw(12) << std::right << "total"
+		<< std::setw(12) << "used"
+		<< std::setw(12) << "free" << '\n';
+	std::cout << std::setw(10) << std::left << "blocks"
+		<< std::setw(12) << std::right << stats.blocks
+		<< std::setw(12) << stats.blocks - stats.free_blocks
+		<< std::setw(12) << stats.free_blocks << '\n';
+	std::cout << std::setw(10) << std::left << "inodes"
+		<< std::setw(12) << std::right << stats.inodes
+		<< std::setw(12) << stats.inodes - stats.free_inodes
+		<< std::setw(12) << stats.free_inodes << '\n';
+	std::cout << "block size: " << stats.block_size << " bytes" << '\n';
+}
+
+/**
+ * Print the counters of every operation that was called, and of the cache.
+ */
+static void print_stats(const CachedBlockDevice *cache) {
+	std::cout << std::setw(20) << std::left << "operation"
+		<< std::setw(10) << std::right << "calls"
+		<< std::setw(14) << "bytes"
+		<< std::setw(12) << "avg(us)"
+		<< std::setw(12) << "p50(us)"
+		<< std::setw(12) << "p99(us)" << '\n';
+	std::cout << std::fixed << std::setprecision(2);
+	for (const Stats::Metric &metric : Stats::snapshot()) {
+		if (metric.calls == 0)
+			continue;
+		std::cout << std::setw(20) << std::left << metric.name
+			<< std::setw(10) << std::right << metric.calls
+			<< std::setw(14) << metric.bytes
+			<< std::setw(12) << metric.totalNs / 1000.0 / metric.calls
+			<< std::setw(12) << metric.percentile(0.5) / 1000.0
+			<< std::setw(12) << metric.percentile(0.99) / 1000.0 << '\n';
+	}
+	std::cout << std::defaultfloat;
+	if (cache) {
+		CachedBlockDevice::stats counters = cache->get_stats();
+		std::cout << "cache: " << counters.hits << " hits, "
+			<< counters.misses << " misses, "
+			<< counters.read_ahead << " pages read ahead, "
+			<< counters.write_backs << " write-backs, "
+			<< counters.evictions << " evictions" << '\n';
+	}
+	std::cout.flush();
 }
 
 int main(int argc, char **argv) {
 
-	if (argc != 2) {
+	uint64_t device_size = BlockDevice::DEFAULT_DEVICE_SIZE;
+	int block_size = MyFs::DEFAULT_BLOCK_SIZE;
+	std::string device_type = MMAP_DEVICE;
+	std::string cache_size;
+	std::unique_ptr<BlockDevice> blkdev;
+	std::unique_ptr<CachedBlockDevice> cache;
+	std::string option;
+	bool batch = false;
+
+	while (argc >= 2 && std::string(argv[1]).starts_with("--")) {
+		option = argv[1];
+		if (option.starts_with(DEVICE_OPTION))
+			device_type = option.substr(DEVICE_OPTION.size());
+		else if (option.starts_with(CACHE_OPTION))
+			cache_size = option.substr(CACHE_OPTION.size());
+		else if (option == BATCH_OPTION)
+			batch = true;
+		else
+			break;
+		argv++;
+		argc--;
+	}
+	if (argc < 2 || argc > 4) {
 		std::cerr << "Please provide the file to operate on" << std::endl;
+		std::cerr << "Usage: " << argv[0]
+			<< " [" << DEVICE_OPTION << "<type>] [" << CACHE_OPTION << "<size>] [" << BATCH_OPTION << "]"
+			<< " <file> [<device-size> [<block-size>]]" << std::endl;
+		std::cerr << "The sizes are only used when the file has to be created"
+			<< " or formatted, and accept a K, M or G suffix." << std::endl;
+		std::cerr << "The device type is " << MMAP_DEVICE << " (the default, maps the file), "
+			<< FILE_DEVICE << " (reads and writes the file explicitly) or "
+			<< RAM_DEVICE << " (ignores the file and keeps the device in memory)." << std::endl;
+		std::cerr << "With " << CACHE_OPTION << ", the recently used pages of the device"
+			<< " are cached in memory." << std::endl;
+		std::cerr << "With " << BATCH_OPTION << ", the commands are read from the input without"
+			<< " prompts, and the exit code is 1 if any of them failed." << std::endl;
+		return -1;
+	}
+	try {
+		if (argc >= 3)
+			device_size = parse_size(argv[2]);
+		if (argc == 4)
+			block_size = (int)parse_size(argv[3]);
+		blkdev = open_device(device_type, argv[1], device_size);
+		if (cache_size != "")
+			cache = std::make_unique<CachedBlockDevice>(blkdev.get(),
+				std::max<uint64_t>(parse_size(cache_size) / CachedBlockDevice::DEFAULT_PAGE_SIZE, 4));
+	} catch (std::logic_error &e) {
+		std::cerr << "Invalid argument: " << e.what() << std::endl;
 		return -1;
 	}
 
-	BlockDeviceSimulator *blkdevptr = new BlockDeviceSimulator(argv[1]);
-	MyFs myfs(blkdevptr);
+	// in batch mode the output is only flushed when the buffer fills or
+	// the program exits, instead of every time a line is read
+	if (batch) {
+		std::ios::sync_with_stdio(false);
+		std::cin.tie(nullptr);
+	}
+
+	MyFs myfs(cache ? cache.get() : blkdev.get(), block_size);
 	bool exit = false;
+	bool failed = false;
+	std::string cmdline;
 
-	std::cout << "Welcome to " << FS_NAME << std::endl;
-	std::cout << "To get help, please type 'help' on the prompt below." << std::endl;
-    std::cout << "\nPLEASE NOTE:\nRelative paths are not supported, every path should start with '/'." << std::endl;
-	std::cout << std::endl;
+	if (!batch) {
+		std::cout << "Welcome to " << FS_NAME << '\n';
+		std::cout << "To get help, please type 'help' on the prompt below." << '\n';
+		std::cout << "\nPLEASE NOTE:\nRelative paths are not supported, every path should start with '/'." << '\n';
+		std::cout << '\n';
+	}
 
 	while (!exit) {
 		try {
-			std::string cmdline;
-			std::cout << FS_NAME << "$ ";
-			std::getline(std::cin, cmdline, '\n');
+			if (!batch)
+				std::cout << FS_NAME << "$ ";
+			if (!std::getline(std::cin, cmdline, '\n'))
+				break;
 			if (cmdline == std::string(""))
 				continue;
 
@@ -90,59 +328,138 @@ int main(int argc, char **argv) {
 
 			if (cmd[0] == LIST_CMD) {
 				MyFs::dir_list dlist;
-				if (cmd.size() == 1)
+				if (cmd.size() == 1) {
 					dlist = myfs.list_dir("/");
-				else if (cmd.size() == 2)
+				} else if (cmd.size() == 2) {
 					dlist = myfs.list_dir(cmd[1]);
-				else
-					std::cout << LIST_CMD << ": one or zero arguments requested" << std::endl;
+				} else {
+					std::cout << LIST_CMD << ": one or zero arguments requested" << '\n';
+					failed = true;
+				}
 
 				for (size_t i=0; i < dlist.size(); i++) {
 					std::cout << std::setw(15) << std::left
 						<< dlist[i].name + (dlist[i].is_dir ? "/":"")
 						<< std::setw(10) << std::right
-						<< dlist[i].file_size << std::endl;
+						<< dlist[i].file_size << '\n';
 				}
 			} else if (cmd[0] == EXIT_CMD) {
 				exit = true;
 			} else if (cmd[0] == HELP_CMD) {
 				std::cout << HELP_STRING;
 			} else if (cmd[0] == CREATE_FILE_CMD) {
-				if (cmd.size() == 2)
+				if (cmd.size() == 2) {
 					myfs.create_file(cmd[1], false);
-				else
-					std::cout << CREATE_FILE_CMD << ": file path requested" << std::endl;
+				} else if (cmd.size() == 3 && cmd[2] == COMPRESSED_ARG) {
+					myfs.create_file(cmd[1], false, true);
+				} else {
+					std::cout << CREATE_FILE_CMD << ": file path and optionally '" << COMPRESSED_ARG
+						<< "' requested" << '\n';
+					failed = true;
+				}
 			} else if (cmd[0] == CONTENT_CMD) {
-				if (cmd.size() == 2)
-					std::cout << myfs.get_content(cmd[1]) << std::endl;
-				else
-					std::cout << CONTENT_CMD << ": file path requested" << std::endl;
+				if (cmd.size() == 2) {
+					std::cout << myfs.get_content(cmd[1]) << '\n';
+				} else {
+					std::cout << CONTENT_CMD << ": file path requested" << '\n';
+					failed = true;
+				}
 			} else if (cmd[0] == TREE_CMD) {
-				recursive_print(myfs, "");
+				print_tree(myfs, "/");
 			} else if (cmd[0] == EDIT_CMD) {
 				if (cmd.size() == 2) {
-					std::cout << "Enter new file content" << std::endl;
+					if (!batch)
+						std::cout << "Enter new file content" << '\n';
 					std::string content;
 					std::string curr_line;
-					std::getline(std::cin, curr_line);
-					while (curr_line != "") {
-						content += curr_line + "\n";
-						std::getline(std::cin, curr_line);
+					while (std::getline(std::cin, curr_line) && curr_line != "") {
+						content.append(curr_line);
+						content.push_back('\n');
 					}
 					myfs.set_content(cmd[1], content);
 				} else {
-					std::cout << EDIT_CMD << ": file path requested" << std::endl;
+					std::cout << EDIT_CMD << ": file path requested" << '\n';
+					failed = true;
+				}
+			} else if (cmd[0] == FORMAT_CMD) {
+				if (cmd.size() == 1) {
+					myfs.format(block_size);
+				} else if (cmd.size() == 2) {
+					myfs.format((int)parse_size(cmd[1]));
+				} else if (cmd.size() == 3 && cmd[2] == FORMAT_EAGER_ARG) {
+					myfs.format((int)parse_size(cmd[1]), false);
+				} else {
+					std::cout << FORMAT_CMD << ": a block size and '" << FORMAT_EAGER_ARG
+						<< "' or less arguments requested" << '\n';
+					failed = true;
+				}
+			} else if (cmd[0] == DF_CMD) {
+				print_usage(myfs.statfs());
+			} else if (cmd[0] == DEFRAG_CMD) {
+				if (cmd.size() == 1 || (cmd.size() == 2 && cmd[1] == DEFRAG_PACK_ARG)) {
+					MyFs::defrag_stats stats = myfs.defrag(cmd.size() == 2);
+
+					std::cout << std::fixed << std::setprecision(1)
+						<< "fragmentation: " << stats.fragmentation_before << "% -> "
+						<< stats.fragmentation_after << "%, moved " << stats.files_moved
+						<< " files (" << stats.blocks_moved << " blocks)" << std::defaultfloat << '\n';
+				} else {
+					std::cout << DEFRAG_CMD << ": zero arguments or '" << DEFRAG_PACK_ARG << "' requested" << '\n';
+					failed = true;
+				}
+			} else if (cmd[0] == IMPORT_CMD) {
+				if (cmd.size() == 3 || (cmd.size() == 4 && cmd[3] == COMPRESSED_ARG)) {
+					if (import_tree(myfs, cmd[1], cmd[2], cmd.size() == 4) != 0)
+						failed = true;
+				} else {
+					std::cout << IMPORT_CMD << ": host directory and path requested" << '\n';
+					failed = true;
+				}
+			} else if (cmd[0] == STATS_CMD) {
+				if (cmd.size() == 1) {
+					print_stats(cache.get());
+				} else if (cmd.size() == 2 && cmd[1] == STATS_RESET_ARG) {
+					Stats::reset();
+					if (cache)
+						cache->reset_stats();
+				} else {
+					std::cout << STATS_CMD << ": zero arguments or '" << STATS_RESET_ARG << "' requested" << '\n';
+					failed = true;
 				}
 			} else if (cmd[0] == CREATE_DIR_CMD) {
-				if (cmd.size() == 2)
+				if (cmd.size() == 2) {
 					myfs.create_file(cmd[1], true);
-				else
-					std::cout << CREATE_DIR_CMD << ": one argument requested" << std::endl;
+				} else {
+					std::cout << CREATE_DIR_CMD << ": one argument requested" << '\n';
+					failed = true;
+				}
+			} else if (cmd[0] == REMOVE_CMD) {
+				if (cmd.size() == 2) {
+					myfs.remove_file(cmd[1]);
+				} else {
+					std::cout << REMOVE_CMD << ": file path requested" << '\n';
+					failed = true;
+				}
+			} else if (cmd[0] == TRUNCATE_CMD) {
+				if (cmd.size() == 3) {
+					myfs.truncate(cmd[1], parse_size(cmd[2]));
+				} else {
+					std::cout << TRUNCATE_CMD << ": file path and size requested" << '\n';
+					failed = true;
+				}
 			} else {
-				std::cout << "unknown command: " << cmd[0] << std::endl;
+				std::cout << "unknown command: " << cmd[0] << '\n';
+				failed = true;
 			}
 		} catch (std::runtime_error &e) {
-			std::cout << e.what() << std::endl;
+			std::cout << e.what() << '\n';
+			failed = true;
+		} catch (std::logic_error &e) {
+			std::cout << "invalid argument: " << e.what() << '\n';
+			failed = true;
 		}
 	}
+	std::cout.flush();
+
+	return batch && failed ? 1 : 0;
 }
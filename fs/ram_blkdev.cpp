@@ -0,0 +1,33 @@
+#include <cstring>
+#include "ram_blkdev.h"
+#include "stats.h"
+
+RamBlockDevice::RamBlockDevice(uint64_t size) :
+		device_size(size), memory(new char[size]()) {
+}
+
+void RamBlockDevice::read(uint64_t addr, size_t size, char *ans) const {
+	static const int METRIC = Stats::metric("ram.read");
+	Stats::Timer timer(METRIC, size);
+
+	memcpy(ans, memory.get() + addr, size);
+}
+
+void RamBlockDevice::write(uint64_t addr, size_t size, const char* data) {
+	static const int METRIC = Stats::metric("ram.write");
+	Stats::Timer timer(METRIC, size);
+
+	memcpy(memory.get() + addr, data, size);
+}
+
+const char* RamBlockDevice::view(uint64_t addr, size_t size) const {
+	return memory.get() + addr;
+}
+
+void RamBlockDevice::sync(uint64_t addr, size_t size) {
+	// there's nowhere to store the data
+}
+
+uint64_t RamBlockDevice::size() const {
+	return device_size;
+}
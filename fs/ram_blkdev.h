@@ -0,0 +1,33 @@
+#ifndef __RAM_BLKDEV_H__
+#define __RAM_BLKDEV_H__
+
+#include <memory>
+#include "blkdev.h"
+
+/**
+ * A block device that is only kept in memory, and is lost when it is
+ * destroyed. Useful for benchmarks, where it measures the file system
+ * without any I/O.
+ */
+class RamBlockDevice : public BlockDevice {
+public:
+	/**
+	 * Create a device that is filled with null bytes.
+	 */
+	explicit RamBlockDevice(uint64_t size = DEFAULT_DEVICE_SIZE);
+
+	void read(uint64_t addr, size_t size, char* ans) const override;
+	void write(uint64_t addr, size_t size, const char* data) override;
+	const char* view(uint64_t addr, size_t size) const override;
+
+	using BlockDevice::sync;
+	void sync(uint64_t addr, size_t size) override;
+
+	uint64_t size() const override;
+
+private:
+	uint64_t device_size;
+	std::unique_ptr<char[]> memory;
+};
+
+#endif // __RAM_BLKDEV_H__
@@ -0,0 +1,231 @@
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+
+/**
+ * The counters of a metric in a single thread.
+ * Only the thread writes them, and other threads read them when the
+ * counters of all the threads are summed.
+ */
+struct ThreadMetric
+{
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> buckets[Stats::BUCKETS];
+};
+
+struct ThreadCounters
+{
+    ThreadMetric metrics[Stats::MAX_METRICS];
+};
+
+struct Registry
+{
+    std::mutex lock; // guards everything below
+    std::vector<std::string> names; // of every metric, by id
+    std::vector<const ThreadCounters*> threads; // the counters of the running threads
+    Stats::Metric exited[Stats::MAX_METRICS]{}; // the counts of the threads that exited
+    Stats::Metric baseline[Stats::MAX_METRICS]{}; // the counts at the last reset
+};
+
+Registry& registry()
+{
+    static Registry instance;
+
+    return instance;
+}
+
+/**
+ * Add one thread's counters of a metric to a sum.
+ */
+void addCounters(Stats::Metric& sum, const ThreadMetric& counters)
+{
+    sum.calls += counters.calls.load(std::memory_order_relaxed);
+    sum.bytes += counters.bytes.load(std::memory_order_relaxed);
+    sum.totalNs += counters.totalNs.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < Stats::BUCKETS; i++)
+    {
+        sum.buckets[i] += counters.buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Keeps the counters of a thread in the registry for as long as the thread
+ * runs, and keeps their counts once it exits.
+ */
+class ThreadRegistration
+{
+public:
+    ThreadRegistration() :
+            counters(new ThreadCounters())
+    {
+        std::lock_guard lock(registry().lock);
+
+        registry().threads.push_back(this->counters);
+    }
+
+    ~ThreadRegistration()
+    {
+        Registry& instance = registry();
+        std::lock_guard lock(instance.lock);
+
+        for (size_t i = 0; i < Stats::MAX_METRICS; i++)
+        {
+            addCounters(instance.exited[i], this->counters->metrics[i]);
+        }
+        instance.threads.erase(std::find(instance.threads.begin(), instance.threads.end(), this->counters));
+        delete this->counters;
+    }
+
+    ThreadCounters* counters;
+};
+
+ThreadCounters& localCounters()
+{
+    thread_local ThreadRegistration registration;
+
+    return *registration.counters;
+}
+
+/**
+ * Add to a counter of the current thread.
+ * Only the current thread writes the counter, so it doesn't need an atomic
+ * addition.
+ */
+void add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * Sum the counters of a metric in every thread since the metric was
+ * registered.
+ * Note: must be called with the registry's lock held.
+ */
+Stats::Metric total(const Registry& instance, size_t metric)
+{
+    Stats::Metric sum = instance.exited[metric];
+
+    for (const ThreadCounters* counters : instance.threads)
+    {
+        addCounters(sum, counters->metrics[metric]);
+    }
+
+    return sum;
+}
+
+} // namespace
+
+uint64_t Stats::Metric::percentile(double fraction) const
+{
+    const uint64_t RANK = std::max<uint64_t>((uint64_t)std::ceil(fraction * this->calls), 1);
+    uint64_t seen{};
+
+    if (this->calls == 0)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        seen += this->buckets[i];
+        if (seen >= RANK)
+        {
+            return (uint64_t)1 << i;
+        }
+    }
+
+    // the counters of a thread may change while they are read, so the
+    // buckets can add up to a little less than the calls
+    return (uint64_t)1 << (BUCKETS - 1);
+}
+
+Stats::Timer::Timer(int metric, uint64_t bytes) :
+        _metric(metric), _bytes(bytes), _start(std::chrono::steady_clock::now())
+{
+}
+
+Stats::Timer::~Timer()
+{
+    const auto END = std::chrono::steady_clock::now();
+
+    Stats::record(this->_metric,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(END - this->_start).count(),
+                  this->_bytes);
+}
+
+void Stats::Timer::setBytes(uint64_t bytes)
+{
+    this->_bytes = bytes;
+}
+
+int Stats::metric(std::string_view name)
+{
+    Registry& instance = registry();
+    std::lock_guard lock(instance.lock);
+    const auto FOUND = std::find(instance.names.begin(), instance.names.end(), name);
+
+    if (FOUND != instance.names.end())
+    {
+        return (int)(FOUND - instance.names.begin());
+    }
+    if (instance.names.size() == MAX_METRICS)
+    {
+        throw std::runtime_error("Error: too many metrics");
+    }
+    instance.names.emplace_back(name);
+
+    return (int)instance.names.size() - 1;
+}
+
+void Stats::record(int metric, uint64_t ns, uint64_t bytes)
+{
+    ThreadMetric& counters = localCounters().metrics[metric];
+
+    add(counters.calls, 1);
+    add(counters.bytes, bytes);
+    add(counters.totalNs, ns);
+    add(counters.buckets[std::min<size_t>(std::bit_width(ns), BUCKETS - 1)], 1);
+}
+
+std::vector<Stats::Metric> Stats::snapshot()
+{
+    Registry& instance = registry();
+    std::lock_guard lock(instance.lock);
+    std::vector<Metric> metrics(instance.names.size());
+
+    for (size_t i = 0; i < metrics.size(); i++)
+    {
+        const Metric& BASELINE = instance.baseline[i];
+
+        metrics[i] = total(instance, i);
+        metrics[i].name = instance.names[i];
+        metrics[i].calls -= BASELINE.calls;
+        metrics[i].bytes -= BASELINE.bytes;
+        metrics[i].totalNs -= BASELINE.totalNs;
+        for (size_t bucket = 0; bucket < BUCKETS; bucket++)
+        {
+            metrics[i].buckets[bucket] -= BASELINE.buckets[bucket];
+        }
+    }
+
+    return metrics;
+}
+
+void Stats::reset()
+{
+    Registry& instance = registry();
+    std::lock_guard lock(instance.lock);
+
+    for (size_t i = 0; i < instance.names.size(); i++)
+    {
+        instance.baseline[i] = total(instance, i);
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Counters and latency histograms of the operations of the file system and
+ * its devices, which are cheap enough to always be on.
+ * Every thread counts in a copy of the counters of its own, which only that
+ * thread writes to, so counting doesn't need a lock or an atomic
+ * read-modify-write. The copies of all the threads are summed when the
+ * counters are read, and the counts of threads that exit are kept.
+ * The counters are global to the process, and every metric is identified by
+ * a name such as "myfs.get_content" or "mmap.read".
+ */
+class Stats
+{
+public:
+    /**
+     * Latency buckets: bucket i counts the calls that took less than 2^i
+     * nanoseconds but at least 2^(i-1).
+     */
+    static constexpr size_t BUCKETS = 64;
+
+    /**
+     * The maximal amount of metrics.
+     */
+    static constexpr size_t MAX_METRICS = 64;
+
+    /**
+     * The counters of a metric, since it was registered or since the last
+     * reset.
+     */
+    struct Metric
+    {
+        std::string name;
+        uint64_t calls;
+        uint64_t bytes; // the amount of data that the calls moved
+        uint64_t totalNs; // the time that the calls took together
+        uint64_t buckets[BUCKETS];
+
+        /**
+         * Get an upper bound of a latency percentile.
+         * @param fraction the percentile as a fraction, e.g. 0.99.
+         * @return the latency in nanoseconds that at least that part of the
+         *         calls took less than, or 0 if there were no calls.
+         */
+        uint64_t percentile(double fraction) const;
+    };
+
+    /**
+     * Measures a call from its construction until its destruction.
+     */
+    class Timer
+    {
+    public:
+        /**
+         * @param metric the id of the metric the call is counted in.
+         * @param bytes the amount of data that the call moves.
+         */
+        explicit Timer(int metric, uint64_t bytes = 0);
+        ~Timer();
+
+        /**
+         * Set the amount of data that the call moved, if it's only known
+         * at the end of the call.
+         */
+        void setBytes(uint64_t bytes);
+
+    private:
+        int _metric;
+        uint64_t _bytes;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    /**
+     * Get the id of a metric, registering it if it wasn't registered yet.
+     * Registering takes a lock, so the id should be looked up once and kept.
+     * @param name the name of the metric.
+     * @return the id of the metric.
+     */
+    static int metric(std::string_view name);
+
+    /**
+     * Count a call.
+     * @param metric the id of the metric.
+     * @param ns the time that the call took.
+     * @param bytes the amount of data that the call moved.
+     */
+    static void record(int metric, uint64_t ns, uint64_t bytes);
+
+    /**
+     * Read the counters of every registered metric.
+     * @return the metrics, in the order they were registered.
+     */
+    static std::vector<Metric> snapshot();
+
+    /**
+     * Restart the counting of every metric from 0.
+     */
+    static void reset();
+};
+
+#endif // __STATS_H__
@@ -36,7 +36,7 @@ xorriso -as mkisofs                                             \
 target/limine/limine-deploy $KERNEL.iso
 
 # Run the created image with QEMU.
-qemu-system-x86_64 -d int -D log.txt -m 1G $2 \
+qemu-system-x86_64 -d int -D log.txt -m 1G -smp 4 $2 \
     -machine q35 -cpu qemu64 -M smm=off \
     -D target/log.txt -d int,guest_errors -no-reboot -no-shutdown \
     -serial stdio \
@@ -0,0 +1,83 @@
+use super::io;
+use crate::{memory, scheduler};
+use x86_64::structures::idt::InterruptStackFrame;
+use x86_64::PhysAddr;
+
+const APIC_BASE_MSR: u32 = 0x1b;
+/// The bits of the `APIC_BASE` MSR that hold the physical address of the registers.
+const APIC_BASE_ADDRESS: u64 = 0xf_ffff_f000;
+
+// The offsets of the registers of the local APIC.
+const END_OF_INTERRUPT: u64 = 0xb0;
+const SPURIOUS_INTERRUPT_VECTOR: u64 = 0xf0;
+const LVT_TIMER: u64 = 0x320;
+const TIMER_INITIAL_COUNT: u64 = 0x380;
+const TIMER_DIVIDE_CONFIGURATION: u64 = 0x3e0;
+
+const APIC_SOFTWARE_ENABLE: u32 = 1 << 8;
+const TIMER_PERIODIC: u32 = 1 << 17;
+const TIMER_DIVIDE_BY_16: u32 = 0x3;
+/// The timer ticks at the speed of the bus divided by 16, so with a 1GHz bus, which is what QEMU
+/// emulates, it fires about 19 times a second like the PIT.
+const TIMER_COUNT: u32 = 3_290_000;
+
+/// The interrupt vectors of the local APIC.
+pub const TIMER_HANDLER: u8 = 0x30;
+pub const SPURIOUS_HANDLER: u8 = 0xff;
+
+/// Returns the physical address of the registers of the local APIC.
+fn base() -> u64 {
+    io::rdmsr(APIC_BASE_MSR) & APIC_BASE_ADDRESS
+}
+
+/// Returns a pointer to a register of the local APIC of the current processor.
+///
+/// # Arguments
+/// - `offset` - The offset of the register.
+fn register(offset: u64) -> *mut u32 {
+    (memory::HHDM_OFFSET + base() + offset) as *mut u32
+}
+
+/// Map the registers of the local APIC so that the processors can access them.
+/// All the processors have their registers at the same address.
+pub fn map() -> Result<(), memory::vmm::MapError> {
+    memory::map_device_page(PhysAddr::new(base()))
+}
+
+/// Enable the local APIC of the current processor and start its timer.
+///
+/// # Safety
+/// The registers must be mapped with `map`, and the handlers of the timer and the spurious
+/// interrupts must be loaded in the IDT.
+pub unsafe fn start_timer() {
+    register(SPURIOUS_INTERRUPT_VECTOR)
+        .write_volatile(APIC_SOFTWARE_ENABLE | u32::from(SPURIOUS_HANDLER));
+    register(TIMER_DIVIDE_CONFIGURATION).write_volatile(TIMER_DIVIDE_BY_16);
+    register(LVT_TIMER).write_volatile(TIMER_PERIODIC | u32::from(TIMER_HANDLER));
+    register(TIMER_INITIAL_COUNT).write_volatile(TIMER_COUNT);
+}
+
+/// Save the context of the process that the processor runs, if it runs one.
+unsafe fn save_context(frame: &InterruptStackFrame) {
+    // The processor has no process if it is idle.
+    if let Some(curr) = scheduler::get_running_process().as_mut() {
+        curr.instruction_pointer = frame.instruction_pointer.as_u64();
+        curr.stack_pointer = frame.stack_pointer.as_u64();
+        curr.flags = frame.cpu_flags;
+    }
+}
+
+pub unsafe extern "C" fn timer_handler(frame: &InterruptStackFrame) {
+    save_context(frame);
+    scheduler::switch_current_process();
+    register(END_OF_INTERRUPT).write_volatile(0);
+    scheduler::load_from_queue();
+}
+
+/// Spurious interrupts are not acknowledged, and the processor continues as after a tick of the
+/// timer.
+pub unsafe extern "C" fn spurious_handler(frame: &InterruptStackFrame) {
+    save_context(frame);
+    scheduler::switch_current_process();
+    scheduler::load_from_queue();
+}
@@ -1,3 +1,4 @@
+use super::scheduler::{self, MAX_CPUS};
 use bitflags::bitflags;
 use x86_64::VirtAddr;
 
@@ -7,9 +8,16 @@ pub const KERNEL_CODE: u16 = 0x28;
 pub const KERNEL_DATA: u16 = 0x30;
 pub const USER_CODE: u16 = 0x38;
 pub const USER_DATA: u16 = 0x40;
+/// The selector of the TSS of the first processor, the TSS of every other processor follows the
+/// TSS of the processor before it.
 pub const TSS: u16 = 0x48;
+pub const TSS_DESCRIPTOR_SIZE: u16 = 16;
+const ENTRY_SIZE: u16 = 8;
 
-static mut GDT: [u64; 11] = [0; 11];
+const GDT_ENTRIES: usize =
+    (TSS + TSS_DESCRIPTOR_SIZE * MAX_CPUS as u16) as usize / ENTRY_SIZE as usize;
+
+static mut GDT: [u64; GDT_ENTRIES] = [0; GDT_ENTRIES];
 
 #[repr(packed)]
 #[allow(unused)]
@@ -127,18 +135,14 @@ impl SystemSegmentDescriptor {
     }
 }
 
-/// Create the GDT with the required segments.
+/// Create the GDT with the required segments and a TSS for every processor.
 pub fn create() {
-    let tss_segment = SystemSegmentDescriptor::new(
-        super::scheduler::get_tss_address(),
-        core::mem::size_of::<super::scheduler::TaskStateSegment>() as u32 - 1,
-        AccessByte::PRESENT | AccessByte::TYPE_TSS,
-        Flags::empty(),
-    );
+    let mut tss_segment;
+    let mut index;
 
     // The 16 bit and 32 bit code and data segments are needed to use limine's terminal.
     unsafe {
-        GDT = [
+        GDT[..(TSS / ENTRY_SIZE) as usize].copy_from_slice(&[
             // NULL descriptor.
             UserSegmentDescriptor::zeros().bits(),
             // 16 bit code segment.
@@ -221,10 +225,20 @@ pub fn create() {
                 Flags::GRANULARITY_4KIB | Flags::LONG_MODE,
             )
             .bits(),
-            // Task State Segment
-            tss_segment.low.bits(),
-            tss_segment.base_high as u64,
-        ]
+        ]);
+    }
+    for cpu in 0..MAX_CPUS {
+        tss_segment = SystemSegmentDescriptor::new(
+            scheduler::get_tss_address(cpu),
+            core::mem::size_of::<scheduler::TaskStateSegment>() as u32 - 1,
+            AccessByte::PRESENT | AccessByte::TYPE_TSS,
+            Flags::empty(),
+        );
+        index = ((TSS + cpu as u16 * TSS_DESCRIPTOR_SIZE) / ENTRY_SIZE) as usize;
+        unsafe {
+            GDT[index] = tss_segment.low.bits();
+            GDT[index + 1] = tss_segment.base_high as u64;
+        }
     }
 }
 
@@ -147,11 +147,12 @@ pub fn read_char() -> Option<char> {
 }
 
 pub unsafe extern "C" fn handler(frame: &x86_64::structures::idt::InterruptStackFrame) {
-    let p = scheduler::get_running_process().as_mut().unwrap();
-
-    p.stack_pointer = frame.stack_pointer.as_u64();
-    p.instruction_pointer = frame.instruction_pointer.as_u64();
-    p.flags = frame.cpu_flags;
+    // The processor has no process if it is idle.
+    if let Some(p) = scheduler::get_running_process().as_mut() {
+        p.stack_pointer = frame.stack_pointer.as_u64();
+        p.instruction_pointer = frame.instruction_pointer.as_u64();
+        p.flags = frame.cpu_flags;
+    }
 
     if let Some(input) = read_char() {
         key_handle(input);
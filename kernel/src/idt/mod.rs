@@ -1,6 +1,7 @@
 pub mod keyboard;
 mod macros;
 
+use crate::apic::{self, spurious_handler, timer_handler as apic_timer_handler};
 use crate::pit::pit_handler;
 use crate::syscalls::int_0x80_handler as syscall_handler;
 use crate::{interrupt_handler, print, println, scheduler};
@@ -65,6 +66,22 @@ lazy_static! {
             )
             .set_stack_index(1),
         );
+        idt.set_handler_entry(
+            apic::TIMER_HANDLER,
+            *Entry::new(
+                SegmentSelector::new(crate::gdt::KERNEL_CODE / 8, PrivilegeLevel::Ring0),
+                interrupt_handler!(apic_timer_handler => apic_timer_save_context) as u64,
+            )
+            .set_stack_index(1),
+        );
+        idt.set_handler_entry(
+            apic::SPURIOUS_HANDLER,
+            *Entry::new(
+                SegmentSelector::new(crate::gdt::KERNEL_CODE / 8, PrivilegeLevel::Ring0),
+                interrupt_handler!(spurious_handler => spurious_save_context) as u64,
+            )
+            .set_stack_index(1),
+        );
         idt.set_handler_entry(
             SYSCALL_HANDLER,
             *Entry::new(
@@ -177,7 +194,19 @@ impl Idt {
         self.0[index as usize] = handler;
     }
 
+    /// Initialize the PICs and load the IDT to the bootstrap processor.
     pub fn load(&'static self) {
+        unsafe {
+            let mut pics = PICS.lock();
+
+            pics.initialize();
+            pics.write_masks(0, 0);
+        }
+        self.load_to_processor();
+    }
+
+    /// Load the IDT to the current processor, without initializing the PICs again.
+    pub fn load_to_processor(&'static self) {
         use core::mem::size_of;
 
         unsafe {
@@ -185,10 +214,7 @@ impl Idt {
                 base: VirtAddr::new_unsafe(self as *const _ as u64),
                 limit: (size_of::<Self>() - 1) as u16,
             };
-            let mut pics = PICS.lock();
 
-            pics.initialize();
-            pics.write_masks(0, 0);
             x86_64::instructions::tables::lidt(&ptr)
         };
     }
@@ -214,12 +240,24 @@ unsafe fn double_fault_handler(stack_frame: &InterruptStackFrame) -> ! {
     loop {}
 }
 
+/// Load a page of the executable of a process that the process accessed for the first time.
+/// The page is read from the file system, so it is read under the lock of the syscalls.
+unsafe fn load_page(process: &scheduler::Process, address: VirtAddr) -> bool {
+    let _guard = crate::syscalls::KERNEL_LOCK.lock();
+
+    process.load_page(address)
+}
+
 unsafe fn page_fault_handler(
     stack_frame: &InterruptStackFrame,
     error_code: PageFaultErrorCode,
 ) -> ! {
     let curr = crate::scheduler::get_running_process().as_mut().unwrap();
     let pfault_address = x86_64::registers::control::Cr2::read();
+    // The processor pushes an error code after the interrupt stack frame of a page fault and the
+    // handler gets the stack pointer, so the frame starts after the error code.
+    let frame = &*((stack_frame as *const InterruptStackFrame as *const u64).add(1)
+        as *const InterruptStackFrame);
 
     if pfault_address <= curr.stack_start()
         && pfault_address >= (curr.stack_start() - scheduler::MAX_STACK_SIZE)
@@ -245,6 +283,13 @@ unsafe fn page_fault_handler(
         }
 
         crate::scheduler::load_from_queue();
+    } else if frame.code_segment & 3 == 3 && load_page(curr, pfault_address) {
+        // The page was a part of the executable that the process hasn't accessed yet, so the
+        // process performs the access again.
+        curr.instruction_pointer = frame.instruction_pointer.as_u64();
+        curr.stack_pointer = frame.stack_pointer.as_u64();
+        curr.flags = frame.cpu_flags;
+        scheduler::load_context(curr);
     } else {
         crate::memory::load_tables_to_cr3(crate::memory::get_page_table());
         println!("============");
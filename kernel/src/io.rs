@@ -82,3 +82,24 @@ pub fn wrmsr(msr: u32, data: u64) {
         ", in("ecx")msr, in("edx")high, in("eax")low);
     }
 }
+
+/// Read from a Model Specific Register.
+///
+/// # Arguments
+/// - `msr` - The model specific register to read from.
+///
+/// # Returns
+/// The data in the register.
+#[inline]
+pub fn rdmsr(msr: u32) -> u64 {
+    let low: u64;
+    let high: u64;
+
+    unsafe {
+        asm!("
+        rdmsr
+        ", in("ecx")msr, out("edx")high, out("eax")low);
+    }
+
+    (high << 32) | low
+}
@@ -14,15 +14,18 @@ use alloc::vec::Vec;
 use fs_rs::fs::{self, FsError};
 use limine::LimineFramebufferRequest;
 
+mod apic;
 mod gdt;
 mod idt;
 mod io;
 mod iostream;
 mod memory;
 mod mutex;
+mod pipe;
 mod pit;
 mod queue;
 mod scheduler;
+mod smp;
 mod syscalls;
 mod terminal;
 
@@ -65,7 +68,8 @@ pub unsafe fn initialize_everything() {
     gdt::create();
     gdt::activate();
     fs::init();
-    scheduler::load_tss();
+    // The kernel runs on the bootstrap processor, whose index is 0.
+    scheduler::load_tss(0);
     idt::IDT.load();
     syscalls::initialize();
     pit::start(19);
@@ -127,6 +131,9 @@ pub extern "C" fn _start() -> ! {
         print_logo();
         add_processes().expect("failed to add executables");
         println!("Welcome to YehudaOS!");
+        // The bootstrap processor is preempted by the PIT and the other processors by the timers
+        // of their local APICs.
+        smp::start();
         scheduler::load_from_queue();
     }
 }
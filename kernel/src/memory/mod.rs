@@ -13,6 +13,9 @@ use x86_64::{
 
 pub const KERNEL_ADDRESS: u64 = 0xffff_ffff_8000_0000;
 pub const HHDM_OFFSET: u64 = 0xffff_8000_0000_0000;
+/// The part of the address space of user processes that files are mapped into.
+pub const MMAP_START: u64 = 0x5555_0000_0000;
+pub const MMAP_END: u64 = 0x6555_0000_0000;
 
 pub static MEMMAP: LimineMemmapRequest = LimineMemmapRequest::new(0);
 pub static mut PAGE_TABLE: PhysAddr = PhysAddr::zero();
@@ -67,6 +70,27 @@ fn get_last_phys_addr() -> u64 {
     last_entry.base + last_entry.len
 }
 
+/// Map a page of device memory, such as the registers of the local APIC, to the higher half
+/// direct map, unless the direct map already covers it.
+///
+/// # Arguments
+/// - `address` - The physical address of the page.
+pub fn map_device_page(address: PhysAddr) -> Result<(), vmm::MapError> {
+    if address.as_u64() < get_last_phys_addr() {
+        return Ok(());
+    }
+
+    vmm::map_address(
+        unsafe { PAGE_TABLE },
+        VirtAddr::new(HHDM_OFFSET + address.as_u64()),
+        PhysFrame::<Size4KiB>::containing_address(address),
+        PageTableFlags::GLOBAL
+            | PageTableFlags::PRESENT
+            | PageTableFlags::WRITABLE
+            | PageTableFlags::NO_CACHE,
+    )
+}
+
 /// Map a memmap entry to a virtual address.
 ///
 /// # Arguments
@@ -1,38 +1,47 @@
+use crate::mutex::Mutex;
 use limine::LimineMemoryMapEntryType;
 use x86_64::{
+    instructions::interrupts,
     structures::paging::{PageSize, PhysFrame, Size4KiB},
     PhysAddr,
 };
 
-static mut FREE_LIST_START: *mut FreePageNode = core::ptr::null_mut();
+static FREE_LIST: Mutex<FreeList> = Mutex::new(FreeList {
+    start: core::ptr::null_mut(),
+});
 
 struct FreePageNode {
     pub next: *mut FreePageNode,
 }
 
+struct FreeList {
+    start: *mut FreePageNode,
+}
+
+// SAFETY: The free pages are only accessed while the lock of the list is held.
+unsafe impl Send for FreeList {}
+
 /// Returns the address of a newly allocated physical page, or None if there are no free pages.
 pub fn allocate() -> Option<PhysFrame> {
-    let free_page;
+    // The interrupts are disabled so that the processor isn't switched to a process that
+    // allocates while the lock is held.
+    interrupts::without_interrupts(|| {
+        let mut free_list = FREE_LIST.lock();
+        let free_page;
 
-    // SAFETY: the kernel is not multithreaded.
-    if unsafe { FREE_LIST_START.is_null() } {
-        return None;
-    } else {
-        // SAFETY: the kernel is not multithreaded.
-        free_page = unsafe {
-            PhysFrame::from_start_address(PhysAddr::new(
-                FREE_LIST_START as u64 - super::HHDM_OFFSET,
-            ))
-            // UNWRAP: Freed pages are always 4KiB aligned
-            .unwrap()
-        };
+        if free_list.start.is_null() {
+            return None;
+        }
+        free_page = PhysFrame::from_start_address(PhysAddr::new(
+            free_list.start as u64 - super::HHDM_OFFSET,
+        ))
+        // UNWRAP: Freed pages are always 4KiB aligned
+        .unwrap();
         // SAFETY: if the first free page is invalid a page fault was already triggered.
-        unsafe {
-            FREE_LIST_START = (*FREE_LIST_START).next;
-        };
-    }
+        free_list.start = unsafe { (*free_list.start).next };
 
-    return Some(free_page);
+        Some(free_page)
+    })
 }
 
 /// Free a physical page that was previously allocated with `allocate`.
@@ -45,10 +54,14 @@ pub fn allocate() -> Option<PhysFrame> {
 pub unsafe fn free(address: PhysFrame) {
     let free_page = (super::HHDM_OFFSET + address.start_address().as_u64()) as *mut FreePageNode;
 
-    *free_page = FreePageNode {
-        next: FREE_LIST_START,
-    };
-    FREE_LIST_START = free_page;
+    interrupts::without_interrupts(|| {
+        let mut free_list = FREE_LIST.lock();
+
+        *free_page = FreePageNode {
+            next: free_list.start,
+        };
+        free_list.start = free_page;
+    });
 }
 
 /// Initialize the free pages list with the usable pages in limine's memmap and initialize the value
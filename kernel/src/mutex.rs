@@ -1,26 +1,24 @@
+use core::cell::UnsafeCell;
+use core::sync::atomic::{AtomicBool, Ordering};
+
+/// A spin lock that several processors can share.
 pub struct Mutex<T> {
-    value: T,
-    locked: bool,
+    value: UnsafeCell<T>,
+    locked: AtomicBool,
 }
 
 unsafe impl<T: Sized + Send> core::marker::Sync for Mutex<T> {}
 unsafe impl<T: Sized + Send> core::marker::Send for Mutex<T> {}
 
-#[derive(Debug)]
 pub struct MutexGuard<'a, T> {
-    value: &'a mut T,
-    locked: &'a mut bool,
-}
-
-fn get<T>(v: &T) -> *mut T {
-    v as *const T as *mut T
+    mutex: &'a Mutex<T>,
 }
 
 impl<T> Mutex<T> {
     pub const fn new(value: T) -> Self {
         Mutex {
-            value,
-            locked: false,
+            value: UnsafeCell::new(value),
+            locked: AtomicBool::new(false),
         }
     }
 
@@ -29,58 +27,31 @@ impl<T> Mutex<T> {
     /// # Returns
     /// Returns a mutex guard that unlocks the lock automatically when it goes out of scope.
     pub fn lock(&self) -> MutexGuard<T> {
-        unsafe {
-            core::arch::asm!(
-                "
-            2:
-                mov rdx, 0
-                lock bts [{0}], rdx
-                jc 2b
-            ",
-            in(reg)get(&self.locked)
-            )
+        // Acquire ordering keeps the accesses to the value after the lock is taken.
+        while self
+            .locked
+            .compare_exchange_weak(false, true, Ordering::Acquire, Ordering::Relaxed)
+            .is_err()
+        {
+            core::hint::spin_loop();
         }
 
-        MutexGuard {
-            value: unsafe { &mut *get(&self.value) },
-            locked: unsafe { &mut *get(&self.locked) },
-        }
+        MutexGuard { mutex: self }
     }
 
     /// Try to lock and return a mutex guard if the lock was successfuly locked.
     pub fn try_lock(&self) -> Option<MutexGuard<T>> {
-        let mut locked = true;
-
-        unsafe {
-            core::arch::asm!(
-                "
-            mov rdx, 0
-            lock bts [{0}], rdx
-            jc 2f
-            jmp 3f
-            ",
-                in(reg)get(&self.locked),
-            );
-            core::arch::asm!("2:");
-            // If the carry flag is on the lock was already locked.
-            locked = false;
-            core::arch::asm!("3:");
-        }
-
-        if locked {
-            Some(MutexGuard {
-                value: unsafe { &mut *get(&self.value) },
-                locked: unsafe { &mut *get(&self.locked) },
-            })
-        } else {
-            None
-        }
+        self.locked
+            .compare_exchange(false, true, Ordering::Acquire, Ordering::Relaxed)
+            .ok()
+            .map(|_| MutexGuard { mutex: self })
     }
 }
 
 impl<'a, T> Drop for MutexGuard<'a, T> {
     fn drop(&mut self) {
-        *self.locked = false;
+        // Release ordering keeps the accesses to the value before the lock is released.
+        self.mutex.locked.store(false, Ordering::Release);
     }
 }
 
@@ -88,12 +59,14 @@ impl<'a, T> core::ops::Deref for MutexGuard<'a, T> {
     type Target = T;
 
     fn deref(&self) -> &Self::Target {
-        self.value
+        // SAFETY: The guard holds the lock, so no one else accesses the value.
+        unsafe { &*self.mutex.value.get() }
     }
 }
 
 impl<'a, T> core::ops::DerefMut for MutexGuard<'a, T> {
     fn deref_mut(&mut self) -> &mut Self::Target {
-        self.value
+        // SAFETY: The guard holds the lock, so no one else accesses the value.
+        unsafe { &mut *self.mutex.value.get() }
     }
 }
@@ -0,0 +1,217 @@
+use alloc::{boxed::Box, collections::BTreeMap};
+use x86_64::instructions::interrupts;
+
+use crate::mutex::Mutex;
+
+/// The amount of bytes a pipe can hold, and the maximal size of a write to a pipe.
+pub const PIPE_CAPACITY: usize = 4096;
+/// The file descriptors of pipes start here, so they don't collide with the file descriptors of
+/// files, which are the ids of the files.
+const PIPE_DESCRIPTOR_START: i32 = 0x4000_0000;
+
+/// The pipes are used by the syscalls of all the processors, and released by the terminator,
+/// which runs with interrupts enabled, so the lock is always taken with interrupts disabled.
+static PIPES: Mutex<Pipes> = Mutex::new(Pipes {
+    pipes: BTreeMap::new(),
+    next_id: 0,
+});
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+pub enum End {
+    Read,
+    Write,
+}
+
+pub enum Transfer {
+    /// The amount of bytes that were transferred.
+    Bytes(usize),
+    /// The pipe is empty or full, and the other end is still open.
+    WouldBlock,
+    /// The other end of the pipe is closed.
+    Closed,
+}
+
+/// A bounded ring buffer that one process writes into and another reads from.
+struct Pipe {
+    buffer: Box<[u8; PIPE_CAPACITY]>,
+    start: usize,
+    len: usize,
+    readers: usize,
+    writers: usize,
+}
+
+struct Pipes {
+    /// The open pipes, by their id.
+    pipes: BTreeMap<usize, Pipe>,
+    next_id: usize,
+}
+
+/// Create a pipe whose ends are both open once.
+///
+/// # Returns
+/// The file descriptors of the read end and the write end.
+pub fn create() -> (i32, i32) {
+    let buffer = Box::new([0; PIPE_CAPACITY]);
+    let id = interrupts::without_interrupts(|| {
+        let mut pipes = PIPES.lock();
+        let id = pipes.next_id;
+
+        pipes.next_id += 1;
+        pipes.pipes.insert(
+            id,
+            Pipe {
+                buffer,
+                start: 0,
+                len: 0,
+                readers: 1,
+                writers: 1,
+            },
+        );
+
+        id
+    });
+
+    (descriptor(id, End::Read), descriptor(id, End::Write))
+}
+
+/// Get the file descriptor of an end of a pipe.
+fn descriptor(id: usize, end: End) -> i32 {
+    PIPE_DESCRIPTOR_START + (id * 2) as i32 + (end == End::Write) as i32
+}
+
+/// Get the end of a pipe that a file descriptor refers to.
+///
+/// # Returns
+/// The id of the pipe and the end, or `None` if `fd` is not the file descriptor of a pipe.
+pub fn from_descriptor(fd: i32) -> Option<(usize, End)> {
+    let index;
+
+    if fd < PIPE_DESCRIPTOR_START {
+        return None;
+    }
+    index = (fd - PIPE_DESCRIPTOR_START) as usize;
+
+    Some((
+        index / 2,
+        if index % 2 == 0 {
+            End::Read
+        } else {
+            End::Write
+        },
+    ))
+}
+
+/// Open an end of an existing pipe once more, for a process that inherits it.
+pub fn acquire(fd: i32) {
+    if let Some((id, end)) = from_descriptor(fd) {
+        interrupts::without_interrupts(|| {
+            if let Some(pipe) = PIPES.lock().pipes.get_mut(&id) {
+                match end {
+                    End::Read => pipe.readers += 1,
+                    End::Write => pipe.writers += 1,
+                }
+            }
+        });
+    }
+}
+
+/// Close an end of a pipe once. The pipe is destroyed when both of its ends are closed.
+pub fn release(fd: i32) {
+    let mut destroyed = None;
+
+    if let Some((id, end)) = from_descriptor(fd) {
+        interrupts::without_interrupts(|| {
+            let mut pipes = PIPES.lock();
+
+            if let Some(pipe) = pipes.pipes.get_mut(&id) {
+                match end {
+                    End::Read => pipe.readers -= 1,
+                    End::Write => pipe.writers -= 1,
+                }
+                if pipe.readers == 0 && pipe.writers == 0 {
+                    destroyed = pipes.pipes.remove(&id);
+                }
+            }
+        });
+    }
+    // The buffer is freed after the lock is released, so the lock is held for less time.
+    drop(destroyed);
+}
+
+/// Read bytes from a pipe.
+///
+/// # Arguments
+/// - `fd` - The file descriptor of the read end.
+/// - `buf` - The buffer to read into, a maximum of `buf.len()` bytes will be read.
+///
+/// # Returns
+/// The amount of bytes that were read, `WouldBlock` if the pipe is empty, `Closed` if the pipe
+/// is empty and its write end is closed, or `None` if `fd` is not the read end of a pipe.
+///
+pub fn read(fd: i32, buf: &mut [u8]) -> Option<Transfer> {
+    let (id, end) = from_descriptor(fd)?;
+
+    interrupts::without_interrupts(|| read_locked(PIPES.lock().pipes.get_mut(&id)?, end, buf))
+}
+
+/// Read bytes from a pipe while holding the lock of the pipes.
+fn read_locked(pipe: &mut Pipe, end: End, buf: &mut [u8]) -> Option<Transfer> {
+    let count = core::cmp::min(buf.len(), pipe.len);
+
+    if end != End::Read {
+        return None;
+    }
+
+    if count == 0 && !buf.is_empty() {
+        return Some(if pipe.writers == 0 {
+            Transfer::Closed
+        } else {
+            Transfer::WouldBlock
+        });
+    }
+    for byte in buf[..count].iter_mut() {
+        *byte = pipe.buffer[pipe.start];
+        pipe.start = (pipe.start + 1) % PIPE_CAPACITY;
+    }
+    pipe.len -= count;
+
+    Some(Transfer::Bytes(count))
+}
+
+/// Write bytes to a pipe.
+/// The bytes are written together once there's room for all of them, so that writes of
+/// different processes don't interleave.
+///
+/// # Arguments
+/// - `fd` - The file descriptor of the write end.
+/// - `buf` - The data to write, at most `PIPE_CAPACITY` bytes.
+///
+/// # Returns
+/// The amount of bytes that were written, `WouldBlock` if there's no room for them, `Closed` if
+/// the read end of the pipe is closed, or `None` if `fd` is not the write end of a pipe or `buf`
+/// is too large.
+///
+pub fn write(fd: i32, buf: &[u8]) -> Option<Transfer> {
+    let (id, end) = from_descriptor(fd)?;
+
+    interrupts::without_interrupts(|| write_locked(PIPES.lock().pipes.get_mut(&id)?, end, buf))
+}
+
+/// Write bytes to a pipe while holding the lock of the pipes.
+fn write_locked(pipe: &mut Pipe, end: End, buf: &[u8]) -> Option<Transfer> {
+    if end != End::Write || buf.len() > PIPE_CAPACITY {
+        return None;
+    }
+    if pipe.readers == 0 {
+        return Some(Transfer::Closed);
+    }
+    if PIPE_CAPACITY - pipe.len < buf.len() {
+        return Some(Transfer::WouldBlock);
+    }
+    for byte in buf {
+        pipe.buffer[(pipe.start + pipe.len) % PIPE_CAPACITY] = *byte;
+        pipe.len += 1;
+    }
+
+    Some(Transfer::Bytes(buf.len()))
+}
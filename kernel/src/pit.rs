@@ -25,11 +25,12 @@ pub unsafe fn start(tps: u32) {
 }
 
 pub unsafe extern "C" fn pit_handler(frame: &InterruptStackFrame) {
-    let curr = scheduler::get_running_process().as_mut().unwrap();
-
-    curr.instruction_pointer = frame.instruction_pointer.as_u64();
-    curr.stack_pointer = frame.stack_pointer.as_u64();
-    curr.flags = frame.cpu_flags;
+    // The processor has no process if it is idle.
+    if let Some(curr) = scheduler::get_running_process().as_mut() {
+        curr.instruction_pointer = frame.instruction_pointer.as_u64();
+        curr.stack_pointer = frame.stack_pointer.as_u64();
+        curr.flags = frame.cpu_flags;
+    }
 
     scheduler::switch_current_process();
     super::idt::PICS.lock().notify_end_of_interrupt(0x20);
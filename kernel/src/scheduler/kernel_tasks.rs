@@ -1,5 +1,5 @@
 use super::MAX_STACK_SIZE;
-use alloc::string::String;
+use alloc::{collections::BTreeMap, string::String, vec::Vec};
 use x86_64::{
     structures::paging::{PageSize, PageTableFlags, PhysFrame, Size4KiB},
     PhysAddr, VirtAddr,
@@ -113,6 +113,13 @@ impl super::Process {
                 PhysAddr::zero(),
                 false,
             )),
+            mmap_next: memory::MMAP_START,
+            mappings: BTreeMap::new(),
+            stdin: 0,
+            stdout: 1,
+            pipes: Vec::new(),
+            image: None,
+            segments: Vec::new(),
         };
 
         memory::vmm::map_address(
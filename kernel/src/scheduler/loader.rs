@@ -6,11 +6,13 @@ use core::{
 use super::{Process, SchedulerError};
 use crate::memory;
 use crate::memory::allocator;
-use alloc::{string::String, vec::Vec};
+use crate::mutex::Mutex;
+use alloc::{collections::BTreeMap, string::String, vec::Vec};
 use fs_rs::fs;
 use x86_64::{
+    instructions::{interrupts, tlb},
     registers::control::Cr3,
-    structures::paging::{PageSize, PageTableFlags, Size4KiB},
+    structures::paging::{PageSize, PageTableFlags, PhysFrame, Size4KiB},
     VirtAddr,
 };
 
@@ -23,6 +25,8 @@ const PROCESS_STACK_POINTER: u64 = 0x7000_0000_0000;
 
 const EI_NIDENT: usize = 16;
 const PT_LOAD: u32 = 1;
+/// The flag of a writable segment.
+const PF_W: u32 = 2;
 
 #[repr(C)]
 #[derive(Default)]
@@ -103,72 +107,99 @@ fn get_program_table(file_id: u64, header: &ElfEhdr) -> alloc::vec::Vec<ElfPhdr>
     }
 }
 
-/// Map a segment to a process' address space.
-///
-///  # Arguments
-/// - `p` - The process' struct.
-/// - `segment` - The segment to map.
-fn map_segment(p: &Process, segment: &ElfPhdr) -> Result<(), SchedulerError> {
-    let flags =
-        PageTableFlags::PRESENT | PageTableFlags::USER_ACCESSIBLE | PageTableFlags::WRITABLE;
-    let mut mapped = 0;
-    let mut page;
-
-    while mapped < segment.p_memsz {
-        page = memory::page_allocator::allocate().ok_or(SchedulerError::OutOfMemory)?;
-        // The page table should not be null because it is returned from the `create_page_table`
-        // function.
-        // If the file is valid, the virtual address should not be already used.
-        // We map a 4KiB page and we don't use the `HUGE_PAGE` flag.
-        memory::vmm::map_address(
-            p.page_table,
-            VirtAddr::new(segment.p_vaddr + mapped),
-            page,
-            flags,
-        )
-        .map_err(|_| SchedulerError::OutOfMemory)?;
-        mapped += Size4KiB::SIZE;
+/// A segment of an executable, whose pages are loaded from the file the first time the process
+/// accesses them.
+pub struct Segment {
+    start: u64,
+    end: u64,
+    file_offset: u64,
+    file_size: u64,
+    writable: bool,
+}
+
+impl Segment {
+    /// Returns `true` if the segment covers a part of a page.
+    ///
+    /// # Arguments
+    /// - `page` - The address of the page.
+    fn overlaps(&self, page: u64) -> bool {
+        self.start < page + Size4KiB::SIZE && page < self.end
     }
+}
 
-    Ok(())
+/// The executables that are running and the pages they share.
+struct Images {
+    /// The amount of processes that run every executable, by its file ID.
+    running: BTreeMap<usize, usize>,
+    /// The pages of the read-only segments of executables, by the file ID and the address of the
+    /// page.
+    /// The pages are shared by the processes that run the executable, and are freed when the last
+    /// of them exits.
+    pages: BTreeMap<(usize, u64), PhysFrame>,
 }
 
-/// Write a segment to the process' memory.
+static IMAGES: Mutex<Images> = Mutex::new(Images {
+    running: BTreeMap::new(),
+    pages: BTreeMap::new(),
+});
+
+/// Free the pages that are kept for an executable.
 ///
 /// # Arguments
-/// - `file_id` - The ELF file of the process.
-/// - `p` - The process' struct.
-/// - `segment` - The segment to write.
-///
-/// # Panics
-/// Panic if the segment has not yet been mapped into the process' address space.
+/// - `images` - The locked images.
+/// - `file_id` - The ID of the executable.
 ///
 /// # Safety
-/// This function is unsafe because it assumes the segment has been loaded to memory correctly.
-unsafe fn write_segment(file_id: u64, p: &Process, segment: &ElfPhdr) {
-    let mut address;
-    let mut buffer;
-    let mut to_write = segment.p_memsz;
-
-    loop {
-        // UNWRAP: The page table is not null and we
-        // panic if the segment has not been mapped to memory.
-        address = memory::vmm::virtual_to_physical(p.page_table, VirtAddr::new(segment.p_vaddr))
-            .unwrap()
-            .as_u64();
-        buffer = core::slice::from_raw_parts_mut(
-            (address + memory::HHDM_OFFSET) as *mut u8,
-            core::cmp::min(to_write, Size4KiB::SIZE) as usize,
-        );
+/// No process may map the pages of the executable.
+unsafe fn free_pages(images: &mut Images, file_id: usize) {
+    let pages = images
+        .pages
+        .range((file_id, 0)..=(file_id, u64::MAX))
+        .map(|(key, _)| *key)
+        .collect::<Vec<_>>();
 
-        fs::read(file_id as usize, buffer, segment.p_offset as usize);
+    for key in pages {
+        // UNWRAP: The key was just found.
+        memory::page_allocator::free(images.pages.remove(&key).unwrap());
+    }
+}
 
-        if to_write <= Size4KiB::SIZE {
-            return;
-        }
+/// Returns `true` if a process runs an executable, and then the executable must not be modified
+/// or removed because the pages that the process hasn't accessed yet are still loaded from it.
+///
+/// # Arguments
+/// - `file_id` - The ID of the file.
+pub fn is_running(file_id: usize) -> bool {
+    interrupts::without_interrupts(|| IMAGES.lock().running.contains_key(&file_id))
+}
 
-        to_write -= Size4KiB::SIZE;
-    }
+/// Count a process that runs an executable.
+fn start_running(file_id: usize) {
+    interrupts::without_interrupts(|| *IMAGES.lock().running.entry(file_id).or_insert(0) += 1)
+}
+
+/// Stop counting a process that ran an executable, and free the pages of the executable when the
+/// last process that ran it exits.
+///
+/// # Arguments
+/// - `file_id` - The ID of the executable.
+///
+/// # Safety
+/// The process must have unmapped the pages of the executable.
+pub(super) unsafe fn stop_running(file_id: usize) {
+    // Processes are dropped by the terminator, which runs with interrupts enabled.
+    interrupts::without_interrupts(|| {
+        let mut images = IMAGES.lock();
+
+        if let Some(count) = images.running.get_mut(&file_id) {
+            *count -= 1;
+            if *count == 0 {
+                images.running.remove(&file_id);
+                // SAFETY: No process runs the executable so no process maps its pages.
+                unsafe { free_pages(&mut images, file_id) };
+            }
+        }
+    })
 }
 
 /// Allocate memory in a process' heap.
@@ -277,15 +308,34 @@ impl super::Process {
                 page_table,
                 true,
             )),
+            mmap_next: memory::MMAP_START,
+            mappings: BTreeMap::new(),
+            stdin: 0,
+            stdout: 1,
+            pipes: Vec::new(),
+            image: Some(file_id as usize),
+            segments: Vec::new(),
         };
 
+        start_running(file_id as usize);
         p.registers.rdi = argv.len() as u64;
         p.registers.rsi = write_args(&p, argv)? as u64;
 
+        // The segments are only mapped when they're accessed, so a process doesn't wait for and
+        // doesn't take memory for the parts of the executable it doesn't use.
         for entry in &get_program_table(file_id, &header) {
-            if entry.p_type == PT_LOAD {
-                map_segment(&p, entry)?;
-                write_segment(file_id, &p, entry);
+            if entry.p_type == PT_LOAD && entry.p_memsz != 0 {
+                p.segments.push(Segment {
+                    start: entry.p_vaddr,
+                    end: entry
+                        .p_vaddr
+                        .checked_add(entry.p_memsz)
+                        .filter(|end| *end <= PROCESS_STACK_POINTER - super::MAX_STACK_SIZE)
+                        .ok_or(SchedulerError::InvalidExecutable)?,
+                    file_offset: entry.p_offset,
+                    file_size: core::cmp::min(entry.p_filesz, entry.p_memsz),
+                    writable: entry.p_flags & PF_W != 0,
+                });
             }
         }
         // The page table is not null because we check it in `create_page_table`.
@@ -302,4 +352,120 @@ impl super::Process {
 
         Ok(p)
     }
+
+    /// Returns `true` if a page of the process is one of the pages of its executable that are
+    /// shared with the other processes that run it, which are the pages that only read-only
+    /// segments cover.
+    ///
+    /// # Arguments
+    /// - `page` - The address of the page.
+    pub fn is_shared_page(&self, page: u64) -> bool {
+        let mut covered = false;
+
+        for segment in &self.segments {
+            if segment.overlaps(page) {
+                if segment.writable {
+                    return false;
+                }
+                covered = true;
+            }
+        }
+
+        covered
+    }
+
+    /// Map a page of the process' executable that the process accesses for the first time.
+    /// The read-only pages are shared by all the processes that run the executable, and the
+    /// other pages are copied for the process.
+    ///
+    /// # Arguments
+    /// - `address` - An address in the page.
+    ///
+    /// # Returns
+    /// `true` if the page has been mapped, or `false` if it is not a part of the executable, is
+    /// already mapped or there is not enough memory.
+    ///
+    /// # Safety
+    /// The interrupts must be disabled.
+    pub unsafe fn load_page(&self, address: VirtAddr) -> bool {
+        let page = address.align_down(Size4KiB::SIZE).as_u64();
+        let mut flags = PageTableFlags::PRESENT | PageTableFlags::USER_ACCESSIBLE;
+        let image;
+        let frame;
+
+        if let Some(file_id) = self.image {
+            image = file_id;
+        } else {
+            return false;
+        }
+        if !self.segments.iter().any(|segment| segment.overlaps(page))
+            || memory::vmm::virtual_to_physical(self.page_table, VirtAddr::new(page)).is_ok()
+        {
+            return false;
+        }
+
+        if self.is_shared_page(page) {
+            let mut images = IMAGES.lock();
+
+            if let Some(cached) = images.pages.get(&(image, page)) {
+                frame = *cached;
+            } else if let Some(read) = self.read_page(page) {
+                images.pages.insert((image, page), read);
+                frame = read;
+            } else {
+                return false;
+            }
+        } else if let Some(read) = self.read_page(page) {
+            flags |= PageTableFlags::WRITABLE;
+            frame = read;
+        } else {
+            return false;
+        }
+        if memory::vmm::map_address(self.page_table, VirtAddr::new(page), frame, flags).is_err() {
+            if flags.contains(PageTableFlags::WRITABLE) {
+                memory::page_allocator::free(frame);
+            }
+
+            return false;
+        }
+        tlb::flush(VirtAddr::new(page));
+
+        true
+    }
+
+    /// Read a page of the process' executable into a new physical page.
+    /// The parts of the page that the segments don't cover, and the parts of the segments that
+    /// are not in the file, are zeroed.
+    ///
+    /// # Arguments
+    /// - `page` - The address of the page.
+    ///
+    /// # Returns
+    /// The physical page or `None` if there is not enough memory.
+    unsafe fn read_page(&self, page: u64) -> Option<PhysFrame> {
+        let frame = memory::page_allocator::allocate()?;
+        let content = core::slice::from_raw_parts_mut(
+            (frame.start_address().as_u64() + memory::HHDM_OFFSET) as *mut u8,
+            Size4KiB::SIZE as usize,
+        );
+        let mut start;
+        let mut end;
+
+        content.fill(0);
+        for segment in &self.segments {
+            start = core::cmp::max(page, segment.start);
+            end = core::cmp::min(page + Size4KiB::SIZE, segment.start + segment.file_size);
+            // The range is empty if the segment doesn't cover the page.
+            if start < end {
+                fs::read(
+                    // UNWRAP: Only the processes of executables have segments.
+                    self.image.unwrap(),
+                    &mut content[(start - page) as usize..(end - page) as usize],
+                    (segment.file_offset + start - segment.start) as usize,
+                );
+            }
+        }
+
+        Some(frame)
+    }
 }
@@ -1,13 +1,15 @@
 use super::memory;
 use crate::memory::allocator::{Allocator, Locked};
 use crate::mutex::Mutex;
-use crate::{io, syscalls};
-use alloc::collections::{BTreeMap, LinkedList};
+use crate::{io, pipe, syscalls};
+use alloc::collections::{BTreeMap, BTreeSet, LinkedList};
 use alloc::string::String;
+use alloc::vec::Vec;
 use core::arch::asm;
 use core::fmt;
 use fs_rs::fs;
 use x86_64::{
+    instructions::interrupts,
     structures::paging::{PageSize, PhysFrame, Size4KiB},
     PhysAddr, VirtAddr,
 };
@@ -16,6 +18,8 @@ mod kernel_tasks;
 mod loader;
 pub mod terminator;
 
+pub use loader::is_running;
+
 pub const MAX_STACK_SIZE: u64 = 1024 * 20; // 20KiB
 const KERNEL_CODE_SEGMENT: u16 = super::gdt::KERNEL_CODE;
 const KERNEL_DATA_SEGMENT: u16 = super::gdt::KERNEL_DATA;
@@ -23,11 +27,12 @@ const USER_CODE_SEGMENT: u16 = super::gdt::USER_CODE | 3;
 const USER_DATA_SEGMENT: u16 = super::gdt::USER_DATA | 3;
 const INTERRUPT_FLAG_ON: u64 = 0x200;
 
-static mut CURR_PROC: Option<Process> = None;
-static mut RUNNING_QUEUE: LinkedList<Process> = LinkedList::new();
-static mut WAITING_QUEUE: BTreeMap<i64, (Process, *mut i32)> = BTreeMap::new();
+/// The maximal amount of processors that the scheduler runs processes on.
+pub const MAX_CPUS: usize = 8;
 
-static mut TSS_ENTRY: TaskStateSegment = TaskStateSegment {
+const NO_PROCESS: Option<Process> = None;
+const EMPTY_QUEUE: Mutex<LinkedList<Process>> = Mutex::new(LinkedList::new());
+const EMPTY_TSS: TaskStateSegment = TaskStateSegment {
     reserved0: 0,
     rsp0: 0,
     rsp1: 0,
@@ -44,16 +49,66 @@ static mut TSS_ENTRY: TaskStateSegment = TaskStateSegment {
     reserved3: 0,
     io_permission_bitmap: 0,
 };
+const EMPTY_REGISTERS: Registers = Registers {
+    rax: 0,
+    rbx: 0,
+    rcx: 0,
+    rdx: 0,
+    rsi: 0,
+    rdi: 0,
+    rbp: 0,
+    r8: 0,
+    r9: 0,
+    r10: 0,
+    r11: 0,
+    r12: 0,
+    r13: 0,
+    r14: 0,
+    r15: 0,
+};
+
+/// The process that every processor runs, only accessed by its processor.
+static mut CURR_PROCS: [Option<Process>; MAX_CPUS] = [NO_PROCESS; MAX_CPUS];
+/// The processes that are ready to run on every processor.
+/// A processor whose queue is empty steals processes from the queues of the other processors.
+static RUN_QUEUES: [Mutex<LinkedList<Process>>; MAX_CPUS] = [EMPTY_QUEUE; MAX_CPUS];
+static mut PROCESS_TABLE: Mutex<ProcessTable> = Mutex::new(ProcessTable {
+    alive: BTreeSet::new(),
+    waiting: BTreeMap::new(),
+});
+
+/// The amount of mappings of every file that processes have mapped with `mmap`, by its file ID.
+static MAPPED_FILES: Mutex<BTreeMap<usize, usize>> = Mutex::new(BTreeMap::new());
+
+static mut TSS_ENTRIES: [TaskStateSegment; MAX_CPUS] = [EMPTY_TSS; MAX_CPUS];
+/// The interrupt handlers save the registers of the interrupted process to the `gs` base, and a
+/// processor that has no process to run points it here instead.
+static mut IDLE_REGISTERS: [Registers; MAX_CPUS] = [EMPTY_REGISTERS; MAX_CPUS];
+
+/// The processes that haven't exited and the processes that wait for them.
+/// The two are kept under a single lock so that a child can't exit between its parent checking
+/// that it exists and the parent waiting for it.
+struct ProcessTable {
+    /// The IDs of the user processes that haven't exited.
+    alive: BTreeSet<i64>,
+    /// The processes that are waiting for a child process to exit, by the ID of the child, with
+    /// a buffer for the exit code of the child.
+    waiting: BTreeMap<i64, (Process, *mut i32)>,
+}
 
 #[derive(Debug)]
 pub enum SchedulerError {
     OutOfMemory,
+    InvalidExecutable,
 }
 
 impl fmt::Display for SchedulerError {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         match *self {
             SchedulerError::OutOfMemory => write!(f, "not enough memory to create a process"),
+            SchedulerError::InvalidExecutable => {
+                write!(f, "the executable has a segment outside the user's memory")
+            }
         }
     }
 }
@@ -110,20 +165,42 @@ pub struct Process {
     cwd: usize,
     kernel_task: bool,
     allocator: Locked<Allocator>,
+    mmap_next: u64,
+    /// The files that the process has mapped, by the start of the mapping, with the amount of
+    /// pages in the mapping and the ID of the file.
+    mappings: BTreeMap<u64, (u64, usize)>,
+    stdin: i32,
+    stdout: i32,
+    pipes: Vec<i32>,
+    /// The file ID of the executable that the process runs, `None` for kernel tasks.
+    image: Option<usize>,
+    segments: Vec<loader::Segment>,
 }
 
 impl Drop for Process {
     fn drop(&mut self) {
+        // Processes are dropped by the terminator, which runs with interrupts enabled, so the
+        // interrupts are disabled to not be switched out while holding the lock.
+        interrupts::without_interrupts(|| unsafe { PROCESS_TABLE.lock().alive.remove(&self.pid) });
+        for fd in &self.pipes {
+            pipe::release(*fd);
+        }
         if self.kernel_task {
             kernel_tasks::deallocate_stack(self.stack_pointer);
         } else {
             memory::vmm::page_table_walker(self.page_table, &|virt, physical| {
                 if virt.as_u64() < memory::HHDM_OFFSET {
                     memory::vmm::unmap_address(self.page_table, virt).unwrap();
-                    unsafe {
-                        memory::page_allocator::free(PhysFrame::from_start_address_unchecked(
-                            physical,
-                        ))
+                    // The pages of mapped files belong to the file system, and the shared pages of
+                    // the executable are kept for the next processes that run it.
+                    if !(memory::MMAP_START..memory::MMAP_END).contains(&virt.as_u64())
+                        && !self.is_shared_page(virt.as_u64())
+                    {
+                        unsafe {
+                            memory::page_allocator::free(PhysFrame::from_start_address_unchecked(
+                                physical,
+                            ))
+                        }
                     }
                 }
             });
@@ -134,6 +211,14 @@ impl Drop for Process {
                 ))
             }
         }
+        for (_, file_id) in self.mappings.values() {
+            stop_mapping(*file_id);
+        }
+        // The shared pages of the executable can only be freed once they're unmapped.
+        if let Some(image) = self.image {
+            // SAFETY: The pages of the process have been unmapped.
+            unsafe { loader::stop_running(image) };
+        }
     }
 }
 
@@ -170,9 +255,150 @@ impl Process {
     pub const fn allocator(&self) -> &Locked<Allocator> {
         &self.allocator
     }
+
+    /// The file descriptor that the standard input of the process reads from, which is either
+    /// the standard input of the terminal or the read end of a pipe.
+    pub const fn stdin(&self) -> i32 {
+        self.stdin
+    }
+
+    /// The file descriptor that the standard output of the process writes to, which is either
+    /// the standard output of the terminal or the write end of a pipe.
+    pub const fn stdout(&self) -> i32 {
+        self.stdout
+    }
+
+    /// Returns `true` if the process has an end of a pipe open.
+    ///
+    /// # Arguments
+    /// - `fd` - The file descriptor of the end.
+    pub fn has_pipe(&self, fd: i32) -> bool {
+        self.pipes.contains(&fd)
+    }
+
+    /// Give the process an end of a pipe that has been opened for it.
+    ///
+    /// # Arguments
+    /// - `fd` - The file descriptor of the end.
+    pub fn add_pipe(&mut self, fd: i32) {
+        self.pipes.push(fd);
+    }
+
+    /// Close an end of a pipe that the process has open.
+    ///
+    /// # Arguments
+    /// - `fd` - The file descriptor of the end.
+    ///
+    /// # Returns
+    /// `false` if the process doesn't have the end open.
+    pub fn close_pipe(&mut self, fd: i32) -> bool {
+        if let Some(index) = self.pipes.iter().position(|pipe| *pipe == fd) {
+            self.pipes.swap_remove(index);
+            pipe::release(fd);
+
+            true
+        } else {
+            false
+        }
+    }
+
+    /// Set the standard input and output of the process, opening the ends of the pipes they
+    /// refer to for the process.
+    ///
+    /// # Arguments
+    /// - `stdin` - The standard input of the terminal or the read end of a pipe.
+    /// - `stdout` - The standard output of the terminal or the write end of a pipe.
+    pub fn redirect(&mut self, stdin: i32, stdout: i32) {
+        for fd in [stdin, stdout] {
+            if pipe::from_descriptor(fd).is_some() {
+                pipe::acquire(fd);
+                self.pipes.push(fd);
+            }
+        }
+        self.stdin = stdin;
+        self.stdout = stdout;
+    }
+
+    /// Reserve a range of the address space of the process to map a file into.
+    /// The ranges are never reused.
+    ///
+    /// # Arguments
+    /// - `pages` - The amount of pages in the range.
+    ///
+    /// # Returns
+    /// The start of the range or `None` if the address space for mapped files is full.
+    pub fn reserve_mapping(&mut self, pages: u64) -> Option<VirtAddr> {
+        let start = self.mmap_next;
+        let end = start.checked_add(pages.checked_mul(Size4KiB::SIZE)?)?;
+
+        if end > memory::MMAP_END {
+            return None;
+        }
+        self.mmap_next = end;
+
+        Some(VirtAddr::new(start))
+    }
+
+    /// Count a file that has been mapped into a range of the address space of the process.
+    ///
+    /// # Arguments
+    /// - `start` - The start of the range.
+    /// - `pages` - The amount of pages in the range.
+    /// - `file_id` - The ID of the file.
+    pub fn add_mapping(&mut self, start: VirtAddr, pages: u64, file_id: usize) {
+        interrupts::without_interrupts(|| *MAPPED_FILES.lock().entry(file_id).or_insert(0) += 1);
+        self.mappings.insert(start.as_u64(), (pages, file_id));
+    }
+
+    /// Stop counting a file that the process has mapped.
+    ///
+    /// # Arguments
+    /// - `start` - The start of the mapping.
+    /// - `pages` - The amount of pages in the mapping.
+    ///
+    /// # Returns
+    /// `false` if the process has no mapping of this size at this address.
+    pub fn remove_mapping(&mut self, start: VirtAddr, pages: u64) -> bool {
+        match self.mappings.get(&start.as_u64()) {
+            Some(&(size, file_id)) if size == pages => {
+                self.mappings.remove(&start.as_u64());
+                stop_mapping(file_id);
+
+                true
+            }
+            _ => false,
+        }
+    }
 }
 
-/// Returns a new process ID.
+/// Stop counting a mapping of a file.
+///
+/// # Arguments
+/// - `file_id` - The ID of the file.
+fn stop_mapping(file_id: usize) {
+    // Processes are dropped by the terminator, which runs with interrupts enabled.
+    interrupts::without_interrupts(|| {
+        let mut mapped = MAPPED_FILES.lock();
+
+        if let Some(count) = mapped.get_mut(&file_id) {
+            *count -= 1;
+            if *count == 0 {
+                mapped.remove(&file_id);
+            }
+        }
+    })
+}
+
+/// Returns `true` if a process has mapped a file, and then the file must not be truncated or
+/// removed because its blocks would be given to another file while they're mapped.
+///
+/// # Arguments
+/// - `file_id` - The ID of the file.
+pub fn is_mapped(file_id: usize) -> bool {
+    interrupts::without_interrupts(|| MAPPED_FILES.lock().contains_key(&file_id))
+}
+
+/// Returns a new process ID and adds it to the processes that haven't exited.
 /// Assumes that no more than 2 ^ 63 processes will ever be created.
 fn allocate_pid() -> i64 {
     static PID_COUNTER: Mutex<i64> = Mutex::new(0);
@@ -180,136 +406,192 @@ fn allocate_pid() -> i64 {
     let pid = *counter;
 
     *counter += 1;
+    // SAFETY: The interrupts are disabled while a process is created.
+    unsafe { PROCESS_TABLE.lock().alive.insert(pid) };
 
     pid
 }
 
-/// Get the `rsp0` field from the TSS.
-pub fn get_kernel_stack() -> u64 {
-    unsafe { TSS_ENTRY.rsp0 }
+/// Returns the index of the processor that runs the code.
+/// The index is known from the selector of the TSS that the processor has loaded, which is
+/// cheaper to read than the ID of the local APIC, and is 0 before a TSS is loaded.
+pub fn cpu_id() -> usize {
+    let selector: u16;
+
+    // SAFETY: Reading the task register has no side effects.
+    unsafe { asm!("str {0:x}", out(reg)selector) };
+
+    (selector.saturating_sub(super::gdt::TSS) / super::gdt::TSS_DESCRIPTOR_SIZE) as usize
 }
 
-/// Returns a mutable reference to the currently running process.
-///
-/// # Safety
-/// Should not be used in a multi-threaded situation.
-pub unsafe fn get_running_process() -> &'static mut Option<Process> {
-    &mut CURR_PROC
+/// Get the `rsp0` field from the TSS of the current processor.
+pub fn get_kernel_stack() -> u64 {
+    unsafe { TSS_ENTRIES[cpu_id()].rsp0 }
 }
 
-/// Searches for a process in the different queues.
-///
-/// # Arguments
-/// - `pid` - The process ID of the process to search.
-///
-/// # Returns
-/// `true` if the process was found and `false` if it wasn't.
+/// Returns a mutable reference to the process that the current processor runs.
 ///
 /// # Safety
-/// Should not be used in a multi-threaded situation.
-pub unsafe fn search_process(pid: i64) -> bool {
-    let queues = [&RUNNING_QUEUE];
-
-    for queue in queues {
-        for element in queue {
-            if element.pid() == pid {
-                return true;
-            }
-        }
-    }
-    for element in WAITING_QUEUE.values() {
-        if element.0.pid() == pid {
-            return true;
-        }
-    }
-
-    false
+/// The reference must not be kept after the processor switches to another process.
+pub unsafe fn get_running_process() -> &'static mut Option<Process> {
+    &mut CURR_PROCS[cpu_id()]
 }
 
-/// Add a process to the waiting processes.
+/// Add a process to the waiting processes, if the process it waits for hasn't exited.
 /// The waiting processes are processes who are waiting for a child process to terminate.
 /// A process will not continue its execution as long as it is in the waiting processes.
 ///
 /// # Arguments
 /// - `pid` - The process ID of the process to wait for.
-/// The function assumes the process exist.
 /// - `parent` - The process who's waiting.
 /// - `wstatus` - A buffer for the future child process' exit code.
 ///
+/// # Returns
+/// The parent back if the process doesn't exist, has already exited or is already waited for.
+///
 /// # Safety
-/// - `wstatus` must be valid for writes.
-/// - Should not be used in a multi-threaded situation.
-pub unsafe fn wait_for(pid: i64, parent: Process, wstatus: *mut i32) {
-    WAITING_QUEUE.insert(pid, (parent, wstatus));
+/// `wstatus` must be valid for writes.
+pub unsafe fn wait_for(pid: i64, parent: Process, wstatus: *mut i32) -> Result<(), Process> {
+    let mut table = PROCESS_TABLE.lock();
+
+    if !table.alive.contains(&pid) || table.waiting.contains_key(&pid) {
+        return Err(parent);
+    }
+    table.waiting.insert(pid, (parent, wstatus));
+
+    Ok(())
 }
 
-/// Notify a waiting parent of the termination of its child, if it exists.
+/// Remove a process that has exited from the processes that haven't exited, and notify its
+/// waiting parent of its termination, if it exists.
 ///
 /// # Arguments
 /// - `p` - The child process that has finished.
 /// - `status` - The exit code of the child process.
 ///
 /// # Safety
-/// Should not be used in a multi-threaded situation.
+/// The interrupts must be disabled.
 pub unsafe fn stop_waiting_for(p: &Process, status: i32) {
-    if let Some(parent) = WAITING_QUEUE.remove(&p.pid()) {
+    let parent;
+
+    {
+        let mut table = PROCESS_TABLE.lock();
+
+        table.alive.remove(&p.pid());
+        parent = table.waiting.remove(&p.pid());
+    }
+    if let Some(parent) = parent {
         memory::load_tables_to_cr3(parent.0.page_table);
-        add_to_the_queue(parent.0);
         *parent.1 = status;
+        add_to_the_queue(parent.0);
     }
 }
 
-/// function that push process into the process queue
+/// function that push process into the queue of the current processor
 ///
 /// # Arguments
 /// - `p` - the process
 ///
 /// # Safety
-/// Should not be used in a multi-threaded situation.
+/// The interrupts must be disabled.
 pub unsafe fn add_to_the_queue(p: Process) {
-    RUNNING_QUEUE.push_back(p);
+    RUN_QUEUES[cpu_id()].lock().push_back(p);
 }
 
 /// Re-add the current process to the process queue and set the current process to `None`.
 ///
 /// # Safety
-/// Should not be used in a multi-threaded situation.
+/// The interrupts must be disabled.
 pub unsafe fn switch_current_process() {
-    if let Some(proc) = core::mem::replace(&mut CURR_PROC, None) {
+    if let Some(proc) = core::mem::replace(get_running_process(), None) {
         add_to_the_queue(proc);
     }
 }
 
-/// Load a process from the queue.
+/// Take a process from the queue of another processor.
+/// The process is taken from the back of the longest queue, which is the process that would
+/// have waited there the longest, while the owner of the queue keeps taking from the front.
 ///
-/// # Panics
-/// Panics if the process queue is empty.
-pub unsafe fn load_from_queue() -> ! {
-    let p = RUNNING_QUEUE
-        .pop_front()
-        .expect("No processes in the queue");
+/// # Arguments
+/// - `cpu` - The index of the current processor.
+///
+/// # Returns
+/// The process or `None` if the queues of all the other processors are empty.
+fn steal(cpu: usize) -> Option<Process> {
+    let mut victim = None;
+    let mut longest = 0;
+    let mut length;
+
+    for (other, queue) in RUN_QUEUES.iter().enumerate() {
+        if other != cpu {
+            length = queue.lock().len();
+            if length > longest {
+                longest = length;
+                victim = Some(other);
+            }
+        }
+    }
+
+    // The queue may have been emptied since it was checked, and then no process is stolen
+    // and the processor checks its own queue again the next time it switches.
+    RUN_QUEUES[victim?].lock().pop_back()
+}
 
-    if let Some(process) = &CURR_PROC {
-        add_to_the_queue(core::ptr::read(process))
+/// Wait for interrupts on a processor that has no process to run.
+/// The interrupt handlers don't return, so the processor continues from the handler of the
+/// next interrupt, which loads a process if one has been added to the queues in the meantime.
+///
+/// # Arguments
+/// - `cpu` - The index of the current processor.
+unsafe fn idle(cpu: usize) -> ! {
+    io::wrmsr(syscalls::GS_BASE, &IDLE_REGISTERS[cpu] as *const _ as u64);
+
+    loop {
+        asm!("sti; hlt; cli");
+    }
+}
+
+/// Load a process from the queue of the current processor, or from the queue of another
+/// processor if it is empty.
+/// If the queues are empty the processor keeps running its current process, or waits for the
+/// next interrupt if it doesn't have one.
+pub unsafe fn load_from_queue() -> ! {
+    let cpu = cpu_id();
+    // The lock of the queue must be released before stealing from the other queues, or two
+    // processors that steal from each other will wait for each other forever.
+    let local = RUN_QUEUES[cpu].lock().pop_front();
+
+    if let Some(p) = local.or_else(|| steal(cpu)) {
+        if let Some(process) = &CURR_PROCS[cpu] {
+            add_to_the_queue(core::ptr::read(process))
+        }
+        core::ptr::write(&mut CURR_PROCS[cpu], Some(p));
+    } else if CURR_PROCS[cpu].is_none() {
+        idle(cpu);
     }
-    core::ptr::write(&mut CURR_PROC, Some(p));
-    load_context(CURR_PROC.as_ref().unwrap());
+    load_context(CURR_PROCS[cpu].as_ref().unwrap());
 }
 
-/// Returns the address of the Task State Segment.
-pub fn get_tss_address() -> u64 {
-    unsafe { &TSS_ENTRY as *const _ as u64 }
+/// Returns the address of the Task State Segment of a processor.
+///
+/// # Arguments
+/// - `cpu` - The index of the processor.
+pub fn get_tss_address(cpu: usize) -> u64 {
+    unsafe { &TSS_ENTRIES[cpu] as *const _ as u64 }
 }
 
-/// Load kernel's stack pointer to the TSS and load the
-/// TSS segment selector to the task register.
+/// Load the current stack pointer to the TSS of the current processor as its kernel stack,
+/// and load the TSS segment selector to the task register.
+///
+/// # Arguments
+/// - `cpu` - The index of the processor that runs the function, must be less than `MAX_CPUS`.
 ///
 /// # Safety
 /// This function is unsafe because it requires a valid GDT with a TSS segment descriptor.
-pub unsafe fn load_tss() {
-    asm!("mov {0}, rsp", out(reg)TSS_ENTRY.rsp0);
-    asm!("mov {0}, rsp", out(reg)TSS_ENTRY.ist1);
-    asm!("ltr ax", in("ax")super::gdt::TSS);
+pub unsafe fn load_tss(cpu: usize) {
+    asm!("mov {0}, rsp", out(reg)TSS_ENTRIES[cpu].rsp0);
+    asm!("mov {0}, rsp", out(reg)TSS_ENTRIES[cpu].ist1);
+    asm!("ltr ax", in("ax")super::gdt::TSS + cpu as u16 * super::gdt::TSS_DESCRIPTOR_SIZE);
 }
 
 /// Start running a user process in ring 3.
@@ -1,4 +1,5 @@
 use alloc::collections::LinkedList;
+use x86_64::instructions::interrupts;
 
 use super::Process;
 use crate::mutex::Mutex;
@@ -12,14 +13,10 @@ pub unsafe fn add_to_queue(p: Process) {
 }
 
 pub extern "C" fn terminate_from_queue(_: *mut u64) -> i32 {
-    let mut q;
-
     loop {
-        q = TERMINATE_PROC_QUEUE.lock();
-
-        q.pop_front();
-
-        drop(q);
+        // The process is dropped with interrupts disabled, so that the terminator isn't switched
+        // out while it holds the locks that the syscalls on its processor take.
+        interrupts::without_interrupts(|| drop(TERMINATE_PROC_QUEUE.lock().pop_front()));
 
         // Call `sched_yield`.
         unsafe { core::arch::asm!("mov rax, 0x18; syscall") }
@@ -0,0 +1,58 @@
+use crate::scheduler::{self, MAX_CPUS};
+use crate::{apic, gdt, idt, memory, syscalls};
+use core::sync::atomic::{AtomicU64, Ordering};
+use limine::{LimineSmpInfo, LimineSmpRequest};
+
+static SMP: LimineSmpRequest = LimineSmpRequest::new(0);
+
+/// Start the application processors, so that they run processes from the queues together with
+/// the bootstrap processor.
+/// Only the first `MAX_CPUS` processors are used.
+///
+/// # Safety
+/// Must be called once, by the bootstrap processor after it has been initialized.
+pub unsafe fn start() {
+    let response = if let Some(response) = SMP.get_response().get() {
+        response
+    } else {
+        return;
+    };
+    // The bootstrap processor is the first processor.
+    let mut cpus = 1;
+    let mut info;
+
+    if apic::map().is_err() {
+        return;
+    }
+    for i in 0..response.cpu_count {
+        info = (*response.cpus.as_ptr().offset(i as isize)).as_ptr() as *mut LimineSmpInfo;
+
+        if (*info).lapic_id != response.bsp_lapic_id && cpus < MAX_CPUS {
+            core::ptr::addr_of_mut!((*info).extra_argument).write_volatile(cpus as u64);
+            // The processor jumps to the entry point once it is written, so it is written last
+            // and atomically.
+            (*(core::ptr::addr_of_mut!((*info).goto_address) as *const AtomicU64))
+                .store(processor_entry as usize as u64, Ordering::SeqCst);
+            cpus += 1;
+        }
+    }
+}
+
+/// The entry point of the application processors.
+///
+/// # Arguments
+/// - `info` - The information of limine about the processor, its `extra_argument` is the index of
+/// the processor.
+extern "C" fn processor_entry(info: *const LimineSmpInfo) -> ! {
+    unsafe {
+        let cpu = (*info).extra_argument as usize;
+
+        memory::load_tables_to_cr3(memory::get_page_table());
+        gdt::activate();
+        scheduler::load_tss(cpu);
+        idt::IDT.load_to_processor();
+        syscalls::initialize();
+        apic::start_timer();
+        scheduler::load_from_queue();
+    }
+}
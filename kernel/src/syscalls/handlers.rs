@@ -3,20 +3,28 @@ use core::alloc::{GlobalAlloc, Layout};
 use crate::{
     iostream::STDIN,
     memory::{self, allocator},
-    scheduler,
+    pipe, scheduler,
 };
 use alloc::{string::ToString, vec::Vec};
 use fs_rs::fs::{self, DirEntry};
+use x86_64::{
+    structures::paging::{PageSize, PageTableFlags, PhysFrame, Size4KiB},
+    PhysAddr, VirtAddr,
+};
 
 pub const READ: u64 = 0x0;
 pub const WRITE: u64 = 0x1;
 pub const OPEN: u64 = 0x2;
+pub const CLOSE: u64 = 0x3;
 pub const FSTAT: u64 = 0x5;
 pub const WAITPID: u64 = 0x7;
 pub const MALLOC: u64 = 0x9;
 pub const CALLOC: u64 = 0xa;
 pub const FREE: u64 = 0xb;
 pub const REALLOC: u64 = 0xc;
+pub const MMAP: u64 = 0xd;
+pub const MUNMAP: u64 = 0xe;
+pub const PIPE: u64 = 0x16;
 pub const SCHED_YIELD: u64 = 0x18;
 pub const EXEC: u64 = 0x3b;
 pub const EXIT: u64 = 0x3c;
@@ -27,6 +35,7 @@ pub const REMOVE_FILE: u64 = 0x57;
 pub const READ_DIR: u64 = 0x59;
 pub const TRUNCATE: u64 = 0x4c;
 pub const FTRUNCATE: u64 = 0x4d;
+pub const GETDENTS: u64 = 0x4e;
 
 const STDIN_DESCRIPTOR: i32 = 0;
 const STDOUT_DESCRIPTOR: i32 = 1;
@@ -39,6 +48,16 @@ pub struct Stat {
     directory: bool,
 }
 
+/// A directory entry together with the information that `fstat` returns about it.
+#[allow(unused)]
+#[repr(C)]
+pub struct Dirent {
+    name: [u8; fs::FILE_NAME_LEN],
+    id: usize,
+    size: u64,
+    directory: bool,
+}
+
 /// Get the current working directory.
 ///
 /// # Returns
@@ -151,6 +170,7 @@ pub unsafe fn exit(status: i32) -> i64 {
 }
 
 /// Remove a file from the file system, or remove a directory that must be empty.
+/// A file can't be removed while a process runs or maps it.
 ///
 /// # Arguments
 /// - `path` - Path to the file.
@@ -168,6 +188,11 @@ pub unsafe fn remove_file(path: *mut u8) -> i64 {
         return -1;
     }
 
+    if fs::get_file_id(name_str, Some(p.cwd())).map_or(false, |id| {
+        scheduler::is_running(id) || scheduler::is_mapped(id)
+    }) {
+        return -1;
+    }
     if fs::remove_file(name_str, Some(p.cwd())).is_ok() {
         0
     } else {
@@ -181,10 +206,12 @@ pub unsafe fn remove_file(path: *mut u8) -> i64 {
 /// - `fd` - The file descriptor to read from.
 /// - `buf` - The buffer to write into.
 /// - `count` - The number of bytes to read.
-/// - `offset` - The offset in the file to start reading from, ignored for `stdin`.
+/// - `offset` - The offset in the file to start reading from, ignored for `stdin` and pipes.
+///
+/// Reading `stdin` or a pipe waits until there's data to read.
 ///
 /// # Returns
-/// The amount of bytes read or -1 on failure.
+/// The amount of bytes read, 0 at the end of a pipe, or -1 on failure.
 pub unsafe fn read(fd: i32, buf: *mut u8, count: usize, offset: usize) -> i64 {
     let p = scheduler::get_running_process().as_ref().unwrap();
     let buffer;
@@ -200,9 +227,20 @@ pub unsafe fn read(fd: i32, buf: *mut u8, count: usize, offset: usize) -> i64 {
     }
 
     match fd {
-        STDIN_DESCRIPTOR => STDIN.read(buffer) as i64,
+        STDIN_DESCRIPTOR if p.stdin() != STDIN_DESCRIPTOR => read_pipe(p.stdin(), buffer),
+        STDIN_DESCRIPTOR => {
+            let read = STDIN.read(buffer);
+
+            // Wait until the user types something.
+            if read == 0 && !buffer.is_empty() {
+                super::WOULD_BLOCK
+            } else {
+                read as i64
+            }
+        }
         STDOUT_DESCRIPTOR => -1, // STDOUT still not implemented
         STDERR_DESCRIPTOR => -1, // STDERR still not implemented
+        _ if p.has_pipe(fd) => read_pipe(fd, buffer),
         _ => {
             file_id = (fd - RESERVED_FILE_DESCRIPTORS) as usize;
             if fs::is_dir(file_id).unwrap_or(true) {
@@ -229,6 +267,11 @@ pub unsafe fn read(fd: i32, buf: *mut u8, count: usize, offset: usize) -> i64 {
 /// If the offset is beyond the file's size the file will be extended and a "hole" will be
 /// created in the file. Reading from the hole will return null bytes.
 ///
+/// Writing a pipe waits until there's room for all the data, which must be at most
+/// `pipe::PIPE_CAPACITY` bytes.
+///
+/// A file can't be written while a process runs it.
+///
 /// # Returns
 /// 0 if the operation was successful, -1 otherwise.
 pub unsafe fn write(fd: i32, buf: *const u8, count: usize, offset: usize) -> i64 {
@@ -247,6 +290,7 @@ pub unsafe fn write(fd: i32, buf: *const u8, count: usize, offset: usize) -> i64
 
     match fd {
         STDIN_DESCRIPTOR => -1, // STDIN still not implemented
+        STDOUT_DESCRIPTOR if p.stdout() != STDOUT_DESCRIPTOR => write_pipe(p.stdout(), buffer),
         STDOUT_DESCRIPTOR => {
             if let Ok(string) = core::str::from_utf8(buffer) {
                 memory::load_tables_to_cr3(memory::get_page_table());
@@ -258,9 +302,10 @@ pub unsafe fn write(fd: i32, buf: *const u8, count: usize, offset: usize) -> i64
             }
         }
         STDERR_DESCRIPTOR => -1, // STDERR still not implemented
+        _ if p.has_pipe(fd) => write_pipe(fd, buffer),
         _ => {
             file_id = (fd - RESERVED_FILE_DESCRIPTORS) as usize;
-            if fs::is_dir(file_id).unwrap_or(true) {
+            if fs::is_dir(file_id).unwrap_or(true) || scheduler::is_running(file_id) {
                 -1
             } else {
                 if fs::write(file_id, buffer, offset).is_ok() {
@@ -273,6 +318,74 @@ pub unsafe fn write(fd: i32, buf: *const u8, count: usize, offset: usize) -> i64
     }
 }
 
+/// Read from the read end of a pipe and get the result of the `read` syscall.
+fn read_pipe(fd: i32, buffer: &mut [u8]) -> i64 {
+    match pipe::read(fd, buffer) {
+        Some(pipe::Transfer::Bytes(count)) => count as i64,
+        Some(pipe::Transfer::WouldBlock) => super::WOULD_BLOCK,
+        Some(pipe::Transfer::Closed) => 0,
+        None => -1,
+    }
+}
+
+/// Write to the write end of a pipe and get the result of the `write` syscall.
+fn write_pipe(fd: i32, buffer: &[u8]) -> i64 {
+    match pipe::write(fd, buffer) {
+        Some(pipe::Transfer::Bytes(_)) => 0,
+        Some(pipe::Transfer::WouldBlock) => super::WOULD_BLOCK,
+        Some(pipe::Transfer::Closed) | None => -1,
+    }
+}
+
+/// Create a pipe, a buffer that one process writes into and another process reads from.
+///
+/// # Arguments
+/// - `fds` - A buffer of two file descriptors to write the read end and the write end into.
+///
+/// # Returns
+/// 0 on success or -1 if `fds` is null.
+pub unsafe fn pipe(fds: *mut i32) -> i64 {
+    let p = scheduler::get_running_process().as_mut().unwrap();
+    let (read_end, write_end);
+
+    if fds.is_null() || !super::map_user_range_mut(p, fds as u64, 2 * core::mem::size_of::<i32>()) {
+        return -1;
+    }
+    (read_end, write_end) = pipe::create();
+    p.add_pipe(read_end);
+    p.add_pipe(write_end);
+    *fds = read_end;
+    *fds.add(1) = write_end;
+
+    0
+}
+
+/// Close a file descriptor.
+/// The end of a pipe is closed when all the processes that have it open close it, and then
+/// reading the pipe reaches its end or writing it fails.
+///
+/// # Arguments
+/// - `fd` - The file descriptor.
+///
+/// # Returns
+/// 0 on success or -1 if the process doesn't have `fd` open.
+pub unsafe fn close(fd: i32) -> i64 {
+    let p = scheduler::get_running_process().as_mut().unwrap();
+
+    if pipe::from_descriptor(fd).is_some() {
+        if p.close_pipe(fd) {
+            0
+        } else {
+            -1
+        }
+    } else if fd >= RESERVED_FILE_DESCRIPTORS {
+        // Files don't keep any state for their file descriptors.
+        0
+    } else {
+        -1
+    }
+}
+
 /// Get a file descriptor for a file.
 ///
 /// # Arguments
@@ -313,10 +426,18 @@ pub unsafe fn fstat(fd: i32, statbuf: *mut Stat) -> i64 {
         return -1;
     }
 
+    if !super::map_user_range_mut(
+        scheduler::get_running_process().as_ref().unwrap(),
+        statbuf as u64,
+        core::mem::size_of::<Stat>(),
+    ) {
+        return -1;
+    }
+
     file_id = (fd - RESERVED_FILE_DESCRIPTORS) as usize;
-    if let Some(size) = fs::get_file_size(file_id) {
+    if let Some((size, directory)) = fs::get_file_info(file_id) {
         (*statbuf).size = size as u64;
-        (*statbuf).directory = fs::is_dir(file_id).unwrap();
+        (*statbuf).directory = directory;
 
         if (*statbuf).directory {
             (*statbuf).size /= core::mem::size_of::<DirEntry>() as u64;
@@ -341,22 +462,29 @@ pub unsafe fn fstat(fd: i32, statbuf: *mut Stat) -> i64 {
 /// - `pid` is negative.
 /// - The process specified by `pid` does not exist.
 /// - The process specified by `pid` has already finished its execution.
+/// - Another process is already waiting for the process specified by `pid`.
 pub unsafe fn waitpid(pid: i64, wstatus: *mut i32) -> i64 {
     let p;
 
-    if pid < 0 {
+    if pid < 0
+        || !super::map_user_range_mut(
+            scheduler::get_running_process().as_ref().unwrap(),
+            wstatus as u64,
+            core::mem::size_of::<i32>(),
+        )
+    {
         return -1;
     }
 
     // Write to `wstatus` to avoid any errors with it later.
     *wstatus = 0;
-    if scheduler::search_process(pid) {
-        p = core::mem::replace(scheduler::get_running_process(), None).unwrap();
-        scheduler::wait_for(pid, p, wstatus);
+    p = core::mem::replace(scheduler::get_running_process(), None).unwrap();
+    if let Err(p) = scheduler::wait_for(pid, p, wstatus) {
+        *scheduler::get_running_process() = Some(p);
 
-        0
-    } else {
         -1
+    } else {
+        0
     }
 }
 
@@ -364,6 +492,7 @@ pub unsafe fn waitpid(pid: i64, wstatus: *mut i32) -> i64 {
 /// If the file has been set to a greater length, reading the extra data will return null bytes
 /// until the data is being written.
 /// If the file has been set to a smaller length, the extra data will be lost.
+/// A file can't be truncated while a process runs or maps it.
 ///
 /// # Arguments
 /// - `fd` - The file descriptor of the file.
@@ -380,10 +509,13 @@ pub unsafe fn ftruncate(fd: i32, length: u64) -> i64 {
 
     if fd >= RESERVED_FILE_DESCRIPTORS {
         file_id = (fd - RESERVED_FILE_DESCRIPTORS) as usize;
-        if fs::is_dir(file_id).unwrap_or(true) {
+        if fs::is_dir(file_id).unwrap_or(true)
+            || scheduler::is_running(file_id)
+            || scheduler::is_mapped(file_id)
+        {
             -1
         } else {
-            if fs::set_len(fd as usize, length as usize).is_ok() {
+            if fs::set_len(file_id, length as usize).is_ok() {
                 0
             } else {
                 -1
@@ -439,7 +571,13 @@ pub unsafe fn readdir(fd: i32, offset: usize, dirp: *mut DirEntry) -> i64 {
 
     if fd >= RESERVED_FILE_DESCRIPTORS {
         file_id = (fd - RESERVED_FILE_DESCRIPTORS) as usize;
-        if !fs::is_dir(file_id).unwrap_or(false) {
+        if !fs::is_dir(file_id).unwrap_or(false)
+            || !super::map_user_range_mut(
+                scheduler::get_running_process().as_ref().unwrap(),
+                dirp as u64,
+                core::mem::size_of::<DirEntry>(),
+            )
+        {
             -1
         } else {
             if let Some(mut entry) = fs::read_dir(file_id, offset) {
@@ -456,17 +594,240 @@ pub unsafe fn readdir(fd: i32, offset: usize, dirp: *mut DirEntry) -> i64 {
     }
 }
 
+/// Read many entries of a directory at once, with the size of every entry and whether it's a
+/// directory, so that listing a directory doesn't take a `readdir` and an `fstat` per entry.
+///
+/// # Arguments
+/// - `fd` - The file descriptor of the directory.
+/// - `offset` - The offset **in files** inside the directory of the first entry to read.
+/// - `dirp` - A buffer of `count` entries to write the data into.
+/// - `count` - The maximal amount of entries to read.
+///
+/// # Returns
+/// The amount of entries that were read, 0 at the end of the directory, or -1 on failure.
+/// Possible failures:
+/// - `fd` is negative or invalid.
+/// - `fd` is not a directory.
+/// - `dirp` is not a mapped buffer of the process.
+pub unsafe fn getdents(fd: i32, offset: usize, dirp: *mut Dirent, count: usize) -> i64 {
+    let file_id;
+    let mut entries;
+    let entries_read;
+
+    if fd < RESERVED_FILE_DESCRIPTORS {
+        return -1;
+    }
+    file_id = (fd - RESERVED_FILE_DESCRIPTORS) as usize;
+    if let Some(size) = fs::get_file_size(file_id) {
+        // don't allocate more entries than the directory has left
+        entries = Vec::new();
+        entries.resize(
+            core::cmp::min(
+                count,
+                (size / core::mem::size_of::<DirEntry>()).saturating_sub(offset),
+            ),
+            DirEntry::default(),
+        );
+    } else {
+        return -1;
+    }
+    if let Some(amount) = fs::read_dir_entries(file_id, offset, &mut entries) {
+        entries_read = amount;
+    } else {
+        return -1;
+    }
+    if !super::map_user_range_mut(
+        scheduler::get_running_process().as_ref().unwrap(),
+        dirp as u64,
+        entries_read * core::mem::size_of::<Dirent>(),
+    ) {
+        return -1;
+    }
+
+    for (i, entry) in entries[..entries_read].iter().enumerate() {
+        let dirent = &mut *dirp.add(i);
+
+        dirent.name = entry.name;
+        dirent.id = entry.id + RESERVED_FILE_DESCRIPTORS as usize;
+        (dirent.size, dirent.directory) = fs::get_file_info(entry.id)
+            .map_or((0, false), |(size, directory)| (size as u64, directory));
+        if dirent.directory {
+            dirent.size /= core::mem::size_of::<DirEntry>() as u64;
+        }
+    }
+
+    entries_read as i64
+}
+
+/// Get the page that the holes of mapped files are mapped to.
+/// The page is shared by all the mappings and is never freed.
+///
+/// # Returns
+/// The page or `None` if there is no free page to allocate it.
+unsafe fn get_zero_page() -> Option<PhysFrame> {
+    static mut ZERO_PAGE: Option<PhysFrame> = None;
+
+    if ZERO_PAGE.is_none() {
+        let page = memory::page_allocator::allocate()?;
+
+        core::ptr::write_bytes(
+            (page.start_address().as_u64() + memory::HHDM_OFFSET) as *mut u8,
+            0,
+            Size4KiB::SIZE as usize,
+        );
+        ZERO_PAGE = Some(page);
+    }
+
+    ZERO_PAGE
+}
+
+/// Unmap the pages of a range of a process' mapped files, skipping the pages that aren't mapped.
+/// The pages themselves are not freed because they belong to the file system.
+///
+/// # Arguments
+/// - `page_table` - The page table of the process.
+/// - `start` - The start of the range.
+/// - `pages` - The amount of pages in the range.
+fn unmap_file_pages(page_table: PhysAddr, start: VirtAddr, pages: u64) {
+    for i in 0..pages {
+        let page = start + i * Size4KiB::SIZE;
+
+        if memory::vmm::virtual_to_physical(page_table, page).is_ok() {
+            // UNWRAP: The page is mapped.
+            memory::vmm::unmap_address(page_table, page).unwrap();
+        }
+    }
+}
+
+/// Map a file read-only into the address space of the calling process, so that its data can be
+/// read without being copied.
+/// The pages of the mapping are the blocks of the file in the file system, so the mapping shows
+/// the changes that are written to the file. The file can't be truncated or removed until every
+/// mapping of it is unmapped, because its blocks would then be given to another file.
+///
+/// # Arguments
+/// - `fd` - The file descriptor of the file.
+///
+/// # Returns
+/// The address of the mapping, which spans the file's size rounded up to a page,
+/// or null on failure.
+/// Possible failures:
+/// - `fd` is negative or invalid.
+/// - `fd` is a directory.
+/// - The file is empty.
+/// - There is no memory left to map the file.
+pub unsafe fn mmap(fd: i32) -> *const u8 {
+    let p = scheduler::get_running_process().as_mut().unwrap();
+    let file_id;
+    let pages;
+    let start;
+
+    if fd < RESERVED_FILE_DESCRIPTORS {
+        return core::ptr::null();
+    }
+    file_id = (fd - RESERVED_FILE_DESCRIPTORS) as usize;
+    if fs::is_dir(file_id).unwrap_or(true) {
+        return core::ptr::null();
+    }
+    // UNWRAP: The file exists because `is_dir` found it.
+    pages = (fs::get_file_size(file_id).unwrap() as u64).div_ceil(Size4KiB::SIZE);
+    if pages == 0 {
+        return core::ptr::null();
+    }
+    if let Some(address) = p.reserve_mapping(pages) {
+        start = address;
+    } else {
+        return core::ptr::null();
+    }
+
+    for i in 0..pages {
+        // UNWRAP: The block is within the file's size.
+        let block = fs::get_block(file_id, i as usize).unwrap();
+        let frame = if block.is_null() {
+            get_zero_page()
+        } else {
+            // The device is in the kernel's heap, whose pages are mapped in every page table.
+            memory::vmm::virtual_to_physical(memory::get_page_table(), VirtAddr::from_ptr(block))
+                .ok()
+                .map(PhysFrame::containing_address)
+        };
+
+        if frame.map_or(true, |frame| {
+            memory::vmm::map_address(
+                p.page_table,
+                start + i * Size4KiB::SIZE,
+                frame,
+                PageTableFlags::PRESENT | PageTableFlags::USER_ACCESSIBLE,
+            )
+            .is_err()
+        }) {
+            unmap_file_pages(p.page_table, start, i);
+            memory::flush_tlb_cache();
+
+            return core::ptr::null();
+        }
+    }
+    memory::flush_tlb_cache();
+    p.add_mapping(start, pages, file_id);
+
+    start.as_ptr()
+}
+
+/// Unmap a file that was mapped with `mmap`.
+///
+/// # Arguments
+/// - `addr` - The address that `mmap` returned.
+/// - `length` - The size of the file when it was mapped.
+///
+/// # Returns
+/// 0 if the operation was successful, -1 if `addr` and `length` are not a mapping that `mmap`
+/// returned.
+pub unsafe fn munmap(addr: *const u8, length: usize) -> i64 {
+    let p = scheduler::get_running_process().as_mut().unwrap();
+    let start = VirtAddr::new_truncate(addr as u64);
+    let pages = (length as u64).div_ceil(Size4KiB::SIZE);
+
+    if !p.remove_mapping(start, pages) {
+        return -1;
+    }
+    unmap_file_pages(p.page_table, start, pages);
+    memory::flush_tlb_cache();
+
+    0
+}
+
 /// Execute a program in a new process.
 ///
 /// # Arguments
 /// - `pathname` - Path to the file to execute, must be a valid ELF file.
 /// - `argv` - The commandline arguments.
+/// - `stdin` - The standard input of the new process, the read end of a pipe or any other
+/// descriptor to inherit the standard input of the calling process.
+/// - `stdout` - The standard output of the new process, the write end of a pipe or any other
+/// descriptor to inherit the standard output of the calling process.
+///
+/// Programs that were built before `stdin` and `stdout` were added pass 0 for both, which
+/// therefore inherits them.
 ///
 /// # Returns
 /// The process ID of the new process if the operation was successful, -1 otherwise.
-pub unsafe fn exec(pathname: *const u8, argv: *const *const u8) -> i64 {
+pub unsafe fn exec(pathname: *const u8, argv: *const *const u8, stdin: i32, stdout: i32) -> i64 {
     let p = scheduler::get_running_process().as_ref().unwrap();
-    let args = super::get_args(argv);
+    let stdin = if pipe::from_descriptor(stdin).is_some() {
+        stdin
+    } else {
+        p.stdin()
+    };
+    let stdout = if pipe::from_descriptor(stdout).is_some() {
+        stdout
+    } else {
+        p.stdout()
+    };
+    let args = if let Some(args) = super::get_args(p, argv) {
+        args
+    } else {
+        return -1;
+    };
     let mut args_str = Vec::new();
     let file_name;
     let file_id;
@@ -490,8 +851,17 @@ pub unsafe fn exec(pathname: *const u8, argv: *const *const u8) -> i64 {
             return -1;
         }
     }
-    if let Ok(proc) = scheduler::Process::new_user_process(file_id as u64, p.cwd_path(), &args_str)
+    for (fd, end) in [(stdin, pipe::End::Read), (stdout, pipe::End::Write)] {
+        if pipe::from_descriptor(fd).is_some()
+            && (!p.has_pipe(fd) || pipe::from_descriptor(fd).unwrap().1 != end)
+        {
+            return -1;
+        }
+    }
+    if let Ok(mut proc) =
+        scheduler::Process::new_user_process(file_id as u64, p.cwd_path(), &args_str)
     {
+        proc.redirect(stdin, stdout);
         new_pid = proc.pid();
         scheduler::add_to_the_queue(proc);
 
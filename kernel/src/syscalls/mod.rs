@@ -1,10 +1,12 @@
 use alloc::string::String;
 use alloc::vec::Vec;
+use x86_64::structures::paging::{PageSize, Size4KiB};
 use x86_64::VirtAddr;
 
 use super::io;
-use super::scheduler;
+use super::scheduler::{self, MAX_CPUS};
 use crate::memory;
+use crate::mutex::Mutex;
 use core::arch::asm;
 use core::u8;
 use fs_rs::fs::DirEntry;
@@ -15,27 +17,46 @@ const EFER: u32 = 0xc0000080;
 const STAR: u32 = 0xc0000081;
 const LSTAR: u32 = 0xc0000082;
 const FMASK: u32 = 0xc0000084;
+pub const GS_BASE: u32 = 0xc0000101;
 pub const KERNEL_GS_BASE: u32 = 0xc0000102;
 
-static mut KERNEL_STACK: u64 = 0;
+/// The result of a syscall that has to wait, such as reading an empty pipe.
+/// The process performs the syscall again the next time it runs, so the other processes run
+/// in the meantime.
+pub const WOULD_BLOCK: i64 = i64::MIN;
+/// The size of the `syscall` instruction.
+const SYSCALL_INSTRUCTION_SIZE: u64 = 2;
 
+/// The kernel's stack of every processor, which the syscall handler switches to.
+static mut KERNEL_STACKS: [u64; MAX_CPUS] = [0; MAX_CPUS];
+/// Syscalls are performed one at a time, even when they are performed on different
+/// processors, because the file system is not safe to use from several processors at once.
+pub static KERNEL_LOCK: Mutex<()> = Mutex::new(());
+
+/// Enable syscalls on the current processor.
+///
+/// # Safety
+/// The TSS of the processor must be loaded, because its kernel's stack is used for syscalls.
 pub unsafe fn initialize() {
     let rip = handler_save_context as u64;
     let cs = u64::from(super::gdt::KERNEL_CODE) << 32;
+    let cpu = scheduler::cpu_id();
 
-    KERNEL_STACK = scheduler::get_kernel_stack();
+    KERNEL_STACKS[cpu] = scheduler::get_kernel_stack();
 
     io::wrmsr(LSTAR, rip);
     io::wrmsr(STAR, cs);
     // Enable syscalls by setting the first bit of the EFER MSR
-    io::wrmsr(EFER, 1);
+    io::wrmsr(EFER, io::rdmsr(EFER) | 1);
     // Write !0 to the `FMASK` MSR to clear all the bits of `rflags` when a syscall occurs.
     io::wrmsr(FMASK, !0);
-    // Write the kernel's stack to the gs register.
-    io::wrmsr(KERNEL_GS_BASE, &KERNEL_STACK as *const _ as u64);
+    // Write the kernel's stack of the processor to the gs register, so that every processor
+    // switches to its own stack.
+    io::wrmsr(KERNEL_GS_BASE, &KERNEL_STACKS[cpu] as *const _ as u64);
 }
 
 /// Handle the syscall (Perform the action that the process has requested).
+/// `KERNEL_LOCK` is held while the syscall is performed.
 ///
 /// # Arguments
 /// - `syscall_number` - The identifier of the syscall, the value stored in `rax`.
@@ -54,6 +75,8 @@ unsafe fn handle_syscall(
     _arg4: u64,
     _arg5: u64,
 ) -> i64 {
+    let _guard = KERNEL_LOCK.lock();
+
     match syscall_number {
         handlers::READ => {
             handlers::read(arg0 as i32, arg1 as *mut u8, arg2 as usize, arg3 as usize)
@@ -61,60 +84,175 @@ unsafe fn handle_syscall(
         handlers::WRITE => {
             handlers::write(arg0 as i32, arg1 as *const u8, arg2 as usize, arg3 as usize)
         }
-        handlers::EXEC => handlers::exec(arg0 as *const u8, arg1 as *const *const u8),
+        handlers::EXEC => handlers::exec(
+            arg0 as *const u8,
+            arg1 as *const *const u8,
+            arg2 as i32,
+            arg3 as i32,
+        ),
         handlers::MALLOC => handlers::malloc(arg0 as usize) as i64,
         handlers::CALLOC => handlers::calloc(arg0 as usize, arg1 as usize) as i64,
         handlers::FREE => handlers::free(arg0 as *mut u8),
         handlers::REALLOC => handlers::realloc(arg0 as *mut u8, arg1 as usize) as i64,
+        handlers::MMAP => handlers::mmap(arg0 as i32) as i64,
+        handlers::MUNMAP => handlers::munmap(arg0 as *const u8, arg1 as usize),
         handlers::SCHED_YIELD => handlers::sched_yield(),
         handlers::EXIT => handlers::exit(arg0 as i32),
         handlers::GET_CURRENT_DIR_NAME => handlers::get_current_dir_name() as i64,
         handlers::CHDIR => handlers::chdir(arg0 as *const u8),
         handlers::CREAT => handlers::creat(arg0 as *mut u8, arg1 != 0) as i64,
         handlers::OPEN => handlers::open(arg0 as *const u8) as i64,
+        handlers::CLOSE => handlers::close(arg0 as i32),
+        handlers::PIPE => handlers::pipe(arg0 as *mut i32),
         handlers::FSTAT => handlers::fstat(arg0 as i32, arg1 as *mut handlers::Stat),
         handlers::WAITPID => handlers::waitpid(arg0 as i64, arg1 as *mut i32),
         handlers::REMOVE_FILE => handlers::remove_file(arg0 as *mut u8),
         handlers::TRUNCATE => handlers::truncate(arg0 as *const u8, arg1),
         handlers::FTRUNCATE => handlers::ftruncate(arg0 as i32, arg1),
         handlers::READ_DIR => handlers::readdir(arg0 as i32, arg1 as usize, arg2 as *mut DirEntry),
+        handlers::GETDENTS => handlers::getdents(
+            arg0 as i32,
+            arg1 as usize,
+            arg2 as *mut handlers::Dirent,
+            arg3 as usize,
+        ),
         _ => -1,
     }
 }
 
-/// Returns the length of a null-terminated string.
+/// Make sure that a page of a process' memory is mapped before the kernel accesses it, by
+/// loading it from the process' executable if the process hasn't accessed it yet.
+/// The kernel doesn't handle its own page faults, so it can't rely on the page fault handler to
+/// load the page.
+///
+/// # Arguments
+/// - `process` - The process.
+/// - `address` - An address in the page.
+///
+/// # Returns
+/// `true` if the page is mapped.
+unsafe fn map_user_page(process: &scheduler::Process, address: u64) -> bool {
+    let address = if let Ok(address) = VirtAddr::try_new(address) {
+        address
+    } else {
+        return false;
+    };
+
+    address.as_u64() < memory::HHDM_OFFSET
+        && (memory::vmm::virtual_to_physical(process.page_table, address).is_ok()
+            || process.load_page(address))
+}
+
+/// Make sure that every page of a range of a process' memory is mapped, see `map_user_page`.
+///
+/// # Arguments
+/// - `process` - The process.
+/// - `start` - The start of the range.
+/// - `len` - The length of the range.
+///
+/// # Returns
+/// `true` if all the pages are mapped.
+unsafe fn map_user_range(process: &scheduler::Process, start: u64, len: usize) -> bool {
+    let end;
+    let mut page = start - start % Size4KiB::SIZE;
+
+    if let Some(value) = start.checked_add(len as u64) {
+        end = value;
+    } else {
+        return false;
+    }
+    while page < end {
+        if !map_user_page(process, page) {
+            return false;
+        }
+        page += Size4KiB::SIZE;
+    }
+
+    true
+}
+
+/// Make sure that every page of a range of a process' memory is mapped and may be written for
+/// the process, see `map_user_range`.
+/// The shared pages of the executable and the pages of mapped files are read-only for the
+/// process, and writing them would change them for the other processes and the file system.
 ///
 /// # Arguments
+/// - `process` - The process.
+/// - `start` - The start of the range.
+/// - `len` - The length of the range.
+///
+/// # Returns
+/// `true` if all the pages are mapped and writable.
+unsafe fn map_user_range_mut(process: &scheduler::Process, start: u64, len: usize) -> bool {
+    let mut page = start - start % Size4KiB::SIZE;
+
+    if !map_user_range(process, start, len) {
+        return false;
+    }
+    // The end of the range doesn't overflow because `map_user_range` has checked it.
+    while page < start + len as u64 {
+        if process.is_shared_page(page) || (memory::MMAP_START..memory::MMAP_END).contains(&page) {
+            return false;
+        }
+        page += Size4KiB::SIZE;
+    }
+
+    true
+}
+
+/// Returns the length of a null-terminated string of a process, mapping its pages as it is
+/// scanned.
+///
+/// # Arguments
+/// - `process` - The process that owns the string.
 /// - `buffer` - Pointer to the string's data.
 ///
-/// # Safety
-/// Might produce a page fault if the string isn't null-terminated or if the buffer points to
-/// unmapped memory.
-unsafe fn strlen(buffer: *const u8) -> usize {
+/// # Returns
+/// The length of the string or `None` if it reaches memory that is not mapped.
+unsafe fn strlen(process: &scheduler::Process, buffer: *const u8) -> Option<usize> {
     let mut i = 0;
 
-    while *buffer.add(i) != 0 {
+    loop {
+        if (i == 0 || buffer.add(i) as u64 % Size4KiB::SIZE == 0)
+            && !map_user_page(process, buffer.add(i) as u64)
+        {
+            return None;
+        }
+        if *buffer.add(i) == 0 {
+            return Some(i);
+        }
         i += 1;
     }
-
-    i
 }
 
-/// Get the arguments array from a raw pointer.
+/// Get the arguments array from a raw pointer, mapping its pages as it is scanned.
 ///
 /// # Arguments
+/// - `process` - The process that owns the array.
 /// - `argv` - The pointer to the arguments array.
 ///
+/// # Returns
+/// The arguments or `None` if the array reaches memory that is not mapped.
+///
 /// # Safety
 /// Assumes that `argv` points to a null-terminated array.
-unsafe fn get_args(argv: *const *const u8) -> &'static [*const u8] {
+unsafe fn get_args(
+    process: &scheduler::Process,
+    argv: *const *const u8,
+) -> Option<&'static [*const u8]> {
     let mut len = 0;
 
-    while !(*argv.add(len)).is_null() {
+    loop {
+        if (len == 0 || argv.add(len) as u64 % Size4KiB::SIZE == 0)
+            && !map_user_page(process, argv.add(len) as u64)
+        {
+            return None;
+        }
+        if (*argv.add(len)).is_null() {
+            return Some(core::slice::from_raw_parts(argv, len));
+        }
         len += 1;
     }
-
-    core::slice::from_raw_parts(argv, len)
 }
 
 /// Get the absolute path to a file from a relative path.
@@ -151,6 +289,8 @@ fn get_absolute_path(path: &str) -> String {
 }
 
 /// Get a slice borrow from a user buffer.
+/// The buffer is accessed through the page table of the process, which the syscalls run with, so
+/// a buffer that spans several pages doesn't have to be contiguous in physical memory.
 ///
 /// # Arguments
 /// - `process` - The user process that sent the buffer.
@@ -160,6 +300,7 @@ fn get_absolute_path(path: &str) -> String {
 /// # Returns
 /// The user's buffer on success or `None` if the buffer is outside the user's memory or isn't
 /// mapped to a physical address.
+/// The pages of the buffer that haven't been loaded from the user's executable yet are loaded.
 ///
 /// # Safety
 /// Assumes the buffer is valid and actually of length `len`.
@@ -168,33 +309,25 @@ unsafe fn get_user_buffer(
     buffer: *const u8,
     len: usize,
 ) -> Option<&[u8]> {
-    let page;
-
-    if buffer.is_null() || buffer as u64 >= memory::HHDM_OFFSET {
+    if buffer.is_null() || !map_user_range(process, buffer as u64, len) {
         None
     } else {
-        page = memory::vmm::virtual_to_physical(process.page_table, VirtAddr::new(buffer as u64))
-            .ok()?;
-
-        Some(core::slice::from_raw_parts(
-            (page.as_u64() + memory::HHDM_OFFSET) as *const u8,
-            len,
-        ))
+        Some(core::slice::from_raw_parts(buffer, len))
     }
 }
 
 /// Mutable version of `get_user_buffer`.
+/// Also fails if the buffer is read-only for the process, see `map_user_range_mut`.
 unsafe fn get_user_buffer_mut(
     process: &scheduler::Process,
     buffer: *mut u8,
     len: usize,
 ) -> Option<&mut [u8]> {
-    let buf = get_user_buffer(process, buffer, len)?;
-
-    Some(core::slice::from_raw_parts_mut(
-        buf.as_ptr() as *mut u8,
-        buf.len(),
-    ))
+    if buffer.is_null() || !map_user_range_mut(process, buffer as u64, len) {
+        None
+    } else {
+        Some(core::slice::from_raw_parts_mut(buffer, len))
+    }
 }
 
 /// Returns a user string from a pointer or `None` if the data is invalid.
@@ -203,22 +336,58 @@ unsafe fn get_user_buffer_mut(
 /// `process` - The process that owns the data.
 /// `buffer` - The buffer the process has sent.
 unsafe fn get_user_str(process: &scheduler::Process, buffer: *const u8) -> Option<&str> {
-    core::str::from_utf8(get_user_buffer(process, buffer, strlen(buffer))?).ok()
+    if buffer.is_null() {
+        return None;
+    }
+
+    core::str::from_utf8(get_user_buffer(process, buffer, strlen(process, buffer)?)?).ok()
+}
+
+/// Return the result of a syscall to the process, or make the process perform the syscall
+/// again if it has to wait.
+///
+/// # Arguments
+/// - `proc` - The process that performed the syscall.
+/// - `result` - The result of the syscall.
+fn set_result(proc: &mut scheduler::Process, result: i64) {
+    if result == WOULD_BLOCK {
+        // The registers still hold the syscall number and the arguments.
+        proc.instruction_pointer -= SYSCALL_INSTRUCTION_SIZE;
+    } else {
+        proc.registers.rax = result as u64;
+    }
 }
 
-pub unsafe fn int_0x80_handler() {
+/// Handle a syscall that was performed with the `int 0x80` instruction.
+///
+/// # Arguments
+/// - `frame` - The interrupt stack frame of the process.
+pub unsafe extern "C" fn int_0x80_handler(
+    frame: &x86_64::structures::idt::InterruptStackFrame,
+) -> ! {
+    // UNWRAP: Syscalls should not be called from inside the kernel.
     let proc = scheduler::get_running_process().as_mut().unwrap();
 
-    proc.registers.rax = handle_syscall(
-        proc.registers.rax,
-        proc.registers.rdi,
-        proc.registers.rsi,
-        proc.registers.rdx,
-        proc.registers.r10,
-        proc.registers.r8,
-        proc.registers.r9,
-    ) as u64;
+    proc.stack_pointer = frame.stack_pointer.as_u64();
+    proc.instruction_pointer = frame.instruction_pointer.as_u64();
+    proc.flags = frame.cpu_flags;
 
+    // The `int 0x80` instruction is as long as the `syscall` instruction, so a syscall that
+    // has to wait is rewound the same way.
+    set_result(
+        proc,
+        handle_syscall(
+            proc.registers.rax,
+            proc.registers.rdi,
+            proc.registers.rsi,
+            proc.registers.rdx,
+            proc.registers.r10,
+            proc.registers.r8,
+            proc.registers.r9,
+        ),
+    );
+
+    scheduler::switch_current_process();
     scheduler::load_from_queue();
 }
 
@@ -262,15 +431,18 @@ pub unsafe fn handler() -> ! {
     proc.instruction_pointer = proc.registers.rcx;
     proc.flags = proc.registers.r11;
 
-    proc.registers.rax = handle_syscall(
-        proc.registers.rax,
-        proc.registers.rdi,
-        proc.registers.rsi,
-        proc.registers.rdx,
-        proc.registers.r10,
-        proc.registers.r8,
-        proc.registers.r9,
-    ) as u64;
+    set_result(
+        proc,
+        handle_syscall(
+            proc.registers.rax,
+            proc.registers.rdi,
+            proc.registers.rsi,
+            proc.registers.rdx,
+            proc.registers.r10,
+            proc.registers.r8,
+            proc.registers.r9,
+        ),
+    );
 
     scheduler::switch_current_process();
     scheduler::load_from_queue();
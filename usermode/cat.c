@@ -1,11 +1,17 @@
 #include "yehuda-os/helpers.h"
 #include "yehuda-os/sys.h"
 
+#define READ_BUFFER_SIZE 4096
+
+// page-aligned, so that every read fills a single page
+static char buffer[READ_BUFFER_SIZE] __attribute__((aligned(READ_BUFFER_SIZE)));
+
 int main(int argc, char** argv)
 {
     int fd           = 0;
     struct Stat stat = { .directory = 0, .size = 0 };
-    char* buf        = NULL;
+    size_t offset    = 0;
+    ssize_t count    = 0;
 
     if (argc <= 1)
     {
@@ -30,10 +36,19 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    buf = malloc(stat.size + 1);
-    read(fd, (void*)buf, stat.size, 0);
-    buf[stat.size] = '\0';
-    print_str(buf);
+    // the file is read in pieces, so only a piece of it is in memory at once
+    while (offset < stat.size)
+    {
+        count = read(fd, buffer, READ_BUFFER_SIZE, offset);
+        if (count <= 0)
+        {
+            print_str("cat: failed to read file\n");
+
+            return 1;
+        }
+        write_out(buffer, count);
+        offset += count;
+    }
     print_newline();
 
     return 0;
@@ -42,13 +57,10 @@ int main(int argc, char** argv)
 // Tell the compiler incoming stack alignment is not RSP%16==8 or ESP%16==12
 __attribute__((force_align_arg_pointer)) void _start()
 {
-    asm("call main");
-
-    /* exit system call */
-    asm("mov $0, %rdi;"
+    /* flush the output and exit with the exit code of main */
+    asm("call main;"
         "mov %eax, %edi;"
-        "mov $0x3c, %rax;"
-        "syscall");
+        "call exit_process");
     // tell the compiler to make sure side effects are done before the asm statement
     __builtin_unreachable();
 }
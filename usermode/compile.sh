@@ -3,4 +3,4 @@
 arg=$1
 filename=${arg%??}
 
-gcc $1 yehuda-os/helpers.c yehuda-os/sys.c -o ../kernel/bin/$filename -nostdlib
+gcc $1 yehuda-os/helpers.c yehuda-os/malloc.c yehuda-os/stream.c yehuda-os/sys.c -o ../kernel/bin/$filename -nostdlib -static
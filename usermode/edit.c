@@ -32,29 +32,48 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    char *empty = (char *)calloc(stat.size, sizeof(char));
-    write(fd, (void *)empty, stat.size, 0);
+    ftruncate(fd, 0);
 
     char *curr_line = NULL;
-    char content[1024] = "";
+    char *content = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    size_t line_length = 0;
 
     while (1)
     {
         curr_line = getline();
 
-        if (strlen(curr_line) == 0 || curr_line == NULL)
+        if (curr_line == NULL || strlen(curr_line) == 0)
         {
             break;
         }
-        strcat(content, curr_line);
-        strcat(content, " \n");
+        line_length = strlen(curr_line);
+
+        // the buffer grows by doubling and the line is copied to the end of
+        // the content, so every line is only copied once
+        if (length + line_length + 2 > capacity)
+        {
+            capacity = capacity * 2 > length + line_length + 2 ? capacity * 2 : length + line_length + 2;
+            content = realloc(content, capacity);
+            if (content == NULL)
+            {
+                print_str("edit: out of memory\n");
+                free(curr_line);
+
+                return 1;
+            }
+        }
+        memcpy(content + length, curr_line, line_length);
+        memcpy(content + length + line_length, " \n", 2);
+        length += line_length + 2;
         free(curr_line);
         curr_line = NULL;
     }
 
-    write(fd, content, strlen(content), 0);
+    write(fd, content, length, 0);
+    free(content);
     free(curr_line);
-    free(empty);
 
     return 0;
 }
@@ -62,13 +81,10 @@ int main(int argc, char* argv[])
 // Tell the compiler incoming stack alignment is not RSP%16==8 or ESP%16==12
 __attribute__((force_align_arg_pointer)) void _start()
 {
-    asm("call main");
-
-    /* exit system call */
-    asm("mov $0, %rdi;"
+    /* flush the output and exit with the exit code of main */
+    asm("call main;"
         "mov %eax, %edi;"
-        "mov $0x3c, %rax;"
-        "syscall");
+        "call exit_process");
     // tell the compiler to make sure side effects are done before the asm
     // statement
     __builtin_unreachable();
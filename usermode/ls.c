@@ -1,12 +1,15 @@
 #include "yehuda-os/helpers.h"
 #include "yehuda-os/sys.h"
 
+#define ENTRIES_PER_CALL 32
+
 int main(int argc, char* argv[])
 {
-    int fd                  = open(argc > 1 ? argv[1] : ".");
-    struct Stat ls_dir_stat = { .size = 0, .directory = 0 };
-    struct Stat child_stat  = { .size = 0, .directory = 0 };
-    struct DirEntry entry   = { .id = 0, .name = 0 };
+    int fd                                  = open(argc > 1 ? argv[1] : ".");
+    struct Stat ls_dir_stat                 = { .size = 0, .directory = 0 };
+    struct Dirent entries[ENTRIES_PER_CALL] = { 0 };
+    size_t offset                           = 0;
+    int count                               = 0;
 
     if (fstat(fd, &ls_dir_stat) == -1)
     {
@@ -15,20 +18,25 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    for (size_t i = 0; i < ls_dir_stat.size; i++)
+    while (offset < ls_dir_stat.size)
     {
-        if (readdir(fd, i, &entry) == -1 || fstat((int)entry.id, &child_stat) == -1)
+        count = getdents(fd, offset, entries, ENTRIES_PER_CALL);
+        if (count <= 0)
         {
             print_str("ls: failed to read directory\n");
 
             return 1;
         }
-        print_str(entry.name);
-        if (child_stat.directory)
+        for (int i = 0; i < count; i++)
         {
-            print_str("/");
+            print_str(entries[i].name);
+            if (entries[i].directory)
+            {
+                print_str("/");
+            }
+            print_newline();
         }
-        print_newline();
+        offset += count;
     }
 
     return 0;
@@ -37,13 +45,10 @@ int main(int argc, char* argv[])
 // Tell the compiler incoming stack alignment is not RSP%16==8 or ESP%16==12
 __attribute__((force_align_arg_pointer)) void _start()
 {
-    asm("call main");
-
-    /* exit system call */
-    asm("mov $0, %rdi;"
+    /* flush the output and exit with the exit code of main */
+    asm("call main;"
         "mov %eax, %edi;"
-        "mov $0x3c, %rax;"
-        "syscall");
+        "call exit_process");
     // tell the compiler to make sure side effects are done before the asm
     // statement
     __builtin_unreachable();
@@ -4,13 +4,10 @@
 // Tell the compiler incoming stack alignment is not RSP%16==8 or ESP%16==12
 __attribute__((force_align_arg_pointer)) void _start()
 {
-    asm("call main");
-
-    /* exit system call */
-    asm("mov $0, %rdi;"
+    /* flush the output and exit with the exit code of main */
+    asm("call main;"
         "mov %eax, %edi;"
-        "mov $0x3c, %rax;"
-        "syscall");
+        "call exit_process");
     // tell the compiler to make sure side effects are done before the asm statement
     __builtin_unreachable();
 }
@@ -1,29 +1,178 @@
 #include "yehuda-os/helpers.h"
 #include "yehuda-os/sys.h"
 
-#define NUM_OF_PROCESSES 5
+// A scaling benchmark: the same amount of work is split between 1, 2, 4, ...
+// processes, and the time each split takes is printed. On a kernel that runs
+// processes on several processors the time drops as processes are added, up to
+// the amount of processors.
 
-int main()
+#define DEFAULT_PROCESSES 8
+#define MAX_PROCESSES     16
+#define TOTAL_WORK        (1 << 26) // iterations of the work loop in a split
+#define CYCLES_PER_UNIT   1000000   // the time is printed in millions of cycles
+#define WORKER_FLAG       "--worker"
+#define MAX_NUMBER_LEN    12
+
+/**
+ * Read the time stamp counter of the processor.
+ */
+static size_t read_timestamp()
+{
+    unsigned int low  = 0;
+    unsigned int high = 0;
+
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return ((size_t)high << 32) | low;
+}
+
+/**
+ * Parse a non-negative decimal number.
+ *
+ * returns: The number or -1 if `str` is not a number.
+ */
+static int parse_number(const char* str)
+{
+    int number = 0;
+
+    if (*str == '\0')
+    {
+        return -1;
+    }
+    for (; *str != '\0'; str++)
+    {
+        if (*str < '0' || *str > '9' || number > (0x7fffffff - 9) / 10)
+        {
+            return -1;
+        }
+        number = number * 10 + (*str - '0');
+    }
+
+    return number;
+}
+
+/**
+ * Perform CPU-bound work that doesn't touch memory.
+ *
+ * `iterations`: The amount of iterations of the work.
+ *
+ * returns: The result of the work, so that the compiler doesn't remove it.
+ */
+static int work(int iterations)
+{
+    size_t state = 1;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        // a step of a linear congruential generator
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+
+    return (int)(state >> 63);
+}
+
+/**
+ * Split the work between processes and measure how long it takes them.
+ *
+ * `processes`: The amount of processes, at most `MAX_PROCESSES`.
+ *
+ * returns: The time it took in cycles or 0 if a process couldn't be created.
+ */
+static size_t run_split(int processes)
 {
-    int status                   = 0;
-    pid_t pids[NUM_OF_PROCESSES] = { 0, 0, 0, 0, 0 };
-    char* const args[]           = { "./repeat", "a", NULL };
+    char iterations[MAX_NUMBER_LEN] = { 0 };
+    char* const args[]              = { "/multiprocessing", WORKER_FLAG, iterations, NULL };
+    pid_t pids[MAX_PROCESSES]       = { 0 };
+    int status                      = 0;
+    size_t start                    = 0;
+    bool_t failed                   = FALSE;
 
-    for (int i = 0; i < NUM_OF_PROCESSES; i++)
+    int_to_string(TOTAL_WORK / processes, iterations);
+    start = read_timestamp();
+    for (int i = 0; i < processes; i++)
     {
-        print_str("Creating process\n");
-        pids[i] = exec("/repeat", args);
+        pids[i] = exec("/multiprocessing", args);
         if (pids[i] == -1)
         {
-            print_str("execution of one of the processes failed\n");
+            failed = TRUE;
+        }
+    }
+    for (int i = 0; i < processes; i++)
+    {
+        if (pids[i] != -1)
+        {
+            waitpid(pids[i], &status);
+        }
+    }
+
+    return failed ? 0 : read_timestamp() - start;
+}
+
+/**
+ * Print a line of the results of the benchmark.
+ *
+ * `processes`: The amount of processes the work was split between.
+ * `cycles`: The time it took them.
+ * `base`: The time it took a single process.
+ */
+static void print_result(int processes, size_t cycles, size_t base)
+{
+    char number[MAX_NUMBER_LEN] = { 0 };
+
+    int_to_string(processes, number);
+    print_str(number);
+    print_str(" processes: ");
+    int_to_string((int)(cycles / CYCLES_PER_UNIT), number);
+    print_str(number);
+    print_str("M cycles, speedup x");
+    int_to_string((int)(base / cycles), number);
+    print_str(number);
+    print_str(".");
+    // the first two digits of the fraction
+    int_to_string((int)(base * 100 / cycles % 100), number);
+    if (base * 100 / cycles % 100 < 10)
+    {
+        print_str("0");
+    }
+    print_str(number);
+    print_newline();
+}
+
+int main(int argc, char** argv)
+{
+    int max_processes = DEFAULT_PROCESSES;
+    size_t base       = 0;
+    size_t cycles     = 0;
+
+    if (argc == 3 && strcmp(argv[1], WORKER_FLAG) == 0)
+    {
+        return work(parse_number(argv[2]));
+    }
+    if (argc > 1)
+    {
+        max_processes = parse_number(argv[1]);
+        if (max_processes < 1 || max_processes > MAX_PROCESSES)
+        {
+            print_str("multiprocessing: the amount of processes must be between 1 and 16\n");
 
             return 1;
         }
-        args[1][0]++;
     }
-    for (int i = 0; i < NUM_OF_PROCESSES; i++)
+
+    for (int processes = 1; processes <= max_processes; processes *= 2)
     {
-        waitpid(pids[i], &status);
+        cycles = run_split(processes);
+        if (cycles == 0)
+        {
+            print_str("execution of one of the processes failed\n");
+
+            return 1;
+        }
+        if (processes == 1)
+        {
+            base = cycles;
+        }
+        print_result(processes, cycles, base);
     }
 
     return 0;
@@ -32,13 +181,10 @@ int main()
 // Tell the compiler incoming stack alignment is not RSP%16==8 or ESP%16==12
 __attribute__((force_align_arg_pointer)) void _start()
 {
-    asm("call main");
-
-    /* exit system call */
-    asm("mov $0, %rdi;"
+    /* flush the output and exit with the exit code of main */
+    asm("call main;"
         "mov %eax, %edi;"
-        "mov $0x3c, %rax;"
-        "syscall");
+        "call exit_process");
     // tell the compiler to make sure side effects are done before the asm
     // statement
     __builtin_unreachable();
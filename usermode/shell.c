@@ -4,9 +4,10 @@
 #define MAX_INT_STRLEN 11
 
 const char* EXECUTABLE_PATH_START[] = { "./", "../", "/", NULL };
+const char* PIPE_SEPARATOR          = "|";
 
 /**
- * Returns the amount of words in `str`.
+ * Returns the amount of words in `str`, where every `|` is a word of its own.
  */
 size_t count_words(const char* str)
 {
@@ -19,6 +20,11 @@ size_t count_words(const char* str)
         {
             in_word = FALSE;
         }
+        else if (*str == PIPE_SEPARATOR[0])
+        {
+            in_word = FALSE;
+            count++;
+        }
         else if (!in_word)
         {
             in_word = TRUE;
@@ -30,8 +36,30 @@ size_t count_words(const char* str)
     return count;
 }
 
+/**
+ * Copies a word into a new string.
+ *
+ * `start`: The start of the word.
+ * `word_len`: The length of the word.
+ *
+ * returns: The new string or `NULL` on an allocation failure.
+ */
+char* copy_word(const char* start, size_t word_len)
+{
+    char* word = malloc((word_len + 1) * sizeof(char));
+
+    if (word != NULL)
+    {
+        memcpy(word, start, word_len);
+        word[word_len] = '\0';
+    }
+
+    return word;
+}
+
 /**
  * Splits `command` into words separated by spaces.
+ * Every `|` is a word of its own, even if it isn't surrounded by spaces.
  *
  * returns: An array of the words that are in the command,
  *          terminated by a NULL pointer or `NULL` on an allocation failure.
@@ -43,7 +71,6 @@ char** parse_command(const char* command)
     size_t word_len     = 0;
     const char* current = command;
     char** words        = calloc(count_words(command) + 1, sizeof(char*));
-    bool_t in_word      = FALSE;
     size_t count        = 0;
 
     if (words == NULL)
@@ -51,13 +78,13 @@ char** parse_command(const char* command)
         return NULL;
     }
 
-    while (*current != '\0')
+    while (TRUE)
     {
-        if (isspace(*current))
+        if (*current == '\0' || isspace(*current) || *current == PIPE_SEPARATOR[0])
         {
-            if (in_word)
+            if (word_len > 0)
             {
-                words[count] = malloc((word_len + 1) * sizeof(char));
+                words[count] = copy_word(start, word_len);
                 if (words[count] == NULL)
                 {
                     free_array((void**)words, count);
@@ -65,40 +92,36 @@ char** parse_command(const char* command)
 
                     return NULL;
                 }
-                strncpy(words[count], start, word_len);
-                words[count][word_len] = '\0';
-
                 count++;
                 word_len = 0;
-                in_word  = FALSE;
+            }
+            if (*current == '\0')
+            {
+                break;
+            }
+            if (*current == PIPE_SEPARATOR[0])
+            {
+                words[count] = copy_word(current, 1);
+                if (words[count] == NULL)
+                {
+                    free_array((void**)words, count);
+                    free(words);
+
+                    return NULL;
+                }
+                count++;
             }
         }
         else
         {
-            if (!in_word)
+            if (word_len == 0)
             {
-                in_word = TRUE;
-                start   = current;
+                start = current;
             }
             word_len++;
         }
         current++;
     }
-
-    if (word_len > 0)
-    {
-        words[count] = malloc((word_len + 1) * sizeof(char));
-        if (words[count] == NULL)
-        {
-            free_array((void**)words, count);
-            free(words);
-
-            return NULL;
-        }
-        strncpy(words[count], start, word_len);
-        words[count][word_len] = '\0';
-        count++;
-    }
     words[count] = NULL;
 
     return words;
@@ -169,40 +192,143 @@ void handle_builtin(char* const argv[])
 }
 
 /**
- * Handles a command that executes a file.
+ * Prints the exit code of a process after it terminates.
  *
- * `argv`: The command that was entered, split into words.
+ * `name`: The name of the program that the process executes.
+ * `pid`: The process ID of the process.
  */
-void handle_executable(char* const argv[])
+void wait_for_exit(const char* name, pid_t pid)
 {
     int exitcode                         = 0;
-    pid_t pid                            = exec(argv[0], argv);
     char exitcode_buffer[MAX_INT_STRLEN] = { 0 };
 
-    if (pid == -1)
-    {
-        print_str("YehudaSH: execution of ");
-        print_str(argv[0]);
-        print_str(" has failed\n");
-
-        return;
-    }
-
     if (waitpid(pid, &exitcode) == -1)
     {
         print_str("Failed to retrieve the exit code of ");
-        print_str(argv[0]);
+        print_str(name);
     }
     else
     {
         int_to_string(exitcode, exitcode_buffer);
-        print_str(argv[0]);
+        print_str(name);
         print_str(" has exited with exit code ");
         print_str(exitcode_buffer);
     }
     print_newline();
 }
 
+/**
+ * Handles a command that executes files, which may be a pipeline of commands
+ * separated by `|`.
+ * All the commands of a pipeline run together, and each one reads the output
+ * of the previous one through a pipe.
+ *
+ * `argv`: The command that was entered, split into words.
+ *
+ * returns: `TRUE` on success and `FALSE` on an allocation failure.
+ */
+bool_t handle_executable(char** argv)
+{
+    size_t stages   = 1;
+    pid_t* pids     = NULL;
+    char** stage    = argv;
+    char** end      = NULL;
+    char* separator = NULL;
+    int input       = STDIN;
+    int output      = STDOUT;
+    int pipe_fds[2] = { 0 };
+    size_t started  = 0;
+
+    for (char** current = argv; *current != NULL; current++)
+    {
+        if (strcmp(*current, PIPE_SEPARATOR) == 0)
+        {
+            stages++;
+            if (current[1] == NULL || strcmp(current[1], PIPE_SEPARATOR) == 0)
+            {
+                print_str("YehudaSH: syntax error near `|'\n");
+
+                return TRUE;
+            }
+        }
+    }
+    pids = calloc(stages, sizeof(pid_t));
+    if (pids == NULL)
+    {
+        return FALSE;
+    }
+
+    for (started = 0; started < stages; started++)
+    {
+        end = stage;
+        while (*end != NULL && strcmp(*end, PIPE_SEPARATOR) != 0)
+        {
+            end++;
+        }
+        output = STDOUT;
+        if (*end != NULL)
+        {
+            if (pipe(pipe_fds) == -1)
+            {
+                print_str("YehudaSH: failed to create a pipe\n");
+                break;
+            }
+            output = pipe_fds[1];
+        }
+
+        // every command is terminated for `exec` while it runs
+        separator     = *end;
+        *end          = NULL;
+        pids[started] = exec_redirect(stage[0], stage, input, output);
+        *end          = separator;
+        if (pids[started] == -1)
+        {
+            print_str("YehudaSH: execution of ");
+            print_str(stage[0]);
+            print_str(" has failed\n");
+        }
+
+        // the processes opened their own ends of the pipes
+        if (input != STDIN)
+        {
+            close(input);
+        }
+        if (output != STDOUT)
+        {
+            close(output);
+            input = pipe_fds[0];
+        }
+        if (separator != NULL)
+        {
+            stage = end + 1;
+        }
+    }
+    if (started < stages && input != STDIN)
+    {
+        close(input);
+    }
+
+    stage = argv;
+    for (size_t i = 0; i < started; i++)
+    {
+        if (pids[i] != -1)
+        {
+            wait_for_exit(stage[0], pids[i]);
+        }
+        while (*stage != NULL && strcmp(*stage, PIPE_SEPARATOR) != 0)
+        {
+            stage++;
+        }
+        if (*stage != NULL)
+        {
+            stage++;
+        }
+    }
+    free(pids);
+
+    return TRUE;
+}
+
 /**
  * Gets a command from the user and handles it.
  *
@@ -215,6 +341,7 @@ bool_t handle_command()
     char** command_args = NULL;
     char** current      = NULL;
     char* dir           = get_current_dir_name();
+    bool_t success      = TRUE;
 
     if (dir == NULL)
     {
@@ -250,7 +377,7 @@ bool_t handle_command()
 
     if (is_executable(command_args[0]))
     {
-        handle_executable((char* const*)command_args);
+        success = handle_executable(command_args);
     }
     else
     {
@@ -267,7 +394,7 @@ bool_t handle_command()
     free(command_args);
     command_args = NULL;
 
-    return TRUE;
+    return success;
 }
 
 int main()
@@ -286,13 +413,10 @@ int main()
 // Tell the compiler incoming stack alignment is not RSP%16==8 or ESP%16==12
 __attribute__((force_align_arg_pointer)) void _start()
 {
-    asm("call main");
-
-    /* exit system call */
-    asm("mov $0, %rdi;"
+    /* flush the output and exit with the exit code of main */
+    asm("call main;"
         "mov %eax, %edi;"
-        "mov $0x3c, %rax;"
-        "syscall");
+        "call exit_process");
     // tell the compiler to make sure side effects are done before the asm
     // statement
     __builtin_unreachable();
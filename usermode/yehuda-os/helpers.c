@@ -1,70 +1,261 @@
 #include "helpers.h"
+#include "stream.h"
 #include "sys.h"
 
+// the routines below go over 8-byte words. A word is only read from an
+// address that is aligned to a word, so it never crosses a page boundary and
+// can't fault past the end of a string.
+#define WORD_SIZE sizeof(size_t)
+#define LOW_BITS ((size_t)-1 / 0xFF) // 0x0101010101010101
+#define HIGH_BITS (LOW_BITS * 0x80) // 0x8080808080808080
+
+// a word that may be stored at any address
+typedef size_t __attribute__((may_alias, aligned(1))) unaligned_word_t;
+// a word that is stored at an aligned address
+typedef size_t __attribute__((may_alias)) word_t;
+
+/**
+ * Check whether any of the bytes of the word `word` is zero.
+ */
+static bool_t has_zero_byte(size_t word)
+{
+    return ((word - LOW_BITS) & ~word & HIGH_BITS) != 0;
+}
+
+static bool_t is_aligned(const void* ptr)
+{
+    return ((size_t)ptr & (WORD_SIZE - 1)) == 0;
+}
+
+void* memcpy(void* dest, const void* src, size_t n)
+{
+    unsigned char* d       = dest;
+    const unsigned char* s = src;
+
+    // align the destination, since unaligned stores are the slower ones
+    while (n > 0 && !is_aligned(d))
+    {
+        *d++ = *s++;
+        n--;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE)
+    {
+        *(word_t*)d = *(const unaligned_word_t*)s;
+        d += WORD_SIZE;
+        s += WORD_SIZE;
+    }
+    while (n > 0)
+    {
+        *d++ = *s++;
+        n--;
+    }
+
+    return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t n)
+{
+    unsigned char* d       = dest;
+    const unsigned char* s = src;
+
+    // copying forwards is only wrong when the destination starts inside
+    // the source
+    if (d <= s || d >= s + n)
+    {
+        return memcpy(dest, src, n);
+    }
+
+    d += n;
+    s += n;
+    while (n > 0 && !is_aligned(d))
+    {
+        *--d = *--s;
+        n--;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE)
+    {
+        d -= WORD_SIZE;
+        s -= WORD_SIZE;
+        *(word_t*)d = *(const unaligned_word_t*)s;
+    }
+    while (n > 0)
+    {
+        *--d = *--s;
+        n--;
+    }
+
+    return dest;
+}
+
+void* memset(void* dest, int c, size_t n)
+{
+    unsigned char* d  = dest;
+    const size_t WORD = LOW_BITS * (unsigned char)c;
+
+    while (n > 0 && !is_aligned(d))
+    {
+        *d++ = (unsigned char)c;
+        n--;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE)
+    {
+        *(word_t*)d = WORD;
+        d += WORD_SIZE;
+    }
+    while (n > 0)
+    {
+        *d++ = (unsigned char)c;
+        n--;
+    }
+
+    return dest;
+}
+
+int memcmp(const void* ptr1, const void* ptr2, size_t n)
+{
+    const unsigned char* p1 = ptr1;
+    const unsigned char* p2 = ptr2;
+
+    // skip the equal words, the first different byte is found below
+    while (n >= WORD_SIZE && *(const unaligned_word_t*)p1 == *(const unaligned_word_t*)p2)
+    {
+        p1 += WORD_SIZE;
+        p2 += WORD_SIZE;
+        n -= WORD_SIZE;
+    }
+    for (; n > 0; n--)
+    {
+        if (*p1 != *p2)
+        {
+            return *p1 > *p2 ? 1 : -1;
+        }
+        p1++;
+        p2++;
+    }
+
+    return 0;
+}
+
 size_t strlen(const char* s)
 {
-    size_t count = 0;
+    const char* p = s;
 
-    while (*s)
+    while (!is_aligned(p))
+    {
+        if (*p == '\0')
+        {
+            return p - s;
+        }
+        p++;
+    }
+    while (!has_zero_byte(*(const word_t*)p))
     {
-        count++;
-        s++;
+        p += WORD_SIZE;
+    }
+    while (*p != '\0')
+    {
+        p++;
     }
 
-    return count;
+    return p - s;
 }
 
 char* strcpy(char* destination, const char* source)
 {
-    char* ptr = destination;
+    char* ptr   = destination;
+    size_t word = 0;
 
-    while (*source != '\0')
+    while (!is_aligned(source))
+    {
+        if ((*ptr++ = *source++) == '\0')
+        {
+            return destination;
+        }
+    }
+    // copy the words that don't hold the null terminator
+    while (!has_zero_byte(word = *(const word_t*)source))
+    {
+        *(unaligned_word_t*)ptr = word;
+        ptr += WORD_SIZE;
+        source += WORD_SIZE;
+    }
+    while ((*ptr++ = *source++) != '\0')
     {
-        *destination = *source;
-        destination++;
-        source++;
     }
-    *destination = '\0';
 
-    return ptr;
+    return destination;
 }
 
 char* strncpy(char* dest, const char* src, size_t n)
 {
-    size_t i = 0;
+    size_t len = 0;
 
     if ((dest == NULL) || (src == NULL))
     {
         return NULL;
     }
 
-
-    for (i = 0; i < n && src[i] != '\0'; i++)
+    // the length of the source is only searched up to `n` bytes, so a
+    // source that isn't terminated is never read past them
+    while (len < n && !is_aligned(src + len))
     {
-        dest[i] = src[i];
+        if (src[len] == '\0')
+        {
+            break;
+        }
+        len++;
     }
-    for (; i < n; i++)
+    if (len < n && src[len] != '\0')
     {
-        dest[i] = '\0';
+        while (n - len >= WORD_SIZE && !has_zero_byte(*(const word_t*)(src + len)))
+        {
+            len += WORD_SIZE;
+        }
+        while (len < n && src[len] != '\0')
+        {
+            len++;
+        }
     }
+    memcpy(dest, src, len);
+    memset(dest + len, '\0', n - len);
 
     return dest;
 }
 
 int strcmp(const char* str1, const char* str2)
 {
-    int i = 0;
+    size_t word = 0;
+
+    // words can only be compared when both strings reach an aligned address
+    // together, otherwise the words of one of them could cross a page
+    if (((size_t)str1 & (WORD_SIZE - 1)) == ((size_t)str2 & (WORD_SIZE - 1)))
+    {
+        while (!is_aligned(str1) && *str1 == *str2 && *str1 != '\0')
+        {
+            str1++;
+            str2++;
+        }
+        if (is_aligned(str1))
+        {
+            while ((word = *(const word_t*)str1) == *(const word_t*)str2 && !has_zero_byte(word))
+            {
+                str1 += WORD_SIZE;
+                str2 += WORD_SIZE;
+            }
+        }
+    }
 
-    while (str1[i] == str2[i])
+    while (*str1 == *str2)
     {
-        if (str1[i] == '\0')
+        if (*str1 == '\0')
         {
             return 0;
         }
-        i++;
+        str1++;
+        str2++;
     }
 
-    return str1[i] > str2[i] ? 1 : -1;
+    return (unsigned char)*str1 > (unsigned char)*str2 ? 1 : -1;
 }
 
 int isspace(int c)
@@ -86,16 +277,18 @@ void free_array(void** arr, size_t size)
 
 /**
  * Reads a line from the console.
+ * All the input that is pending is read at once, see `read_char`, and the
+ * line is echoed through the output buffer.
  *
  * returns: The line that was read or `NULL` on an allocation failure.
  *          The returned buffer must be freed by the caller.
  */
 char* getline()
 {
-    ssize_t bytes_read = 0;
-    size_t current     = 0;
-    size_t len         = 1;
-    char* buffer       = NULL;
+    size_t current = 0;
+    size_t len     = 1;
+    char* buffer   = NULL;
+    int c          = 0;
 
     do
     {
@@ -110,41 +303,40 @@ char* getline()
             }
         }
 
-        bytes_read = read(STDIN, buffer + current, 1, 0);
-        if (bytes_read == -1)
+        c = read_char();
+        if (c == -1)
         {
             free(buffer);
 
             return NULL;
         }
-        else if (bytes_read == 1)
+        else if (c == '\b')
         {
-            if (buffer[current] == '\b')
-            {
-                if (current > 0)
-                {
-                    print_str("\b \b");
-                    current--;
-                }
-            }
-            else
+            if (current > 0)
             {
-                write(STDOUT, buffer + current, 1, 0);
-                current++;
+                print_str("\b \b");
+                current--;
             }
         }
-    } while (buffer[current - bytes_read] != '\n');
-    buffer[current - bytes_read] = '\0';
+        else
+        {
+            buffer[current] = (char)c;
+            write_out(buffer + current, 1);
+            current++;
+        }
+    } while (c != '\n');
+    buffer[current - 1] = '\0';
 
     return buffer;
 }
 
 /**
  * Print a string `str` to the screen.
+ * The string is buffered, see `write_out`.
  */
 void print_str(const char* str)
 {
-    write(STDOUT, str, strlen(str), 0);
+    write_out(str, strlen(str));
 }
 
 /**
@@ -152,7 +344,7 @@ void print_str(const char* str)
  */
 void print_newline()
 {
-    write(STDOUT, "\n", 1, 0);
+    write_out("\n", 1);
 }
 
 /**
@@ -200,16 +392,7 @@ void int_to_string(int num, char* buffer)
 
 char* strcat(char* dst, const char* src)
 {
-    char* ptr = dst + strlen(dst);
-
-    // appends characters of the source to the destination string
-    while (*src != '\0')
-    {
-        *ptr++ = *src++;
-    }
-
-    // null terminate destination string
-    *ptr = '\0';
+    strcpy(dst + strlen(dst), src);
 
     // the destination is returned by standard `strcat()`
     return dst;
@@ -1,7 +1,16 @@
 #ifndef YEHUDAOS_HELPERS
 #define YEHUDAOS_HELPERS
+#include "stream.h"
 #include "sys.h"
 
+void* memcpy(void* dest, const void* src, size_t n);
+
+void* memmove(void* dest, const void* src, size_t n);
+
+void* memset(void* dest, int c, size_t n);
+
+int memcmp(const void* ptr1, const void* ptr2, size_t n);
+
 size_t strlen(const char* s);
 
 char* strcpy(char* destination, const char* source);
@@ -0,0 +1,208 @@
+#include "helpers.h"
+#include "sys.h"
+
+// Small allocations are served from free lists of size classes that are
+// carved out of large chunks of the kernel's allocator, so that most calls to
+// `malloc` and `free` don't trap into the kernel.
+// Every block starts with a header that keeps the block 16-byte aligned,
+// like the kernel's allocator does.
+
+#define MIN_CLASS_SIZE 16
+#define CLASSES        8 // 16 bytes up to 2KiB
+#define MAX_CLASS_SIZE (MIN_CLASS_SIZE << (CLASSES - 1))
+#define CHUNK_SIZE     0x10000
+#define HUGE_CLASS     ((size_t)-1) // allocated directly with `sys_malloc`
+
+struct BlockHeader
+{
+    size_t size;  // the size that was requested
+    size_t class; // the index of the size class or `HUGE_CLASS`
+};
+
+struct FreeBlock
+{
+    struct FreeBlock* next;
+};
+
+static struct FreeBlock* free_lists[CLASSES];
+static char* chunk_current = NULL; // the part of the chunk that wasn't carved yet
+static char* chunk_end     = NULL;
+
+/**
+ * Get the smallest size class that fits a size.
+ *
+ * `size`: The size, must be at most `MAX_CLASS_SIZE`.
+ *
+ * returns: The index of the size class.
+ */
+static size_t size_class(size_t size)
+{
+    size_t class = 0;
+
+    while ((MIN_CLASS_SIZE << class) < size)
+    {
+        class++;
+    }
+
+    return class;
+}
+
+/**
+ * Get the header of a block from the pointer that was returned to the user.
+ */
+static struct BlockHeader* header_of(void* ptr)
+{
+    return (struct BlockHeader*)ptr - 1;
+}
+
+/**
+ * Carve a block of a size class from the current chunk, taking a new chunk
+ * from the kernel if it doesn't fit.
+ * The rest of the old chunk is left unused.
+ *
+ * `class`: The index of the size class.
+ *
+ * returns: The header of the block or null if the kernel is out of memory.
+ */
+static struct BlockHeader* carve(size_t class)
+{
+    const size_t BLOCK_SIZE   = sizeof(struct BlockHeader) + (MIN_CLASS_SIZE << class);
+    struct BlockHeader* block = NULL;
+
+    if (chunk_current == NULL || (size_t)(chunk_end - chunk_current) < BLOCK_SIZE)
+    {
+        chunk_current = sys_malloc(CHUNK_SIZE);
+        if (chunk_current == NULL)
+        {
+            return NULL;
+        }
+        chunk_end = chunk_current + CHUNK_SIZE;
+    }
+    block = (struct BlockHeader*)chunk_current;
+    chunk_current += BLOCK_SIZE;
+
+    return block;
+}
+
+void* malloc(size_t size)
+{
+    struct BlockHeader* block = NULL;
+    size_t class              = 0;
+
+    if (size > MAX_CLASS_SIZE)
+    {
+        if (size > (size_t)-1 - sizeof(struct BlockHeader))
+        {
+            return NULL;
+        }
+        block = sys_malloc(sizeof(struct BlockHeader) + size);
+        if (block == NULL)
+        {
+            return NULL;
+        }
+        block->class = HUGE_CLASS;
+    }
+    else
+    {
+        class = size_class(size);
+        if (free_lists[class] != NULL)
+        {
+            block             = (struct BlockHeader*)free_lists[class];
+            free_lists[class] = free_lists[class]->next;
+        }
+        else
+        {
+            block = carve(class);
+            if (block == NULL)
+            {
+                return NULL;
+            }
+        }
+        block->class = class;
+    }
+    block->size = size;
+
+    return block + 1;
+}
+
+void* calloc(size_t nitems, size_t size)
+{
+    void* ptr = NULL;
+
+    if (size != 0 && nitems > (size_t)-1 / size)
+    {
+        return NULL;
+    }
+    ptr = malloc(nitems * size);
+    if (ptr != NULL)
+    {
+        memset(ptr, 0, nitems * size);
+    }
+
+    return ptr;
+}
+
+void free(void* ptr)
+{
+    struct BlockHeader* block = NULL;
+    struct FreeBlock* freed   = NULL;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+    block = header_of(ptr);
+    if (block->class == HUGE_CLASS)
+    {
+        sys_free(block);
+        return;
+    }
+    // the list link is stored in the header, which isn't needed while the
+    // block is free, and the class is known from the list it is in
+    freed                    = (struct FreeBlock*)block;
+    freed->next              = free_lists[block->class];
+    free_lists[block->class] = freed;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    struct BlockHeader* block = NULL;
+    void* new_ptr             = NULL;
+
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+    block = header_of(ptr);
+    if (block->class == HUGE_CLASS && size > MAX_CLASS_SIZE)
+    {
+        if (size > (size_t)-1 - sizeof(struct BlockHeader))
+        {
+            return NULL;
+        }
+        block = sys_realloc(block, sizeof(struct BlockHeader) + size);
+        if (block == NULL)
+        {
+            return NULL;
+        }
+        block->size = size;
+
+        return block + 1;
+    }
+    if (block->class != HUGE_CLASS && size <= (MIN_CLASS_SIZE << block->class))
+    {
+        block->size = size;
+
+        return ptr;
+    }
+
+    new_ptr = malloc(size);
+    if (new_ptr == NULL)
+    {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, block->size < size ? block->size : size);
+    free(ptr);
+
+    return new_ptr;
+}
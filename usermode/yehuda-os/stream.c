@@ -0,0 +1,123 @@
+#include "stream.h"
+#include "helpers.h"
+#include "sys.h"
+
+static char out_buffer[STDOUT_BUFFER_SIZE];
+static size_t out_length      = 0;
+static buffer_mode_t out_mode = BUFFER_LINE;
+static char in_buffer[STDIN_BUFFER_SIZE]; // the input that was read and not returned yet
+static size_t in_start        = 0;
+static size_t in_end          = 0;
+
+/**
+ * Set when the output is written to the console.
+ * The output that is buffered already is flushed first.
+ *
+ * `mode`: The buffering mode, `BUFFER_LINE` by default.
+ */
+void set_output_buffering(buffer_mode_t mode)
+{
+    flush();
+    out_mode = mode;
+}
+
+/**
+ * Write bytes to the standard output through its buffer.
+ * Data that is larger than the buffer is written directly, in pieces that
+ * fit in a pipe in case the output is a pipe.
+ *
+ * `data`: The bytes to write.
+ * `count`: The amount of bytes.
+ */
+void write_out(const char* data, size_t count)
+{
+    size_t chunk = 0;
+    size_t i     = count;
+
+    if (out_mode == BUFFER_NONE || count >= STDOUT_BUFFER_SIZE)
+    {
+        flush();
+        while (i > 0)
+        {
+            chunk = i < MAX_WRITE_SIZE ? i : MAX_WRITE_SIZE;
+            write(STDOUT, data + count - i, chunk, 0);
+            i -= chunk;
+        }
+
+        return;
+    }
+
+    chunk = count < STDOUT_BUFFER_SIZE - out_length ? count : STDOUT_BUFFER_SIZE - out_length;
+    memcpy(out_buffer + out_length, data, chunk);
+    out_length += chunk;
+    if (out_length == STDOUT_BUFFER_SIZE)
+    {
+        flush();
+        memcpy(out_buffer, data + chunk, count - chunk);
+        out_length = count - chunk;
+    }
+
+    if (out_mode == BUFFER_LINE)
+    {
+        while (i > 0 && data[i - 1] != '\n')
+        {
+            i--;
+        }
+        if (i > 0)
+        {
+            flush();
+        }
+    }
+}
+
+/**
+ * Write the buffered output to the console.
+ */
+void flush()
+{
+    if (out_length > 0)
+    {
+        write(STDOUT, out_buffer, out_length, 0);
+        out_length = 0;
+    }
+}
+
+/**
+ * Read a character from the standard input.
+ * All the bytes that are pending in the standard input are read together,
+ * and the output is flushed before waiting for more, so everything that was
+ * printed so far (like a prompt or an echo of the input) is shown.
+ *
+ * returns: The character, or -1 on failure or at the end of the input.
+ */
+int read_char()
+{
+    ssize_t count = 0;
+
+    if (in_start == in_end)
+    {
+        flush();
+        count = read(STDIN, in_buffer, STDIN_BUFFER_SIZE, 0);
+        // reading waits for input, so nothing is read only at the end of a pipe
+        if (count <= 0)
+        {
+            return -1;
+        }
+        in_start = 0;
+        in_end   = (size_t)count;
+    }
+
+    return (unsigned char)in_buffer[in_start++];
+}
+
+/**
+ * Flush the output and terminate the process.
+ * The `_start` of every program calls it with the value `main` returns.
+ *
+ * `status`: The exit code of the process.
+ */
+void exit_process(int status)
+{
+    flush();
+    exit(status);
+}
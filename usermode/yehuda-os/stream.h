@@ -0,0 +1,30 @@
+#ifndef YEHUDAOS_STREAM
+#define YEHUDAOS_STREAM
+#include "defines.h"
+
+#define STDOUT_BUFFER_SIZE 1024
+#define STDIN_BUFFER_SIZE 256
+// the most that can be written to a pipe at once
+#define MAX_WRITE_SIZE 4096
+
+typedef enum
+{
+    // every write goes to the console right away
+    BUFFER_NONE,
+    // the output is written when a newline is written or the buffer fills
+    BUFFER_LINE,
+    // the output is only written when the buffer fills or it is flushed
+    BUFFER_FULL
+} buffer_mode_t;
+
+void set_output_buffering(buffer_mode_t mode);
+
+void write_out(const char* data, size_t count);
+
+void flush();
+
+int read_char();
+
+void exit_process(int status);
+
+#endif // YEHUDAOS_STREAM
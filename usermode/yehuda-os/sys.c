@@ -1,14 +1,18 @@
 #include "sys.h"
+#include "helpers.h"
 
 const size_t READ                 = 0x0;
 const size_t WRITE                = 0x1;
 const size_t OPEN                 = 0x2;
+const size_t CLOSE                = 0x3;
 const size_t FSTAT                = 0x5;
 const size_t WAITPID              = 0x7;
 const size_t MALLOC               = 0x9;
-const size_t CALLOC               = 0xa;
 const size_t FREE                 = 0xb;
 const size_t REALLOC              = 0xc;
+const size_t MMAP                 = 0xd;
+const size_t MUNMAP               = 0xe;
+const size_t PIPE                 = 0x16;
 const size_t EXEC                 = 0x3b;
 const size_t EXIT                 = 0x3c;
 const size_t GET_CURRENT_DIR_NAME = 0x4f;
@@ -18,6 +22,7 @@ const size_t REMOVE_FILE          = 0x57;
 const size_t READ_DIR             = 0x59;
 const size_t TRUNCATE             = 0x4c;
 const size_t FTRUNCATE            = 0x4d;
+const size_t GETDENTS             = 0x4e;
 
 size_t
 syscall(size_t syscall_number, size_t arg0, size_t arg1, size_t arg2, size_t arg3, size_t arg4, size_t arg5)
@@ -115,60 +120,108 @@ int waitpid(pid_t pid, int* wstatus)
 }
 
 /**
- * Allocate memory for a userspace program.
+ * Allocate memory from the kernel's allocator of the process.
+ * Every call is a trap into the kernel, so programs should use `malloc`,
+ * which only calls this function for large chunks of memory.
  *
  * `size`: The size of the allocation.
  *
- * returns: Apointer to the allocation or null on failure.
+ * returns: A pointer to the allocation or null on failure.
  */
-void* malloc(size_t size)
+void* sys_malloc(size_t size)
 {
     return (void*)syscall(MALLOC, size, 0, 0, 0, 0, 0);
 }
 
 /**
- * Behaves like `malloc`, but sets the memory to 0.
+ * Deallocate an allocation that was allocated with `sys_malloc`.
  *
- * `nitems`: The number of elements to be allocated.
- * `size`: The size of each element.
+ * `ptr`: The pointer to the allocation that was returned from `sys_malloc`.
  */
-void* calloc(size_t nitems, size_t size)
+void sys_free(void* ptr)
 {
-    return (void*)syscall(CALLOC, nitems, size, 0, 0, 0, 0);
+    syscall(FREE, (size_t)ptr, 0, 0, 0, 0, 0);
 }
 
 /**
- * Deallocate an allocation that was allocated with `malloc`.
+ * Grow or shrink a block that was allocated with `sys_malloc`.
+ * Copies the data from the original block to the new block.
+ *
+ * `ptr`: The block that was allocated with `sys_malloc`, must not be `NULL`.
+ * `size`: The new required size of the block.
  *
- * `ptr`: The pointer to the allocation that was returned from `malloc`.
+ * returns: A pointer to a new allocation or null on failure.
  */
-void free(void* ptr)
+void* sys_realloc(void* ptr, size_t size)
 {
-    syscall(FREE, (size_t)ptr, 0, 0, 0, 0, 0);
+    return (void*)syscall(REALLOC, (size_t)ptr, size, 0, 0, 0, 0);
 }
 
 /**
- * Grow or shrink a block that was allocated with `malloc`.
- * Copies the data from the original block to the new block.
+ * Map a file read-only into the address space of the process, so that its
+ * data can be read without being copied.
+ * The mapping shows the changes that are written to the file, and it must be
+ * unmapped before the file is truncated or removed.
  *
- * `ptr`: The block that was allocated with `malloc`.
- *        If `ptr` is `NULL`, then the call is equivalent to `malloc(size)`
- * `size`: The new required size of the block.
+ * `fd`: The file descriptor of the file.
  *
- * returns: A pointer to a new allocation or null on failure.
+ * returns: A pointer to the data of the file, or null on failure.
+ *          Possible failures:
+ *          - `fd` is negative or invalid.
+ *          - `fd` is a directory.
+ *          - The file is empty.
  */
-void* realloc(void* ptr, size_t size)
+const void* mmap(int fd)
 {
-    if (ptr == NULL)
-    {
-        return malloc(size);
-    }
+    return (const void*)syscall(MMAP, fd, 0, 0, 0, 0, 0);
+}
 
-    return (void*)syscall(REALLOC, (size_t)ptr, size, 0, 0, 0, 0);
+/**
+ * Unmap a file that was mapped with `mmap`.
+ *
+ * `addr`: The pointer that `mmap` returned.
+ * `length`: The size of the file when it was mapped.
+ *
+ * returns: 0 on success or -1 if `addr` was not returned from `mmap`.
+ */
+int munmap(const void* addr, size_t length)
+{
+    return (int)syscall(MUNMAP, (size_t)addr, length, 0, 0, 0, 0);
+}
+
+/**
+ * Create a pipe, a buffer that one process writes into and another process
+ * reads from.
+ * Reading an empty pipe waits for data, and returns 0 once all the processes
+ * that have the write end open closed it.
+ *
+ * `fds`: A buffer to write the file descriptors of the read end and the
+ *        write end into, in that order.
+ *
+ * returns: 0 on success or -1 on failure.
+ */
+int pipe(int fds[2])
+{
+    return (int)syscall(PIPE, (size_t)fds, 0, 0, 0, 0, 0);
+}
+
+/**
+ * Close a file descriptor.
+ * The ends of pipes must be closed when they are no longer used, so that the
+ * process on the other end knows the pipe has ended.
+ *
+ * `fd`: The file descriptor.
+ *
+ * returns: 0 on success or -1 if `fd` is not open.
+ */
+int close(int fd)
+{
+    return (int)syscall(CLOSE, fd, 0, 0, 0, 0, 0);
 }
 
 /**
  * Execute a program in a new process.
+ * The new process uses the standard input and output of the calling process.
  *
  * `pathname`: Path to the file to execute, must be a valid ELF file.
  * `argv`: The commandline arguments.
@@ -177,7 +230,26 @@ void* realloc(void* ptr, size_t size)
  */
 int exec(const char* pathname, char* const argv[])
 {
-    return (int)syscall(EXEC, (size_t)pathname, (size_t)argv, 0, 0, 0, 0);
+    return exec_redirect(pathname, argv, STDIN, STDOUT);
+}
+
+/**
+ * Execute a program in a new process with a different standard input or output.
+ * The new process opens the ends of the pipes it gets, so the calling
+ * process can close them afterwards.
+ *
+ * `pathname`: Path to the file to execute, must be a valid ELF file.
+ * `argv`: The commandline arguments.
+ * `stdin_fd`: `STDIN` to use the standard input of the calling process, or the
+ *             read end of a pipe.
+ * `stdout_fd`: `STDOUT` to use the standard output of the calling process, or
+ *              the write end of a pipe.
+ *
+ * returns: The process ID of the new process if the operation was successful, -1 otherwise.
+ */
+int exec_redirect(const char* pathname, char* const argv[], int stdin_fd, int stdout_fd)
+{
+    return (int)syscall(EXEC, (size_t)pathname, (size_t)argv, stdin_fd, stdout_fd, 0, 0);
 }
 
 /**
@@ -203,7 +275,25 @@ void exit(int status)
  */
 char* get_current_dir_name()
 {
-    return (char*)syscall(GET_CURRENT_DIR_NAME, 0, 0, 0, 0, 0, 0);
+    // the kernel allocates the name with its own allocator, so it's copied
+    // into a buffer that can be freed with `free`
+    char* kernel_name = (char*)syscall(GET_CURRENT_DIR_NAME, 0, 0, 0, 0, 0, 0);
+    char* name        = NULL;
+    size_t size       = 0;
+
+    if (kernel_name == NULL)
+    {
+        return NULL;
+    }
+    size = strlen(kernel_name) + 1;
+    name = malloc(size);
+    if (name != NULL)
+    {
+        memcpy(name, kernel_name, size);
+    }
+    sys_free(kernel_name);
+
+    return name;
 }
 
 /**
@@ -251,6 +341,7 @@ int remove_file(const char* path)
 
 /**
  * Read a directory entry.
+ * Listing a whole directory is faster with `getdents`.
  *
  * `fd`: The file descriptor of the directory.
  * `offset`: The offset **in files** inside the directory to read from.
@@ -266,6 +357,26 @@ int readdir(int fd, size_t offset, struct DirEntry* dirp)
     return (int)syscall(READ_DIR, fd, offset, (size_t)dirp, 0, 0, 0);
 }
 
+/**
+ * Read many entries of a directory at once, together with the information
+ * that `fstat` returns about every entry.
+ *
+ * `fd`: The file descriptor of the directory.
+ * `offset`: The offset **in files** inside the directory of the first entry to read.
+ * `dirp`: A buffer of `count` entries to write the data into.
+ * `count`: The maximal amount of entries to read.
+ *
+ * returns: The amount of entries that were read, 0 at the end of the directory,
+ *          or -1 on failure.
+ *          Possible failures:
+ *          - `fd` is negative or invalid.
+ *          - `fd` is not a directory.
+ */
+int getdents(int fd, size_t offset, struct Dirent* dirp, size_t count)
+{
+    return (int)syscall(GETDENTS, fd, offset, (size_t)dirp, count, 0, 0);
+}
+
 /**
  * Change the length of a file to a specific ljength.
  * If the file has been set to a greater length, reading the extra data will return null bytes
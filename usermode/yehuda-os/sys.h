@@ -19,6 +19,14 @@ struct DirEntry
     size_t id;
 };
 
+struct Dirent
+{
+    char name[FILE_NAME_LEN];
+    size_t id;
+    size_t size; // the amount of files for directories
+    bool_t directory;
+};
+
 ssize_t read(int fd, void* buf, size_t count, size_t offset);
 
 int write(int fd, const void* buf, size_t count, size_t offset);
@@ -27,6 +35,12 @@ int open(const char* pathname);
 
 int fstat(int fd, struct Stat* statbuf);
 
+void* sys_malloc(size_t size);
+
+void sys_free(void* ptr);
+
+void* sys_realloc(void* ptr, size_t size);
+
 void* malloc(size_t size);
 
 void* calloc(size_t nitems, size_t size);
@@ -35,8 +49,18 @@ void free(void* ptr);
 
 void* realloc(void* ptr, size_t size);
 
+const void* mmap(int fd);
+
+int munmap(const void* addr, size_t length);
+
+int pipe(int fds[2]);
+
+int close(int fd);
+
 int exec(const char* pathname, char* const argv[]);
 
+int exec_redirect(const char* pathname, char* const argv[], int stdin_fd, int stdout_fd);
+
 void exit(int status);
 
 char* get_current_dir_name();
@@ -49,6 +73,8 @@ int remove_file(const char* path);
 
 int readdir(int fd, size_t offset, struct DirEntry* dirp);
 
+int getdents(int fd, size_t offset, struct Dirent* dirp, size_t count);
+
 int truncate(const char* path, size_t length);
 
 int ftruncate(int fd, size_t length);